@@ -0,0 +1,644 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Benchmarks for the xdg-desktop-portal backend.
+
+  The backend is compiled into this program (by including nfd_portal.cpp) so that its internal
+  functions can be measured directly.  The round-trip and async benchmarks need a portal on the
+  session bus; run the program through nfd_mock_portal (the `run_nfd_bench` target does this).
+  They are reported as skipped if no portal is available.
+
+  With --replay, the program instead replays a trace captured with NFD_SetTraceFile() (or the
+  NFD_TRACE_FILE environment variable): every Response signal in it is fed through the same
+  parsing and decoding code as a real dialog, without any bus.
+
+  Usage: nfd_bench [--quick] [--only NAME] [--out FILE] [--replay TRACE]
+
+  --quick         use smaller sizes and time budgets (for CI)
+  --only NAME     only run the benchmarks whose name starts with NAME
+  --out FILE      write the JSON results to FILE instead of stdout
+  --replay TRACE  benchmark the Response signals in TRACE instead
+*/
+
+#include "../src/nfd_portal.cpp"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+struct BenchOptions {
+    bool quick = false;
+    const char* only = nullptr;
+    const char* outFile = nullptr;
+    const char* replayFile = nullptr;
+};
+
+BenchOptions g_options;
+
+// Collects results and writes them as one JSON document.
+class JsonReport {
+    std::string body;
+    bool firstResult = true;
+    bool firstField = true;
+
+   public:
+    void begin(const char* name) {
+        body += firstResult ? "\n    {" : ",\n    {";
+        firstResult = false;
+        firstField = true;
+        field("name", name);
+    }
+    void end() { body += "}"; }
+
+    void field(const char* key, const char* value) {
+        separator(key);
+        body += '"';
+        for (const char* p = value; *p; ++p) {
+            if (*p == '"' || *p == '\\') body += '\\';
+            body += *p;
+        }
+        body += '"';
+    }
+    void field(const char* key, double value) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6g", value);
+        separator(key);
+        body += buf;
+    }
+    void field(const char* key, uint64_t value) {
+        separator(key);
+        body += std::to_string(value);
+    }
+
+    void write(FILE* out) const {
+        fprintf(out,
+                "{\n  \"benchmark\": \"nfd_bench\",\n  \"version\": \"%s\",\n"
+                "  \"backend\": \"portal\",\n  \"quick\": %s,\n  \"results\": [%s\n  ]\n}\n",
+                NFD_BENCH_VERSION,
+                g_options.quick ? "true" : "false",
+                body.c_str());
+    }
+
+   private:
+    void separator(const char* key) {
+        if (!firstField) body += ", ";
+        firstField = false;
+        body += '"';
+        body += key;
+        body += "\": ";
+    }
+};
+
+JsonReport g_report;
+
+bool ShouldRun(const char* name) {
+    return !g_options.only || strncmp(name, g_options.only, strlen(g_options.only)) == 0;
+}
+
+// Time budget for a single measurement.
+uint64_t BudgetNs() {
+    return g_options.quick ? 20000000u : 200000000u;
+}
+
+// Runs `fn` repeatedly until the time budget is used up (at least once), and returns the average
+// time per call in nanoseconds.
+template <typename Fn>
+double MeasureNs(Fn&& fn, uint64_t* outIterations = nullptr) {
+    uint64_t iterations = 0;
+    const uint64_t start = NowNs();
+    uint64_t elapsed;
+    do {
+        fn();
+        ++iterations;
+        elapsed = NowNs() - start;
+    } while (elapsed < BudgetNs());
+    if (outIterations) *outIterations = iterations;
+    return static_cast<double>(elapsed) / static_cast<double>(iterations);
+}
+
+// Makes the body of a file URI (without "file://") of the given length, in which roughly one
+// byte in `escapeEvery` is percent-encoded.
+std::string MakeUriBody(size_t length, size_t escapeEvery) {
+    std::string uri;
+    while (uri.size() < length) {
+        if (escapeEvery && uri.size() % escapeEvery == escapeEvery - 1 && uri.size() + 3 <= length)
+            uri += "%20";
+        else if (uri.size() % 16 == 0)
+            uri += '/';
+        else
+            uri += static_cast<char>('a' + uri.size() % 26);
+    }
+    return uri;
+}
+
+void BenchUriDecode() {
+    if (!ShouldRun("uri_decode")) return;
+    const size_t lengths[] = {32, 256, 4096};
+    const size_t escapes[] = {0, 4};
+    for (size_t length : lengths) {
+        for (size_t escapeEvery : escapes) {
+            const std::string uri = MakeUriBody(length, escapeEvery);
+            std::vector<char> out(uri.size() + 1);
+            volatile char sink = 0;
+            const double ns = MeasureNs([&] {
+                size_t decodedLen;
+                const char* uriEnd;
+                if (!TryUriDecodeLen(uri.c_str(), decodedLen, uriEnd)) abort();
+                char* end = UriDecodeUnchecked(uri.c_str(), uriEnd, out.data());
+                *end = '\0';
+                sink = out[decodedLen / 2];
+            });
+            (void)sink;
+            g_report.begin("uri_decode");
+            g_report.field("uri_bytes", static_cast<uint64_t>(uri.size()));
+            g_report.field("escape_every", static_cast<uint64_t>(escapeEvery));
+            g_report.field("ns_per_uri", ns);
+            g_report.field("bytes_per_sec", static_cast<double>(uri.size()) * 1e9 / ns);
+            g_report.end();
+        }
+    }
+}
+
+// Builds a Windows-style filter string ("name\0pattern\0...\0") with `count` filters.
+std::string MakeWinFilter(unsigned count) {
+    std::string filter;
+    for (unsigned i = 0; i != count; ++i) {
+        filter += "Filter " + std::to_string(i);
+        filter += '\0';
+        filter += "*.ext" + std::to_string(i) + ";*.src;*.Data";
+        filter += '\0';
+    }
+    filter += '\0';
+    return filter;
+}
+
+void BenchFilterMarshal() {
+    if (!ShouldRun("filter_marshal")) return;
+    const unsigned counts[] = {1, 8, 64, 512};
+    for (unsigned count : counts) {
+        const std::string winFilter = MakeWinFilter(count);
+        NfdDialogParams params{};
+        params.winFilter = winFilter.c_str();
+        params.filterIndex = 1;
+        params.title = "Benchmark";
+        const double ns = MeasureNs([&] {
+            DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
+                                                              "/org/freedesktop/portal/desktop",
+                                                              "org.freedesktop.portal.FileChooser",
+                                                              "OpenFile");
+            AppendOpenFileQueryParams<false, false>(query, "nfd_bench_token", &params);
+            dbus_message_unref(query);
+        });
+        g_report.begin("filter_marshal");
+        g_report.field("filters", static_cast<uint64_t>(count));
+        g_report.field("ns_per_message", ns);
+        g_report.field("ns_per_filter", ns / count);
+        g_report.end();
+    }
+}
+
+// Builds a Response signal carrying `count` URIs, like the one the portal sends.
+DBusMessage* MakeResponse(size_t count) {
+    DBusMessage* msg = dbus_message_new_signal("/org/freedesktop/portal/desktop/request/1_1/bench",
+                                               "org.freedesktop.portal.Request",
+                                               "Response");
+    DBusMessageIter iter, dict_iter, entry_iter, variant_iter, array_iter;
+    dbus_message_iter_init_append(msg, &iter);
+    const dbus_uint32_t code = 0;
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &code);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
+    dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &entry_iter);
+    const char* key = "uris";
+    dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry_iter, DBUS_TYPE_VARIANT, "as", &variant_iter);
+    dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "s", &array_iter);
+    char uri[128];
+    for (size_t i = 0; i != count; ++i) {
+        snprintf(uri, sizeof(uri), "file:///home/user/Documents/My%%20Project/file-%08zu.txt", i);
+        const char* uri_ptr = uri;
+        dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING, &uri_ptr);
+    }
+    dbus_message_iter_close_container(&variant_iter, &array_iter);
+    dbus_message_iter_close_container(&entry_iter, &variant_iter);
+    dbus_message_iter_close_container(&dict_iter, &entry_iter);
+    dbus_message_iter_close_container(&iter, &dict_iter);
+    return msg;
+}
+
+void ReportPathSet(const char* name, size_t count, double ns) {
+    g_report.begin(name);
+    g_report.field("paths", static_cast<uint64_t>(count));
+    g_report.field("ns_total", ns);
+    g_report.field("ns_per_path", ns / count);
+    g_report.end();
+}
+
+void BenchPathSet() {
+    if (!ShouldRun("pathset")) return;
+    const size_t maxCount = g_options.quick ? 10000 : 1000000;
+    // Indexed access and the Windows-style path list are quadratic, so they get smaller sizes.
+    const size_t maxQuadraticCount = g_options.quick ? 1000 : 10000;
+    for (size_t count = 1; count <= maxCount; count *= 10) {
+        DBusMessage* msg = MakeResponse(count);
+        const nfdpathset_t* pathSet = msg;
+
+        if (ShouldRun("pathset_enum")) {
+            const double ns = MeasureNs([&] {
+                nfdpathsetenum_t enumerator;
+                NFD_PathSet_GetEnum(pathSet, &enumerator);
+                nfdnchar_t* path;
+                while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path)
+                    NFD_PathSet_FreePathN(path);
+                NFD_PathSet_FreeEnum(&enumerator);
+            });
+            ReportPathSet("pathset_enum", count, ns);
+        }
+
+        if (count <= maxQuadraticCount && ShouldRun("pathset_index")) {
+            const double ns = MeasureNs([&] {
+                nfdpathsetsize_t numPaths;
+                NFD_PathSet_GetCount(pathSet, &numPaths);
+                for (nfdpathsetsize_t i = 0; i != numPaths; ++i) {
+                    nfdnchar_t* path;
+                    if (NFD_PathSet_GetPathN(pathSet, i, &path) != NFD_OKAY) abort();
+                    NFD_PathSet_FreePathN(path);
+                }
+            });
+            ReportPathSet("pathset_index", count, ns);
+        }
+
+        if (count <= maxQuadraticCount && ShouldRun("pathset_win")) {
+            const double ns = MeasureNs([&] {
+                char* pathList;
+                size_t pathListSize;
+                if (CopyPathListWin(msg, pathList, pathListSize) != NFD_OKAY) abort();
+                NFDi_Free(pathList);
+            });
+            ReportPathSet("pathset_win", count, ns);
+        }
+
+        dbus_message_unref(msg);
+    }
+}
+
+bool PortalAvailable() {
+    if (EnsureConnection() != NFD_OKAY) return false;
+    DBusError err;
+    dbus_error_init(&err);
+    const bool res = dbus_bus_name_has_owner(dbus_conn, "org.freedesktop.portal.Desktop", &err);
+    dbus_error_free(&err);
+    return res;
+}
+
+void ReportSkipped(const char* name, const char* reason) {
+    g_report.begin(name);
+    g_report.field("skipped", reason);
+    g_report.end();
+}
+
+double Percentile(std::vector<double>& sorted, double fraction) {
+    const size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+// NFD_Init()/NFD_Quit() pairs, both while another NFD_Init() holds the connection and as the
+// outermost pair, which reuses the connection kept open by the previous NFD_Quit().
+void BenchInitQuit() {
+    if (!ShouldRun("init_quit")) return;
+    if (NFD_Init() != NFD_OKAY) {
+        ReportSkipped("init_quit", "no session bus");
+        return;
+    }
+    const double nestedNs = MeasureNs([] {
+        NFD_Init();
+        NFD_Quit();
+    });
+    NFD_Quit();
+    const double outermostNs = MeasureNs([] {
+        NFD_Init();
+        NFD_Quit();
+    });
+    g_report.begin("init_quit");
+    g_report.field("nested_ns_per_pair", nestedNs);
+    g_report.field("outermost_ns_per_pair", outermostNs);
+    g_report.end();
+}
+
+void BenchRoundTrip(bool portalAvailable) {
+    if (!ShouldRun("roundtrip")) return;
+    if (!portalAvailable) {
+        ReportSkipped("roundtrip", "no portal on the session bus");
+        return;
+    }
+    const unsigned dialogs = g_options.quick ? 20 : 200;
+    std::vector<double> latencies;
+    latencies.reserve(dialogs);
+    unsigned failures = 0;
+    for (unsigned i = 0; i != dialogs; ++i) {
+        char* outPath = nullptr;
+        NfdDialogParams params{};
+        params.outPath = &outPath;
+        params.title = "Benchmark";
+        const uint64_t start = NowNs();
+        const nfdresult_t res = NFD_OpenDialogWin(&params);
+        latencies.push_back(static_cast<double>(NowNs() - start) / 1000.0);
+        if (res == NFD_OKAY)
+            NFD_FreePathN(outPath);
+        else
+            ++failures;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double latency : latencies) total += latency;
+    g_report.begin("roundtrip");
+    g_report.field("dialogs", static_cast<uint64_t>(dialogs));
+    g_report.field("failures", static_cast<uint64_t>(failures));
+    g_report.field("mean_us", total / dialogs);
+    g_report.field("p50_us", Percentile(latencies, 0.50));
+    g_report.field("p95_us", Percentile(latencies, 0.95));
+    g_report.field("p99_us", Percentile(latencies, 0.99));
+    g_report.field("max_us", latencies.back());
+    g_report.end();
+}
+
+struct AsyncRunResult {
+    uint64_t completed;
+    uint64_t failures;
+    uint64_t lost;
+    double seconds;
+};
+
+// Runs `rounds` rounds of `concurrency` overlapping async dialogs on a fresh connection.
+AsyncRunResult RunAsyncDialogs(unsigned concurrency, unsigned rounds) {
+    // Give up on a round that has not completed after this long, so that a lost response shows
+    // up in the results instead of hanging the benchmark.
+    const uint64_t deadlineNs = 10000000000u;
+    AsyncRunResult result{};
+    std::vector<void*> handles(concurrency);
+    const uint64_t start = NowNs();
+    for (unsigned round = 0; round != rounds && !result.lost; ++round) {
+        for (unsigned i = 0; i != concurrency; ++i) {
+            NfdDialogParams params{};
+            params.title = "Benchmark";
+            params.outAsyncOpHandle = &handles[i];
+            if (NFD_OpenDialogWin(&params) != NFD_OKAY) {
+                handles[i] = nullptr;
+                ++result.failures;
+            }
+        }
+        const uint64_t roundStart = NowNs();
+        for (void* handle : handles) {
+            if (!handle) continue;
+            while (!NFD_HasAsyncOpCompleted(handle) && NowNs() - roundStart < deadlineNs)
+                usleep(50);
+            if (!NFD_HasAsyncOpCompleted(handle)) {
+                ++result.lost;
+                NFD_FreeHandle(handle);
+                continue;
+            }
+            char* outPath = nullptr;
+            NfdDialogResponse response{};
+            response.outPath = &outPath;
+            if (NFD_GetAsyncOpResult(handle, &response) == NFD_OKAY) {
+                NFD_FreePathN(outPath);
+                ++result.completed;
+            } else {
+                ++result.failures;
+            }
+            NFD_FreeHandle(handle);
+        }
+    }
+    result.seconds = static_cast<double>(NowNs() - start) / 1e9;
+    return result;
+}
+
+void BenchAsyncThroughput(bool portalAvailable) {
+    if (!ShouldRun("async_throughput")) return;
+    if (!portalAvailable) {
+        ReportSkipped("async_throughput", "no portal on the session bus");
+        return;
+    }
+    const unsigned concurrencies[] = {1, 8, 32};
+    const unsigned rounds = g_options.quick ? 2 : 10;
+    for (unsigned concurrency : concurrencies) {
+        // Each run happens in a child process with its own connection, so that a deadlock inside
+        // the library is reported rather than hanging the whole benchmark.
+        int resultPipe[2];
+        if (pipe(resultPipe) != 0) abort();
+        const pid_t pid = fork();
+        if (pid < 0) abort();
+        if (pid == 0) {
+            close(resultPipe[0]);
+            AsyncRunResult result{};
+            if (NFD_Init() == NFD_OKAY) {
+                result = RunAsyncDialogs(concurrency, rounds);
+                NFD_Quit();
+            } else {
+                result.failures = 1;
+            }
+            if (write(resultPipe[1], &result, sizeof(result)) != sizeof(result)) _exit(1);
+            _exit(0);
+        }
+        close(resultPipe[1]);
+
+        AsyncRunResult result{};
+        struct pollfd fd = {resultPipe[0], POLLIN, 0};
+        const bool finished = poll(&fd, 1, g_options.quick ? 15000 : 60000) == 1 &&
+                              read(resultPipe[0], &result, sizeof(result)) == sizeof(result);
+        close(resultPipe[0]);
+        if (!finished) kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        g_report.begin("async_throughput");
+        g_report.field("concurrency", static_cast<uint64_t>(concurrency));
+        if (!finished) {
+            g_report.field("skipped", "deadlocked");
+            g_report.end();
+            continue;
+        }
+        g_report.field("completed", result.completed);
+        g_report.field("failures", result.failures);
+        g_report.field("lost", result.lost);
+        g_report.field("dialogs_per_sec", static_cast<double>(result.completed) / result.seconds);
+        g_report.end();
+    }
+}
+
+struct TraceRecord {
+    unsigned char kind;
+    uint64_t timeNs;
+    std::vector<char> data;
+};
+
+bool ReadLittleEndian(FILE* in, uint64_t& value, size_t bytes) {
+    unsigned char buf[8];
+    if (fread(buf, 1, bytes, in) != bytes) return false;
+    value = 0;
+    for (size_t i = 0; i != bytes; ++i) value |= static_cast<uint64_t>(buf[i]) << (8 * i);
+    return true;
+}
+
+// Reads a trace in the format written by NFD_SetTraceFile() (described in nfd_portal.cpp).
+bool ReadTrace(const char* path, std::vector<TraceRecord>& records) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    uint64_t version;
+    bool ok = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+              memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0 && ReadLittleEndian(in, version, 4) &&
+              version == TRACE_VERSION;
+    while (ok) {
+        TraceRecord record;
+        const int kind = fgetc(in);
+        if (kind == EOF) break;
+        record.kind = static_cast<unsigned char>(kind);
+        uint64_t size;
+        ok = ReadLittleEndian(in, record.timeNs, 8) && ReadLittleEndian(in, size, 4);
+        if (!ok) break;
+        record.data.resize(size);
+        ok = fread(record.data.data(), 1, size, in) == size;
+        if (ok) records.push_back(std::move(record));
+    }
+    fclose(in);
+    if (!ok) fprintf(stderr, "%s: not a valid trace file\n", path);
+    return ok;
+}
+
+// Parses a Response signal like a dialog does (ReadResponseResults, ReadDict and
+// ReadResponseUris), then decodes every URI through the path set API.
+nfdresult_t ReplayResponse(DBusMessage* msg, size_t& uris) {
+    DBusMessageIter uri_iter;
+    const nfdresult_t res = ReadResponseUris(msg, uri_iter);
+    if (res != NFD_OKAY) return res;
+    uris = 0;
+    nfdpathsetenum_t enumerator;
+    NFD_PathSet_GetEnum(msg, &enumerator);
+    nfdnchar_t* path;
+    while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path) {
+        NFD_PathSet_FreePathN(path);
+        ++uris;
+    }
+    NFD_PathSet_FreeEnum(&enumerator);
+    return NFD_OKAY;
+}
+
+const char* ResultName(nfdresult_t res) {
+    switch (res) {
+        case NFD_OKAY:
+            return "okay";
+        case NFD_CANCEL:
+            return "cancel";
+        default:
+            return "error";
+    }
+}
+
+bool BenchReplay(const char* path) {
+    std::vector<TraceRecord> records;
+    if (!ReadTrace(path, records)) return false;
+    uint64_t lastQueryNs = 0;
+    for (size_t i = 0; i != records.size(); ++i) {
+        const TraceRecord& record = records[i];
+        DBusError err;
+        dbus_error_init(&err);
+        DBusMessage* msg =
+            dbus_message_demarshal(record.data.data(), static_cast<int>(record.data.size()), &err);
+        if (!msg) {
+            fprintf(stderr, "%s: record %zu: %s\n", path, i, err.message);
+            dbus_error_free(&err);
+            return false;
+        }
+        DBusMessage_Guard msg_guard(msg);
+        if (record.kind == static_cast<unsigned char>(TraceKind::Query)) {
+            lastQueryNs = record.timeNs;
+            continue;
+        }
+        if (record.kind != static_cast<unsigned char>(TraceKind::Response)) continue;
+
+        size_t uris = 0;
+        const nfdresult_t res = ReplayResponse(msg, uris);
+        const double ns = MeasureNs([&] {
+            size_t count;
+            ReplayResponse(msg, count);
+        });
+        g_report.begin("replay");
+        g_report.field("record", static_cast<uint64_t>(i));
+        g_report.field("result", ResultName(res));
+        g_report.field("uris", static_cast<uint64_t>(uris));
+        g_report.field("message_bytes", static_cast<uint64_t>(record.data.size()));
+        // how long the user (and the portal) took to answer, as captured
+        if (lastQueryNs && record.timeNs >= lastQueryNs)
+            g_report.field("captured_latency_us",
+                           static_cast<double>(record.timeNs - lastQueryNs) / 1000.0);
+        g_report.field("ns_per_response", ns);
+        if (uris) g_report.field("ns_per_uri", ns / uris);
+        g_report.end();
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            g_options.quick = true;
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            g_options.only = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            g_options.outFile = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            g_options.replayFile = argv[++i];
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--quick] [--only NAME] [--out FILE] [--replay TRACE]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (g_options.replayFile) {
+        if (!BenchReplay(g_options.replayFile)) return 1;
+    } else {
+        BenchUriDecode();
+        BenchFilterMarshal();
+        BenchPathSet();
+        BenchInitQuit();
+
+        const bool initialized = NFD_Init() == NFD_OKAY;
+        const bool portalAvailable = initialized && PortalAvailable();
+        BenchRoundTrip(portalAvailable);
+        if (initialized) NFD_Quit();
+        BenchAsyncThroughput(portalAvailable);
+    }
+
+    FILE* out = stdout;
+    if (g_options.outFile) {
+        out = fopen(g_options.outFile, "w");
+        if (!out) {
+            perror(g_options.outFile);
+            return 1;
+        }
+    }
+    g_report.write(out);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Benchmarks for the GTK backend.
+
+  Unlike nfd_bench, this program links with nfd (built with the GTK backend, or with
+  NFD_RUNTIME_BACKEND and NFD_BACKEND=gtk) and shows real dialogs, so it needs a display; run it
+  under Xvfb (the `run_nfd_gtk_bench` target does this with xvfb-run).  A timer on the GTK main
+  loop, which the dialog runs while it is open, stands in for the user: it waits for the dialog to
+  be mapped, then closes it as a click on a button would.  For each dialog it measures
+
+    - visible: from the call to the dialog being mapped (the first one includes initializing GTK);
+    - click_to_return: from the click to the NFD function returning its result.
+
+  The large_directory benchmarks open a dialog in a new folder of 100000 empty files, with and
+  without NFD_GTK_PROFILE_LARGE_DIRECTORY, and measure the time to interactive: from the call to
+  the chooser's file list holding every entry.
+
+  Usage: nfd_gtk_bench [--quick] [--out FILE]
+
+  --quick     show fewer dialogs, and 10000 files in the large folder (for CI)
+  --out FILE  write the JSON results to FILE instead of stdout
+*/
+
+#include <fcntl.h>
+#include <gtk/gtk.h>
+#include <nfd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// The stand-in for the user, for the dialog that is being shown.
+struct Clicker {
+    gint response;
+    uint64_t mappedNs;
+    uint64_t clickNs;
+};
+
+// Returns the file chooser dialog that is on screen, if any.
+GtkWidget* FindMappedChooser() {
+    GtkWidget* found = nullptr;
+    GList* toplevels = gtk_window_list_toplevels();
+    for (GList* node = toplevels; node; node = node->next) {
+        GtkWidget* widget = GTK_WIDGET(node->data);
+        if (GTK_IS_FILE_CHOOSER_DIALOG(widget) && gtk_widget_get_mapped(widget)) {
+            found = widget;
+            break;
+        }
+    }
+    g_list_free(toplevels);
+    return found;
+}
+
+gboolean ClickWhenMapped(gpointer userData) {
+    Clicker* clicker = static_cast<Clicker*>(userData);
+    GtkWidget* dialog = FindMappedChooser();
+    if (!dialog) return G_SOURCE_CONTINUE;
+    if (!clicker->mappedNs) {
+        // let the dialog draw its first frame, as a user would see it before clicking
+        clicker->mappedNs = NowNs();
+        return G_SOURCE_CONTINUE;
+    }
+    clicker->clickNs = NowNs();
+    gtk_dialog_response(GTK_DIALOG(dialog), clicker->response);
+    return G_SOURCE_REMOVE;
+}
+
+struct Sample {
+    double visibleUs;
+    double clickToReturnUs;
+};
+
+double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+}
+
+std::string g_results;
+
+void Report(const char* name, const std::vector<Sample>& samples) {
+    std::vector<double> visible, clickToReturn;
+    for (const Sample& sample : samples) {
+        visible.push_back(sample.visibleUs);
+        clickToReturn.push_back(sample.clickToReturnUs);
+    }
+    char buf[512];
+    snprintf(buf,
+             sizeof(buf),
+             "%s\n    {\"name\": \"%s\", \"dialogs\": %zu, \"first_visible_us\": %.6g, "
+             "\"visible_us_p50\": %.6g, \"click_to_return_us_p50\": %.6g, "
+             "\"click_to_return_us_p95\": %.6g, \"click_to_return_us_max\": %.6g}",
+             g_results.empty() ? "" : ",",
+             name,
+             samples.size(),
+             samples.empty() ? 0.0 : samples[0].visibleUs,
+             Percentile(visible, 0.5),
+             Percentile(clickToReturn, 0.5),
+             Percentile(clickToReturn, 0.95),
+             Percentile(clickToReturn, 1.0));
+    g_results += buf;
+}
+
+// Shows `count` dialogs with `show`, closing each with `response`; returns false on an error.
+template <typename Show>
+bool Bench(const char* name, size_t count, gint response, Show show) {
+    std::vector<Sample> samples;
+    for (size_t i = 0; i != count; ++i) {
+        Clicker clicker = {response, 0, 0};
+        guint timer = g_timeout_add(1, ClickWhenMapped, &clicker);
+        const uint64_t startNs = NowNs();
+        const nfdresult_t result = show();
+        const uint64_t returnNs = NowNs();
+        if (!clicker.clickNs) g_source_remove(timer);
+        if (result == NFD_ERROR || !clicker.clickNs) {
+            fprintf(stderr, "%s: %s\n", name, result == NFD_ERROR ? NFD_GetError() : "no dialog");
+            return false;
+        }
+        samples.push_back({static_cast<double>(clicker.mappedNs - startNs) / 1000.0,
+                           static_cast<double>(returnNs - clicker.clickNs) / 1000.0});
+    }
+    Report(name, samples);
+    return true;
+}
+
+// Returns the first tree view under `widget`, which in a file chooser is its file list.
+GtkWidget* FindTreeView(GtkWidget* widget) {
+    if (GTK_IS_TREE_VIEW(widget)) return widget;
+    GtkWidget* found = nullptr;
+    if (GTK_IS_CONTAINER(widget)) {
+        GList* children = gtk_container_get_children(GTK_CONTAINER(widget));
+        for (GList* node = children; node && !found; node = node->next) {
+            found = FindTreeView(GTK_WIDGET(node->data));
+        }
+        g_list_free(children);
+    }
+    return found;
+}
+
+// The stand-in for the user, waiting for the file list to be complete.
+struct Waiter {
+    gint expected;
+    uint64_t deadlineNs;
+    uint64_t readyNs;
+};
+
+gboolean CancelWhenLoaded(gpointer userData) {
+    Waiter* waiter = static_cast<Waiter*>(userData);
+    GtkWidget* dialog = FindMappedChooser();
+    if (!dialog) return G_SOURCE_CONTINUE;
+    GtkWidget* treeView = FindTreeView(dialog);
+    GtkTreeModel* model = treeView ? gtk_tree_view_get_model(GTK_TREE_VIEW(treeView)) : nullptr;
+    if (model && gtk_tree_model_iter_n_children(model, nullptr) >= waiter->expected) {
+        waiter->readyNs = NowNs();
+    } else if (NowNs() < waiter->deadlineNs) {
+        return G_SOURCE_CONTINUE;
+    }
+    gtk_dialog_response(GTK_DIALOG(dialog), GTK_RESPONSE_CANCEL);
+    return G_SOURCE_REMOVE;
+}
+
+// Creates a temporary folder with `count` empty files; returns an empty string on an error.
+std::string CreateLargeDirectory(size_t count) {
+    char dir[] = "/tmp/nfd-gtk-bench-XXXXXX";
+    if (!mkdtemp(dir)) return std::string();
+    char path[sizeof(dir) + 32];
+    for (size_t i = 0; i != count; ++i) {
+        snprintf(path, sizeof(path), "%s/file-%06zu.txt", dir, i);
+        const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd == -1) return std::string();
+        close(fd);
+    }
+    return dir;
+}
+
+void RemoveLargeDirectory(const std::string& dir, size_t count) {
+    char path[64];
+    for (size_t i = 0; i != count; ++i) {
+        snprintf(path, sizeof(path), "%s/file-%06zu.txt", dir.c_str(), i);
+        unlink(path);
+    }
+    rmdir(dir.c_str());
+}
+
+// Opens `count` dialogs in `dir` with the given NfdGtkFlags; returns false on an error.
+bool BenchLargeDirectory(const char* name,
+                         size_t count,
+                         const std::string& dir,
+                         size_t entries,
+                         unsigned int gtkFlags) {
+    std::vector<double> ready;
+    for (size_t i = 0; i != count; ++i) {
+        const uint64_t startNs = NowNs();
+        Waiter waiter = {static_cast<gint>(entries), startNs + 120 * 1000000000ull, 0};
+        guint timer = g_timeout_add(1, CancelWhenLoaded, &waiter);
+        nfdchar_t* outPath;
+        NfdDialogParams params = {};
+        params.outPath = &outPath;
+        params.defaultPath = dir.c_str();
+        params.gtkFlags = gtkFlags;
+        const nfdresult_t result = NFD_OpenDialogWin(&params);
+        if (result == NFD_OKAY) NFD_FreePath(outPath);
+        if (result == NFD_ERROR) {
+            g_source_remove(timer);
+            fprintf(stderr, "%s: %s\n", name, NFD_GetError());
+            return false;
+        }
+        if (!waiter.readyNs) {
+            fprintf(stderr, "%s: the file list was not complete after 120 s\n", name);
+            return false;
+        }
+        ready.push_back(static_cast<double>(waiter.readyNs - startNs) / 1000000.0);
+    }
+    char buf[512];
+    snprintf(buf,
+             sizeof(buf),
+             "%s\n    {\"name\": \"%s\", \"dialogs\": %zu, \"entries\": %zu, "
+             "\"gtk_flags\": %u, \"first_time_to_interactive_ms\": %.6g, "
+             "\"time_to_interactive_ms_p50\": %.6g, \"time_to_interactive_ms_max\": %.6g}",
+             g_results.empty() ? "" : ",",
+             name,
+             ready.size(),
+             entries,
+             gtkFlags,
+             ready.empty() ? 0.0 : ready[0],
+             Percentile(ready, 0.5),
+             Percentile(ready, 1.0));
+    g_results += buf;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    const char* outFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outFile = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--out FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    const size_t count = quick ? 5 : 50;
+
+    if (NFD_Init() != NFD_OKAY) {
+        fprintf(stderr, "NFD_Init: %s\n", NFD_GetError());
+        return 1;
+    }
+    const nfdfilteritem_t filters[2] = {{"Source code", "c,cpp,cc"}, {"Headers", "h,hpp"}};
+    const bool ok =
+        Bench("pick_folder_cancel",
+              count,
+              GTK_RESPONSE_CANCEL,
+              [] {
+                  nfdchar_t* outPath;
+                  nfdresult_t result = NFD_PickFolder(&outPath, "/tmp");
+                  if (result == NFD_OKAY) NFD_FreePath(outPath);
+                  return result;
+              }) &&
+        Bench("open_dialog_cancel",
+              count,
+              GTK_RESPONSE_CANCEL,
+              [&] {
+                  nfdchar_t* outPath;
+                  nfdresult_t result = NFD_OpenDialog(&outPath, filters, 2, "/tmp");
+                  if (result == NFD_OKAY) NFD_FreePath(outPath);
+                  return result;
+              }) &&
+        Bench("pick_folder_accept", count, GTK_RESPONSE_ACCEPT, [] {
+            nfdchar_t* outPath;
+            nfdresult_t result = NFD_PickFolder(&outPath, "/tmp");
+            if (result == NFD_OKAY && outPath) NFD_FreePath(outPath);
+            return result;
+        });
+
+    const size_t entries = quick ? 10000 : 100000;
+    const size_t largeCount = quick ? 2 : 5;
+    const std::string largeDir = ok ? CreateLargeDirectory(entries) : std::string();
+    if (ok && largeDir.empty()) perror("creating the large folder");
+    // the same folder with the profile off and on, so both find it in the kernel's caches
+    const bool largeOk =
+        !largeDir.empty() &&
+        BenchLargeDirectory("large_directory_default", largeCount, largeDir, entries, 0) &&
+        BenchLargeDirectory("large_directory_profile",
+                            largeCount,
+                            largeDir,
+                            entries,
+                            NFD_GTK_PROFILE_LARGE_DIRECTORY);
+    if (!largeDir.empty()) RemoveLargeDirectory(largeDir, entries);
+    NFD_Quit();
+    if (!ok || !largeOk) return 1;
+
+    FILE* out = stdout;
+    if (outFile) {
+        out = fopen(outFile, "w");
+        if (!out) {
+            perror(outFile);
+            return 1;
+        }
+    }
+    fprintf(out,
+            "{\n  \"benchmark\": \"nfd_gtk_bench\",\n  \"version\": \"%s\",\n"
+            "  \"backend\": \"gtk\",\n  \"quick\": %s,\n  \"results\": [%s\n  ]\n}\n",
+            NFD_BENCH_VERSION,
+            quick ? "true" : "false",
+            g_results.c_str());
+    if (out != stdout) fclose(out);
+    return 0;
+}
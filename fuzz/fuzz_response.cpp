@@ -0,0 +1,103 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Fuzz target for the parsing of portal Response signals: ReadDict(), ReadResponseUris() and
+  everything the dialogs do with the result (the path set API, CopyPathListWin() and the save
+  dialog's extension handling, if built with NFD_APPEND_EXTENSION).
+
+  The input is either one marshalled D-Bus message, or a whole trace file captured with
+  NFD_SetTraceFile() (see nfd_portal.cpp), in which case every message in it is parsed.  This way,
+  traces of real portals can be used as seeds.
+*/
+
+#include "../src/nfd_portal.cpp"
+
+#include <limits.h>
+#include <stdint.h>
+
+namespace {
+
+void ParseResponse(DBusMessage* msg) {
+    const char* uri;
+    char* path;
+    if (ReadResponseUrisSingle(msg, uri) == NFD_OKAY &&
+        AllocAndCopyFilePath(uri, path) == NFD_OKAY)
+        NFDi_Free(path);
+
+#ifdef NFD_APPEND_EXTENSION
+    const char* extn;
+    if (ReadResponseUrisSingleAndCurrentExtension(msg, uri, extn) == NFD_OKAY &&
+        AllocAndCopyFilePathWithExtn(uri, extn, path) == NFD_OKAY)
+        NFDi_Free(path);
+#endif
+
+    DBusMessageIter uri_iter;
+    if (ReadResponseUris(msg, uri_iter) != NFD_OKAY) return;
+    nfdpathsetsize_t count;
+    NFD_PathSet_GetCount(msg, &count);
+    nfdpathsetenum_t enumerator;
+    NFD_PathSet_GetEnum(msg, &enumerator);
+    nfdpathsetsize_t enumerated = 0;
+    while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path) {
+        NFD_PathSet_FreePathN(path);
+        ++enumerated;
+    }
+    NFD_PathSet_FreeEnum(&enumerator);
+    if (enumerated > count) abort();
+    for (nfdpathsetsize_t i = 0; i != count; ++i) {
+        if (NFD_PathSet_GetPathN(msg, i, &path) == NFD_OKAY) NFD_PathSet_FreePathN(path);
+    }
+    char* path_list;
+    size_t path_list_size;
+    if (CopyPathListWin(msg, path_list, path_list_size) == NFD_OKAY) {
+        // the list must end with two null bytes
+        if (path_list_size < 2 || path_list[path_list_size - 1] != '\0' ||
+            path_list[path_list_size - 2] != '\0')
+            abort();
+        NFDi_Free(path_list);
+    }
+}
+
+void ParseMessage(const uint8_t* data, size_t size) {
+    if (size > INT_MAX) return;
+    DBusError err;
+    dbus_error_init(&err);
+    DBusMessage* msg =
+        dbus_message_demarshal(reinterpret_cast<const char*>(data), static_cast<int>(size), &err);
+    if (!msg) {
+        dbus_error_free(&err);
+        return;
+    }
+    DBusMessage_Guard msg_guard(msg);
+    ParseResponse(msg);
+}
+
+uint64_t GetLittleEndian(const uint8_t* data, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i != bytes; ++i) value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return value;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    constexpr size_t HEADER_SIZE = sizeof(TRACE_MAGIC) + 4;
+    constexpr size_t RECORD_HEADER_SIZE = 1 + 8 + 4;
+    if (size < HEADER_SIZE || memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        ParseMessage(data, size);
+        return 0;
+    }
+    // a trace file: parse the message in each record
+    const uint8_t* ptr = data + HEADER_SIZE;
+    const uint8_t* const end = data + size;
+    while (static_cast<size_t>(end - ptr) >= RECORD_HEADER_SIZE) {
+        const uint64_t message_size = GetLittleEndian(ptr + 9, 4);
+        ptr += RECORD_HEADER_SIZE;
+        if (message_size > static_cast<size_t>(end - ptr)) break;
+        ParseMessage(ptr, message_size);
+        ptr += message_size;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Fuzz target for the URI decoding of the portal backend: TryUriDecodeLen(), UriDecodeUnchecked()
+  and AllocAndCopyFilePath().  The input is one URI (up to its first null byte), copied to a buffer
+  that ends right after its terminating null byte, so that the sanitizers catch any read past it.
+*/
+
+#include "../src/nfd_portal.cpp"
+
+#include <stdint.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    const size_t len = strnlen(reinterpret_cast<const char*>(data), size);
+    char* const uri = new char[len + 1];
+    memcpy(uri, data, len);
+    uri[len] = '\0';
+
+    size_t decoded_len;
+    const char* uri_end;
+    if (TryUriDecodeLen(uri, decoded_len, uri_end)) {
+        if (uri_end != uri + len || decoded_len > len) abort();
+        // exactly the decoded length, so that the sanitizers catch any write past it
+        char* const decoded = new char[decoded_len];
+        if (UriDecodeUnchecked(uri, uri_end, decoded) != decoded + decoded_len) abort();
+        delete[] decoded;
+    }
+
+    // AllocAndCopyFilePath() must accept exactly the well-formed file URIs
+    const bool is_file_uri = strncmp(uri, FILE_URI_PREFIX, FILE_URI_PREFIX_LEN) == 0;
+    const bool expect_okay =
+        is_file_uri && TryUriDecodeLen(uri + FILE_URI_PREFIX_LEN, decoded_len, uri_end);
+    char* path = nullptr;
+    size_t path_size = 0;
+    const nfdresult_t res = AllocAndCopyFilePath(uri, path, &path_size);
+    if ((res == NFD_OKAY) != expect_okay) abort();
+    if (res == NFD_OKAY) {
+        if (path_size != decoded_len + 1 || path[decoded_len] != '\0') abort();
+        NFDi_Free(path);
+    }
+
+    delete[] uri;
+    return 0;
+}
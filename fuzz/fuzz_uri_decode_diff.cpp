@@ -0,0 +1,44 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Differential fuzz target: checks that the backend's URI decoder (TryUriDecodeLen() and
+  UriDecodeUnchecked() in nfd_portal.cpp) agrees byte-for-byte with the reference scalar decoder in
+  uri_decode_reference.h, on every input.  Any faster (e.g. vectorized) decoder must keep this
+  target running clean.  The input is one URI, as in fuzz_uri_decode.
+*/
+
+#include "../src/nfd_portal.cpp"
+
+#include <stdint.h>
+
+#include "uri_decode_reference.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    const size_t len = strnlen(reinterpret_cast<const char*>(data), size);
+    char* const uri = new char[len + 1];
+    memcpy(uri, data, len);
+    uri[len] = '\0';
+
+    size_t expected_len = 0;
+    const char* expected_end = nullptr;
+    const bool expected_ok = reference::TryUriDecodeLen(uri, expected_len, expected_end);
+    size_t actual_len = 0;
+    const char* actual_end = nullptr;
+    const bool actual_ok = TryUriDecodeLen(uri, actual_len, actual_end);
+    if (actual_ok != expected_ok) abort();
+    if (actual_ok) {
+        if (actual_len != expected_len || actual_end != expected_end) abort();
+        char* const expected = new char[expected_len];
+        char* const actual = new char[actual_len];
+        if (reference::UriDecode(uri, expected_end, expected) != expected + expected_len) abort();
+        if (UriDecodeUnchecked(uri, actual_end, actual) != actual + actual_len) abort();
+        if (memcmp(actual, expected, actual_len) != 0) abort();
+        delete[] actual;
+        delete[] expected;
+    }
+
+    delete[] uri;
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Fuzz target for the parser of Windows-style filter lists (`winFilter`, e.g.
+  "Text\0*.txt\0All\0*.*\0\0") in AppendFileQueryDictEntryFilters().  The first byte of the input
+  is the filter index and the rest is the list, to which the terminating null bytes are appended.
+  The list is copied to a buffer that ends right after them, so that the sanitizers catch any read
+  past it.
+*/
+
+#include "../src/nfd_portal.cpp"
+
+#include <stdint.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) return 0;
+    const unsigned long filter_index = data[0];
+    ++data;
+    --size;
+
+    char* const win_filter = new char[size + 2];
+    memcpy(win_filter, data, size);
+    win_filter[size] = '\0';
+    win_filter[size + 1] = '\0';
+
+    // strings passed to NFD must be UTF-8 (libdbus aborts otherwise), so skip other inputs
+    bool valid = true;
+    for (const char* str = win_filter; valid && str < win_filter + size; str += strlen(str) + 1)
+        valid = dbus_validate_utf8(str, nullptr);
+
+    if (valid) {
+        DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
+                                                          "/org/freedesktop/portal/desktop",
+                                                          "org.freedesktop.portal.FileChooser",
+                                                          "OpenFile");
+        DBusMessage_Guard query_guard(query);
+        NfdDialogParams params{};
+        params.winFilter = win_filter;
+        params.filterIndex = filter_index;
+        AppendOpenFileQueryParams<false, false>(query, "token", &params);
+    }
+
+    delete[] win_filter;
+    return 0;
+}
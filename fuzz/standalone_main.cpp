@@ -0,0 +1,81 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  A main() for the fuzz targets when the compiler has no libFuzzer (e.g. GCC).  It runs the target
+  once on each file given on the command line (or each file in a given directory), so that the
+  seed corpus and any crashing inputs can be replayed under the sanitizers.  Options (arguments
+  starting with '-') are ignored, so that the same command line works with libFuzzer builds.
+
+  Usage: fuzz_<target> [-runs=0] FILE_OR_DIRECTORY...
+*/
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace {
+
+bool RunFile(const std::string& path) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), in)) != 0) data.insert(data.end(), buf, buf + count);
+    fclose(in);
+    // copy the input to an exactly-sized buffer, so that the sanitizers catch reads past its end
+    uint8_t* copy = new uint8_t[data.size()];
+    if (!data.empty()) memcpy(copy, data.data(), data.size());
+    LLVMFuzzerTestOneInput(copy, data.size());
+    delete[] copy;
+    return true;
+}
+
+bool RunPath(const std::string& path, size_t& runs) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        perror(path.c_str());
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (!RunFile(path)) return false;
+        ++runs;
+        return true;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        perror(path.c_str());
+        return false;
+    }
+    bool ok = true;
+    while (const dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        ok = RunPath(path + "/" + entry->d_name, runs) && ok;
+    }
+    closedir(dir);
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool ok = true;
+    size_t runs = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-') ok = RunPath(argv[i], runs) && ok;
+    }
+    printf("Executed %zu inputs\n", runs);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  The reference (scalar) URI decoder that fuzz_uri_decode_diff compares the backend's decoder
+  with.  This is a frozen copy of TryUriDecodeLen() and UriDecodeUnchecked() from nfd_portal.cpp,
+  so that faster implementations there can be checked to produce byte-for-byte the same results.
+  Do not optimize it.
+*/
+
+#ifndef _NFD_URI_DECODE_REFERENCE_H
+#define _NFD_URI_DECODE_REFERENCE_H
+
+#include <stddef.h>
+
+namespace reference {
+
+inline bool IsHex(char ch) {
+    return ('0' <= ch && ch <= '9') || ('A' <= ch && ch <= 'F') || ('a' <= ch && ch <= 'f');
+}
+
+inline char ParseHex(char ch) {
+    if ('0' <= ch && ch <= '9') return ch - '0';
+    if ('A' <= ch && ch <= 'F') return ch - ('A' - 10);
+    return ch - ('a' - 10);
+}
+
+// Same contract as TryUriDecodeLen().
+inline bool TryUriDecodeLen(const char* fileUri, size_t& out, const char*& fileUriEnd) {
+    size_t len = 0;
+    while (*fileUri) {
+        if (*fileUri != '%') {
+            ++fileUri;
+        } else {
+            if (*(fileUri + 1) == '\0' || *(fileUri + 2) == '\0') return false;
+            if (!IsHex(*(fileUri + 1)) || !IsHex(*(fileUri + 2))) return false;
+            fileUri += 3;
+        }
+        ++len;
+    }
+    out = len;
+    fileUriEnd = fileUri;
+    return true;
+}
+
+// Same contract as UriDecodeUnchecked().
+inline char* UriDecode(const char* fileUri, const char* fileUriEnd, char* outPath) {
+    while (fileUri != fileUriEnd) {
+        if (*fileUri != '%') {
+            *outPath++ = *fileUri++;
+        } else {
+            ++fileUri;
+            const char high_nibble = ParseHex(*fileUri++);
+            const char low_nibble = ParseHex(*fileUri++);
+            *outPath++ = (high_nibble << 4) | low_nibble;
+        }
+    }
+    return outPath;
+}
+
+}  // namespace reference
+
+#endif  // _NFD_URI_DECODE_REFERENCE_H
@@ -53,9 +53,11 @@ typedef struct {
 typedef unsigned int nfdfiltersize_t;
 
 typedef enum {
-    NFD_ERROR, /* programmatic error */
-    NFD_OKAY,  /* user pressed okay, or successful return */
-    NFD_CANCEL /* user pressed cancel */
+    NFD_ERROR,  /* programmatic error */
+    NFD_OKAY,   /* user pressed okay, or successful return */
+    NFD_CANCEL, /* user pressed cancel */
+    NFD_TIMEOUT /* portal backend: the portal, or the user, did not answer in time (see
+                   NFD_SetTimeout); the dialog has been closed */
 } nfdresult_t;
 
 typedef struct {
@@ -69,11 +71,67 @@ void NFD_FreePathN(nfdnchar_t* filePath);
 
 /* initialize NFD - call this for every thread that might use NFD, before calling any other NFD
  * functions on that thread */
+/* On the portal backend, NFD_Init and NFD_Quit are reference-counted and may be called from any
+ * thread: every NFD_Init shares one D-Bus connection, which is opened by the first dialog (or by
+ * NFD_Prewarm) and reused by later ones (even after the last NFD_Quit), so NFD_Init is cheap. */
+/* On the GTK backend, closed dialogs are kept and reused until the last NFD_Quit, by dialogs that
+ * are given a defaultPath (or NFD_GTK_NO_RECENT); a dialog without one is built anew, so that it
+ * opens where GTK starts a new chooser. */
 nfdresult_t NFD_Init(void);
 
+/* portal backend: like NFD_Init, but use `connection` (a DBusConnection* to the session bus that
+ * the application already has) instead of opening a connection of our own */
+/* The application keeps dispatching the connection as before (e.g. from its main loop), and async
+ * dialogs complete (and their onAsyncOpComplete callbacks run) while it does; do not show blocking
+ * dialogs from those callbacks.  Blocking dialogs dispatch the connection themselves while they
+ * wait.  Later NFD_Init calls share the connection too, and the last NFD_Quit hands it back.
+ * Fails if NFD is already initialized with another connection. */
+nfdresult_t NFD_InitWithConnection(void* connection);
+
 /* call this to de-initialize NFD, if NFD_Init returned NFD_OKAY */
+/* On the portal backend, this may also be called from an onAsyncOpComplete callback (e.g. to pair
+ * an NFD_Init per dialog); async dialogs that are still open when the last NFD_Quit is called
+ * complete with an error, and their callbacks run inside it. */
 void NFD_Quit(void);
 
+/* portal backend: connect to the session bus, start the portal if needed and read its version on a
+ * background thread, so that the first dialog does not wait for any of it; call after NFD_Init */
+/* Returns as soon as the thread has started; errors on that thread are ignored (the first dialog
+ * then reports them) */
+/* With the GTK helper (NFD_GTK_HELPER), starts nfd-gtk-helper and has it initialize GTK instead,
+ * without waiting for it.  With the broker (NFD_BROKER), connects to nfd-broker, starting it if it
+ * is not running, and waits until it is connected to the portal. */
+nfdresult_t NFD_Prewarm(void);
+
+/* portal backend: give up on dialogs and file manager calls that take longer than `timeoutMs`
+ * milliseconds, returning NFD_TIMEOUT; pass 0 (the default) to wait forever */
+/* The timeout covers both the D-Bus call and the wait for the user's response, and applies to
+ * every call that does not set its own `timeoutMs`.  Async dialogs only time out in the D-Bus call;
+ * the caller decides how long to wait for their result. */
+void NFD_SetTimeout(int timeoutMs);
+
+/* GTK backend: when a dialog opens in a default path, read that directory (and stat its entries)
+ * on background threads while the dialog is built, so that the chooser finds them in the kernel's
+ * caches; for very large or remote (e.g. NFS) directories */
+/* Reads at most `maxEntries` entries, for at most `budgetMs` milliseconds; pass 0 for either (the
+ * default) to turn prefetch off. */
+void NFD_SetDirectoryPrefetch(size_t maxEntries, int budgetMs);
+
+#define NFD_POLL_DESCRIPTORS 2
+
+/* portal backend: let the host's event loop drive the D-Bus connection, instead of a library
+ * thread; call after NFD_Init and before the first dialog */
+/* Fills `outFds` with file descriptors that the host must watch for reading; whenever one of them
+ * is readable, call NFD_Dispatch on the loop's thread.  No timers are needed.  The descriptors stay
+ * valid until the last NFD_Quit.  Blocking dialogs read the connection themselves while they wait,
+ * so they still work (but they block the loop). */
+nfdresult_t NFD_GetPollDescriptors(int outFds[NFD_POLL_DESCRIPTORS]);
+
+/* portal backend: handle the messages that arrived on the descriptors of NFD_GetPollDescriptors;
+ * async dialogs complete, and their onAsyncOpComplete callbacks run, inside this call */
+/* Never blocks.  Returns NFD_ERROR if the connection was lost. */
+nfdresult_t NFD_Dispatch(void);
+
 /* single file open dialog */
 /* It is the caller's responsibility to free `outPath` via NFD_FreePathN() if this function returns
  * NFD_OKAY */
@@ -100,8 +158,26 @@ typedef struct {
     const char* title;
     const char* defExt;
     void** outAsyncOpHandle;
+    int timeoutMs; /* portal backend: 0 to use NFD_SetTimeout, or negative to wait forever */
+    /* async dialogs on the portal backend: if set, called with the handle and `userData` once the
+     * dialog has completed, on the thread that dispatches the portal's messages (a library thread,
+     * or the thread calling NFD_Dispatch); the handle may be collected and freed in the callback */
+    void (*onAsyncOpComplete)(void* opHandle, void* userData);
+    void* userData;
+    unsigned int gtkFlags; /* GTK backend: NfdGtkFlags (the portal backend ignores them) */
 } NfdDialogParams;
 
+/* GTK backend: chooser features that cost the most in folders with very many entries, turned off
+ * for one dialog by setting them in NfdDialogParams.gtkFlags */
+typedef enum {
+    NFD_GTK_NO_RECENT = 1 << 0,  /* no Recent place; start in the current directory by default */
+    NFD_GTK_LOCAL_ONLY = 1 << 1, /* no remote volumes (GVFS) or Other Locations in the sidebar */
+    NFD_GTK_PROFILE_LARGE_DIRECTORY = 0x3 /* all of the above */
+} NfdGtkFlags;
+
+/* On the GTK backend, the NFD_*Win functions are synchronous only (outAsyncOpHandle must be NULL),
+ * and parentWindow and timeoutMs are ignored. */
+
 nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params);
 
 nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params);
@@ -131,6 +207,66 @@ nfdresult_t NFD_GetAsyncOpResult(void* opHandle, NfdDialogResponse* result);
  */
 void NFD_FreeHandle(void* opHandle);
 
+/* When each phase of a dialog happened, in nanoseconds on the CLOCK_MONOTONIC clock.  Phases that
+ * were not reached (e.g. because the dialog failed or is still open) are 0. */
+typedef struct {
+    uint64_t start;            /* the dialog was requested */
+    uint64_t connectionReady;  /* the D-Bus connection was ready for use */
+    uint64_t matchRuleAdded;   /* we subscribed to the portal's Response signal */
+    uint64_t queryBuilt;       /* the OpenFile/SaveFile method call was built */
+    uint64_t methodReplied;    /* the portal replied to the method call (the dialog is up) */
+    uint64_t responseReceived; /* the Response signal arrived (the user closed the dialog) */
+    uint64_t resultDecoded;    /* the returned URIs were decoded into paths */
+    uint64_t resultDelivered;  /* the result was handed to the caller */
+} NfdDialogTimings;
+
+/* get the phase timings of the most recent dialog shown by the calling thread; for async dialogs,
+ * this only covers the phases up to methodReplied (use NFD_GetAsyncOpTimings for the rest) */
+/* Returns NFD_ERROR if no dialog has been shown yet */
+nfdresult_t NFD_GetLastTimings(NfdDialogTimings* timings);
+
+/**
+ * @warning The behavior is undefined if the requirements of \p opHandle is not met
+ * @param opHandle handle returned by an AsyncOp
+ * @param timings receives the phase timings of that dialog so far
+ */
+nfdresult_t NFD_GetAsyncOpTimings(void* opHandle, NfdDialogTimings* timings);
+
+#define NFD_STATS_LATENCY_BUCKETS 32
+
+/* Library-wide counters, accumulated since the program started or since NFD_ResetStats(). */
+typedef struct {
+    uint64_t openDialogs;         /* single file open dialogs shown */
+    uint64_t openMultipleDialogs; /* multiple file open dialogs shown */
+    uint64_t saveDialogs;         /* save dialogs shown */
+    uint64_t pickFolderDialogs;   /* folder dialogs shown */
+    uint64_t cancels;             /* dialogs that the user cancelled */
+    uint64_t dbusErrors;          /* failed D-Bus calls and lost connections */
+    uint64_t responseErrors;      /* portal replies and responses that could not be used */
+    uint64_t otherErrors;         /* all other errors (e.g. invalid arguments) */
+    uint64_t timeouts;            /* dialogs and file manager calls that returned NFD_TIMEOUT */
+    uint64_t uriBytesDecoded;     /* bytes of file URIs decoded into paths */
+    uint64_t pathsReturned;       /* paths copied out to the caller */
+    uint64_t allocations;         /* memory allocations made by NFD */
+    /* Latency (from showing the dialog to decoding its result) of the dialogs that returned
+     * NFD_OKAY.  Bucket i counts dialogs that took [2^i, 2^(i+1)) microseconds; the first bucket
+     * also counts shorter dialogs and the last bucket also counts longer ones. */
+    uint64_t latencyHistogram[NFD_STATS_LATENCY_BUCKETS];
+} NfdStats;
+
+/* get a snapshot of the counters */
+/* Returns NFD_ERROR (and zeroes `stats`) if NFD was built with NFD_DISABLE_STATS */
+nfdresult_t NFD_GetStats(NfdStats* stats);
+
+/* reset all the counters to zero */
+void NFD_ResetStats(void);
+
+/* capture every portal query and Response signal to the file at `path` (truncating it), for
+ * replaying them later with nfd_bench --replay; pass NULL to stop capturing */
+/* Capturing can also be enabled by setting the NFD_TRACE_FILE environment variable before the
+ * first call to NFD_Init */
+nfdresult_t NFD_SetTraceFile(const char* path);
+
 typedef enum {
     NFD_FM_SELECT_FILE,
     NFD_FM_OPEN_FOLDER
@@ -140,6 +276,7 @@ typedef struct NfdFileManagerParams {
     const char* filePath;
     NfdFileManagerMode mode;
     int convertToRealPath;
+    int timeoutMs; /* portal backend: 0 to use NFD_SetTimeout, or negative to wait forever */
 } NfdFileManagerParams;
 
 nfdresult_t NFD_OpenFileManager(NfdFileManagerParams* params);
@@ -172,7 +309,8 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath);
 
 /* Get last error -- set when nfdresult_t returns NFD_ERROR */
-/* Returns the last error that was set, or NULL if there is no error. */
+/* Returns the last error that was set on the calling thread, or NULL if there is no error.  The
+ * error of an async dialog is set on the thread that calls NFD_GetAsyncOpResult. */
 /* The memory is owned by NFD and should not be freed by user code. */
 /* This is *always* ASCII printable characters, so it can be interpreted as UTF-8 without any
  * conversion. */
@@ -0,0 +1,99 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  The interface between the run-time backend selection (nfd_runtime.cpp) and the backend modules.
+
+  With -DNFD_RUNTIME_BACKEND=ON, nfd_gtk.cpp and the portal backend are each built into a module
+  (libnfd_gtk.so, libnfd_portal.so) that links with its own libraries, and compiled with
+  NFD_BACKEND_MODULE and hidden visibility, so that the only symbol it exports is
+  NFDi_GetBackend().  The nfd library itself only has nfd_runtime.cpp, which loads one of the
+  modules on first use and forwards every NFD_* call to the table that NFDi_GetBackend() returns.
+  With -DNFD_BROKER=ON, there is a third module, libnfd_broker.so, which is the client of nfd-broker
+  (see nfd_helper.h).
+
+  Internal: not installed, and not part of the API.
+*/
+
+#ifndef _NFD_BACKEND_H
+#define _NFD_BACKEND_H
+
+#include "nfd.h"
+
+/* bumped whenever NfdBackend changes, so that a stale module is rejected instead of misused */
+#define NFD_BACKEND_ABI_VERSION 2
+
+/* The entry points of a backend module.  Each points to the NFD_* function of the same name, or is
+ * null if the backend does not have that function (e.g. the GTK backend has none of the portal's
+ * extensions, and the portal has no directory prefetch). */
+typedef struct {
+    unsigned abiVersion; /* NFD_BACKEND_ABI_VERSION */
+    const char* name;    /* "gtk", "portal" or "broker" */
+
+    /* Returns nonzero if the backend can show dialogs in this session.  Called after Init. */
+    int (*IsAvailable)(void);
+
+    const char* (*GetError)(void);
+    void (*ClearError)(void);
+    nfdresult_t (*Init)(void);
+    nfdresult_t (*InitWithConnection)(void* connection);
+    void (*Quit)(void);
+    nfdresult_t (*Prewarm)(void);
+    void (*SetTimeout)(int timeoutMs);
+    nfdresult_t (*GetPollDescriptors)(int outFds[NFD_POLL_DESCRIPTORS]);
+    nfdresult_t (*Dispatch)(void);
+    void (*FreePathN)(nfdnchar_t* filePath);
+    nfdresult_t (*OpenDialogN)(nfdnchar_t** outPath,
+                               const nfdnfilteritem_t* filterList,
+                               nfdfiltersize_t filterCount,
+                               const nfdnchar_t* defaultPath);
+    nfdresult_t (*OpenDialogWin)(NfdDialogParams* params);
+    nfdresult_t (*OpenDialogMultipleWin)(NfdDialogParams* params);
+    nfdresult_t (*SaveDialogWin)(NfdDialogParams* params);
+    nfdresult_t (*PickFolderWin)(NfdDialogParams* params);
+    int (*HasAsyncOpCompleted)(void* opHandle);
+    nfdresult_t (*GetAsyncOpResult)(void* opHandle, NfdDialogResponse* result);
+    void (*FreeHandle)(void* opHandle);
+    nfdresult_t (*GetLastTimings)(NfdDialogTimings* timings);
+    nfdresult_t (*GetAsyncOpTimings)(void* opHandle, NfdDialogTimings* timings);
+    nfdresult_t (*GetStats)(NfdStats* stats);
+    void (*ResetStats)(void);
+    nfdresult_t (*SetTraceFile)(const char* path);
+    nfdresult_t (*OpenFileManager)(NfdFileManagerParams* params);
+    nfdresult_t (*OpenDialogMultipleN)(const nfdpathset_t** outPaths,
+                                       const nfdnfilteritem_t* filterList,
+                                       nfdfiltersize_t filterCount,
+                                       const nfdnchar_t* defaultPath);
+    nfdresult_t (*SaveDialogN)(nfdnchar_t** outPath,
+                               const nfdnfilteritem_t* filterList,
+                               nfdfiltersize_t filterCount,
+                               const nfdnchar_t* defaultPath,
+                               const nfdnchar_t* defaultName);
+    nfdresult_t (*PickFolderN)(nfdnchar_t** outPath, const nfdnchar_t* defaultPath);
+    nfdresult_t (*PathSet_GetCount)(const nfdpathset_t* pathSet, nfdpathsetsize_t* count);
+    nfdresult_t (*PathSet_GetPathN)(const nfdpathset_t* pathSet,
+                                    nfdpathsetsize_t index,
+                                    nfdnchar_t** outPath);
+    void (*PathSet_FreePathN)(const nfdnchar_t* filePath);
+    void (*PathSet_Free)(const nfdpathset_t* pathSet);
+    /* The GTK module is compiled without NFD_PORTAL, so its nfdpathsetenum_t is just the first
+     * pointer of the portal's, which is what callers of the nfd library allocate. */
+    nfdresult_t (*PathSet_GetEnum)(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator);
+    void (*PathSet_FreeEnum)(nfdpathsetenum_t* enumerator);
+    nfdresult_t (*PathSet_EnumNextN)(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath);
+    void (*SetDirectoryPrefetch)(size_t maxEntries, int budgetMs);
+} NfdBackend;
+
+/* the name of the function that every module exports */
+#define NFD_BACKEND_ENTRY_POINT "NFDi_GetBackend"
+
+#ifdef NFD_BACKEND_MODULE
+#ifdef __cplusplus
+extern "C"
+#endif
+    __attribute__((visibility("default"))) const NfdBackend*
+    NFDi_GetBackend(void);
+#endif
+
+#endif  // _NFD_BACKEND_H
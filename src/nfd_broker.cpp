@@ -0,0 +1,498 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  nfd-broker: shows the dialogs of the broker client (nfd_helper_client.cpp compiled with
+  NFD_BROKER_CLIENT) with the portal backend, for every process of the user, on one D-Bus connection
+  that stays open between them; see nfd_helper.h.  It is usually started by the first client.
+*/
+
+/*
+Usage: nfd-broker [--daemon] [--idle-timeout SECONDS]
+
+The broker listens on the socket of NFDi_BrokerSocketPath(), and holds a lock on that path with
+".lock" appended while it does, so that only one broker serves each socket: a broker that finds the
+lock taken exits with status 0 at once, since the other one serves its clients.  With --daemon
+(which the clients pass), it forks once it listens, and the first process exits once the daemon is
+connected to the session bus (with status 0, or 1 if it could not connect), so that the client that
+started it knows when to connect; the daemon leaves the session and the terminal.  It exits once it
+has had no clients for SECONDS (default: 600; 0 to never exit), when the D-Bus connection is lost
+(e.g. the session has ended), and on SIGTERM or SIGINT.
+
+Everything runs on one thread: the loop in Serve() polls the listening socket, the clients and the
+portal's connection (through NFD_GetPollDescriptors() and NFD_Dispatch()).  Every dialog is an
+async NFD_*Win dialog, whose completion callback sends the response to its client; the requests for
+the other dialogs are converted to the NFD_*Win ones, with their filters as a winFilter, and the
+paths of an open-multiple dialog as full paths again.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nfd.h"
+#include "nfd_helper.h"
+#include "nfd_helper_server.h"
+
+namespace {
+
+/* clients beyond this wait to be accepted until another one disconnects */
+constexpr int MAX_CLIENTS = 256;
+constexpr long DEFAULT_IDLE_TIMEOUT_S = 600;
+/* what the errors that the broker sends call it */
+constexpr const char* PROGRAM = "nfd-broker";
+
+struct Client {
+    int fd;         /* -1 if the slot is free */
+    void* handle;   /* the dialog that is open for the client, or null */
+    NfdHelperOp op; /* the request of that dialog */
+};
+
+Client g_clients[MAX_CLIENTS];
+int g_clientCount = 0;
+
+/* the socket that the clients connect to, and its lock; -1 once the broker no longer listens */
+int g_listenFd = -1;
+int g_lockFd = -1;
+struct sockaddr_un g_address;
+
+/* set by SIGTERM and SIGINT, which are only unblocked while the loop polls */
+volatile sig_atomic_t g_quit = 0;
+
+// Sends the paths of an open-multiple dialog, which NFD_OpenDialogMultipleWin returns as one path,
+// or as a directory and the names in it, as the list of full paths of NFD_HELPER_OPEN_MULTIPLE.
+void SendPathList(int fd, const char* winPaths) {
+    const char* dir = winPaths;
+    const size_t dirLength = strlen(dir);
+    const char* names = dir + dirLength + 1;
+    if (!*names) {
+        // one path, and the empty string after it, as the list needs
+        NFDi_SendHelperPath(fd, PROGRAM, dir, dirLength + 2);
+        return;
+    }
+    const bool separator = dirLength == 0 || dir[dirLength - 1] != '/';
+    uint32_t count = 0;
+    uint64_t size = 1;  // the empty string at the end
+    for (const char* name = names; *name; name += strlen(name) + 1) {
+        size += dirLength + separator + strlen(name) + 1;
+        ++count;
+    }
+    NFDi_SendHelperPaths(fd, PROGRAM, count, size, [=](char* out) {
+        for (const char* name = names; *name; name += strlen(name) + 1) {
+            memcpy(out, dir, dirLength);
+            out += dirLength;
+            if (separator) *out++ = '/';
+            const size_t length = strlen(name) + 1;
+            memcpy(out, name, length);
+            out += length;
+        }
+        *out = '\0';
+    });
+}
+
+// Returns whether `extension` is one of the comma-separated extensions of `spec`.
+bool SpecHasExtension(const char* spec, const char* extension) {
+    const size_t length = strlen(extension);
+    for (const char* ptr = spec;;) {
+        const char* end = strchr(ptr, ',');
+        if (!end) end = ptr + strlen(ptr);
+        if (static_cast<size_t>(end - ptr) == length && !strncmp(ptr, extension, length))
+            return true;
+        if (!*end) return false;
+        ptr = end + 1;
+    }
+}
+
+// Returns the winFilter that shows `filters` as the portal backend's NFD_OpenDialogN and
+// NFD_SaveDialogN do: "Name (c, cpp)" matching "*.c;*.cpp" for each filter, then "All files" (to be
+// freed with free()), or null if there are no filters or on failure.  Sets `filterIndex` to the
+// filter that is selected at first: the first one, or for a save dialog, the first one with the
+// extension of `defaultName`, and else "All files".
+char* BuildWinFilter(const nfdnfilteritem_t* filters,
+                     uint32_t count,
+                     bool save,
+                     const char* defaultName,
+                     unsigned long& filterIndex) {
+    if (count == 0) return nullptr;
+    static const char allFiles[] = "All files\0*";
+    size_t size = sizeof(allFiles) + 1;
+    for (uint32_t i = 0; i != count; ++i) {
+        // at worst "*." and a separator for each character of the spec
+        size += strlen(filters[i].name) + 2 + 2 * strlen(filters[i].spec) + 2 +
+                4 * (strlen(filters[i].spec) + 1);
+    }
+    char* winFilter = static_cast<char*>(malloc(size));
+    if (!winFilter) return nullptr;
+
+    const char* extension = save && defaultName ? strrchr(defaultName, '.') : nullptr;
+    if (extension && !*++extension) extension = nullptr;
+    filterIndex = save ? count + 1 : 1;
+    char* out = winFilter;
+    for (uint32_t i = 0; i != count; ++i) {
+        out += sprintf(out, "%s (", filters[i].name);
+        for (const char* spec = filters[i].spec; *spec; ++spec) {
+            *out++ = *spec;
+            if (*spec == ',') *out++ = ' ';
+        }
+        *out++ = ')';
+        *out++ = '\0';
+        for (const char* spec = filters[i].spec;;) {
+            const char* end = strchr(spec, ',');
+            if (!end) end = spec + strlen(spec);
+            out += sprintf(out, "*.%.*s", static_cast<int>(end - spec), spec);
+            if (!*end) break;
+            *out++ = ';';
+            spec = end + 1;
+        }
+        *out++ = '\0';
+        if (extension && filterIndex == count + 1 && SpecHasExtension(filters[i].spec, extension))
+            filterIndex = i + 1;
+    }
+    memcpy(out, allFiles, sizeof(allFiles));
+    out[sizeof(allFiles)] = '\0';
+    return winFilter;
+}
+
+// Called inside NFD_Dispatch() when the dialog of the client `userData` has completed.
+void OnDialogComplete(void* opHandle, void* userData) {
+    Client& client = *static_cast<Client*>(userData);
+    char* outPath;
+    NfdDialogResponse response = {};
+    response.outPath = &outPath;
+    const nfdresult_t result = NFD_GetAsyncOpResult(opHandle, &response);
+    if (result != NFD_OKAY) {
+        NFDi_SendHelperResult(client.fd, result);
+    } else if (client.op == NFD_HELPER_OPEN_MULTIPLE) {
+        SendPathList(client.fd, outPath);
+    } else {
+        const size_t size =
+            client.op >= NFD_HELPER_OPEN_WIN ? response.outPathSize : strlen(outPath) + 1;
+        NFDi_SendHelperPath(client.fd, PROGRAM, outPath, size);
+    }
+    if (result == NFD_OKAY) NFD_FreePathN(outPath);
+    NFD_FreeHandle(opHandle);
+    client.handle = nullptr;
+}
+
+void HandleRequest(Client& client, const char* message, size_t messageSize) {
+    NfdHelperDialog dialog;
+    if (!NFDi_ReadHelperRequest(client.fd, PROGRAM, message, messageSize, dialog)) return;
+    const NfdHelperRequest& request = dialog.request;
+    // the portal is already warm
+    if (request.op == NFD_HELPER_PREWARM) return;
+    if (client.handle) {
+        free(dialog.filters);
+        NFDi_SendHelperError(client.fd, PROGRAM, "is already showing a dialog for this process.");
+        return;
+    }
+
+    NfdDialogParams params = {};
+    params.filterIndex = request.filterIndex;
+    params.defaultPath = dialog.defaultPath;
+    params.outAsyncOpHandle = &client.handle;
+    params.onAsyncOpComplete = OnDialogComplete;
+    params.userData = &client;
+    char* builtFilter = nullptr;
+    if (request.op >= NFD_HELPER_OPEN_WIN) {
+        params.winFilter = dialog.winFilter;
+        params.defaultName = dialog.defaultName;
+        params.title = dialog.title;
+        params.defExt = dialog.defExt;
+    } else if (request.op != NFD_HELPER_PICK_FOLDER) {
+        const bool save = request.op == NFD_HELPER_SAVE;
+        builtFilter = BuildWinFilter(
+            dialog.filters, request.filterCount, save, dialog.defaultName, params.filterIndex);
+        params.winFilter = builtFilter;
+        if (save) params.defaultName = dialog.defaultName;
+    }
+    free(dialog.filters);
+
+    nfdresult_t result;
+    switch (request.op) {
+        case NFD_HELPER_OPEN:
+        case NFD_HELPER_OPEN_WIN:
+            result = NFD_OpenDialogWin(&params);
+            break;
+        case NFD_HELPER_OPEN_MULTIPLE:
+        case NFD_HELPER_OPEN_MULTIPLE_WIN:
+            result = NFD_OpenDialogMultipleWin(&params);
+            break;
+        case NFD_HELPER_SAVE:
+        case NFD_HELPER_SAVE_WIN:
+            result = NFD_SaveDialogWin(&params);
+            break;
+        default:
+            result = NFD_PickFolderWin(&params);
+            break;
+    }
+    free(builtFilter);
+    if (result != NFD_OKAY) {
+        client.handle = nullptr;
+        NFDi_SendHelperResult(client.fd, result);
+        return;
+    }
+    client.op = static_cast<NfdHelperOp>(request.op);
+}
+
+void Disconnect(Client& client) {
+    // the portal still shows the dialog, but nobody gets its response
+    if (client.handle) NFD_FreeHandle(client.handle);
+    client.handle = nullptr;
+    close(client.fd);
+    client.fd = -1;
+    --g_clientCount;
+}
+
+// Accepts the clients that are waiting, as long as there is room.
+void AcceptClients() {
+    for (int i = 0; i != MAX_CLIENTS && g_listenFd != -1; ++i) {
+        if (g_clients[i].fd != -1) continue;
+        const int fd = accept4(g_listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd == -1) return;
+        // only the processes of our own user may see what it picks
+        struct ucred cred;
+        socklen_t length = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0 ||
+            cred.uid != geteuid()) {
+            close(fd);
+            continue;
+        }
+        g_clients[i].fd = fd;
+        g_clients[i].handle = nullptr;
+        ++g_clientCount;
+    }
+}
+
+// Stops listening, so that the next client starts a new broker, which may take over the socket at
+// once; the clients that connected in the meantime are still served.
+void StopListening() {
+    if (g_listenFd == -1) return;
+    unlink(g_address.sun_path);
+    AcceptClients();
+    close(g_listenFd);
+    g_listenFd = -1;
+    close(g_lockFd);
+    g_lockFd = -1;
+}
+
+// Starts listening on the socket, unless another broker holds its lock.  Returns 0 if it does, 1 on
+// success, or -1 on failure (with the reason printed).
+int Listen() {
+    g_address.sun_family = AF_UNIX;
+    if (!NFDi_BrokerSocketPath(g_address.sun_path, sizeof(g_address.sun_path))) {
+        fprintf(stderr, "nfd-broker: set XDG_RUNTIME_DIR or NFD_BROKER_SOCKET\n");
+        return -1;
+    }
+    char lockPath[sizeof(g_address.sun_path) + 5];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", g_address.sun_path);
+    g_lockFd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (g_lockFd == -1) {
+        perror(lockPath);
+        return -1;
+    }
+    if (flock(g_lockFd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) return 0;
+        perror(lockPath);
+        return -1;
+    }
+    // whatever is there was left by a broker that is gone
+    unlink(g_address.sun_path);
+    g_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (g_listenFd == -1 ||
+        bind(g_listenFd, reinterpret_cast<struct sockaddr*>(&g_address), sizeof(g_address)) == -1 ||
+        listen(g_listenFd, SOMAXCONN) == -1) {
+        perror(g_address.sun_path);
+        return -1;
+    }
+    return 1;
+}
+
+// Forks the daemon.  The first process waits until Detach() is called with the descriptor that this
+// returns (to the daemon), and then exits with status 0, or with 1 if the daemon exits first.
+// Returns -1 on failure.
+int Daemonize() {
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) == -1) {
+        perror("nfd-broker: pipe");
+        return -1;
+    }
+    const pid_t pid = fork();
+    if (pid == -1) {
+        perror("nfd-broker: fork");
+        return -1;
+    }
+    if (pid != 0) {
+        close(ready[1]);
+        char byte;
+        ssize_t size;
+        while ((size = read(ready[0], &byte, 1)) == -1 && errno == EINTR) {
+        }
+        _exit(size == 1 ? 0 : 1);
+    }
+    close(ready[0]);
+    // (the working directory is kept, in which a relative $NFD_BROKER_SOCKET is removed at exit)
+    setsid();
+    return ready[1];
+}
+
+// Lets the first process exit, and leaves the terminal that it may have had; until then, the
+// daemon's errors go to the client's stderr.
+void Detach(int readyFd) {
+    const int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null != -1) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+    while (write(readyFd, "", 1) == -1 && errno == EINTR) {
+    }
+    close(readyFd);
+}
+
+uint64_t NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void OnSignal(int) {
+    g_quit = 1;
+}
+
+// Serves the clients, with the portal's connection on `nfdFds`, until the broker should exit;
+// returns the exit status.
+int Serve(const int (&nfdFds)[NFD_POLL_DESCRIPTORS], long idleTimeoutS) {
+    char* message = static_cast<char*>(malloc(NFD_HELPER_MAX_MESSAGE));
+    struct pollfd fds[NFD_POLL_DESCRIPTORS + 1 + MAX_CLIENTS];
+    int clientOf[MAX_CLIENTS];
+    uint64_t idleSince = NowMs();
+    sigset_t unblocked;
+    sigemptyset(&unblocked);
+    int status = 0;
+    while (!g_quit) {
+        // once idle for long enough, leave the socket to the next broker, and exit when the
+        // clients that came in the meantime are done
+        if (g_clientCount == 0 && g_listenFd != -1 && idleTimeoutS > 0 &&
+            NowMs() - idleSince >= static_cast<uint64_t>(idleTimeoutS) * 1000) {
+            StopListening();
+        }
+        if (g_clientCount == 0 && g_listenFd == -1) break;
+
+        nfds_t count = 0;
+        for (int fd : nfdFds) fds[count++] = {fd, POLLIN, 0};
+        const nfds_t listenIndex = count;
+        const bool accepting = g_listenFd != -1 && g_clientCount != MAX_CLIENTS;
+        if (accepting) fds[count++] = {g_listenFd, POLLIN, 0};
+        const nfds_t firstClient = count;
+        for (int i = 0; i != MAX_CLIENTS; ++i) {
+            if (g_clients[i].fd == -1) continue;
+            clientOf[count - firstClient] = i;
+            fds[count++] = {g_clients[i].fd, POLLIN, 0};
+        }
+        struct timespec timeout;
+        struct timespec* timeoutPtr = nullptr;
+        if (g_clientCount == 0 && idleTimeoutS > 0) {
+            const uint64_t elapsed = NowMs() - idleSince;
+            const uint64_t left = static_cast<uint64_t>(idleTimeoutS) * 1000 - elapsed;
+            timeout.tv_sec = left / 1000;
+            timeout.tv_nsec = (left % 1000) * 1000000;
+            timeoutPtr = &timeout;
+        }
+        if (ppoll(fds, count, timeoutPtr, &unblocked) == -1) continue;
+
+        bool dispatch = false;
+        for (int i = 0; i != NFD_POLL_DESCRIPTORS; ++i) dispatch |= fds[i].revents != 0;
+        if (dispatch && NFD_Dispatch() != NFD_OKAY) {
+            // the session is over
+            fprintf(stderr, "nfd-broker: %s\n", NFD_GetError());
+            status = 1;
+            break;
+        }
+        if (accepting && fds[listenIndex].revents) AcceptClients();
+        for (nfds_t i = firstClient; i != count; ++i) {
+            if (!fds[i].revents) continue;
+            Client& client = g_clients[clientOf[i - firstClient]];
+            const ssize_t size =
+                recv(client.fd, message, NFD_HELPER_MAX_MESSAGE, MSG_TRUNC | MSG_DONTWAIT);
+            if (size == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (size <= 0) {
+                Disconnect(client);
+                if (g_clientCount == 0) idleSince = NowMs();
+                continue;
+            }
+            if (size > NFD_HELPER_MAX_MESSAGE) {
+                NFDi_SendHelperError(client.fd, PROGRAM, "received a request that is too long.");
+                continue;
+            }
+            HandleRequest(client, message, static_cast<size_t>(size));
+        }
+    }
+    free(message);
+    for (Client& client : g_clients) {
+        if (client.fd != -1) Disconnect(client);
+    }
+    return status;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool daemon = false;
+    long idleTimeoutS = DEFAULT_IDLE_TIMEOUT_S;
+    for (int i = 1; i != argc; ++i) {
+        char* end;
+        if (!strcmp(argv[i], "--daemon")) {
+            daemon = true;
+        } else if (!strcmp(argv[i], "--idle-timeout") && i + 1 != argc &&
+                   (idleTimeoutS = strtol(argv[++i], &end, 10)) >= 0 && *argv[i] && !*end) {
+        } else {
+            fprintf(stderr, "usage: %s [--daemon] [--idle-timeout SECONDS]\n", argv[0]);
+            return 2;
+        }
+    }
+    for (Client& client : g_clients) client.fd = -1;
+
+    // the signals that end the broker only arrive while it polls, so that none is missed
+    sigset_t quitSignals;
+    sigemptyset(&quitSignals);
+    sigaddset(&quitSignals, SIGTERM);
+    sigaddset(&quitSignals, SIGINT);
+    sigprocmask(SIG_BLOCK, &quitSignals, nullptr);
+    struct sigaction action = {};
+    action.sa_handler = OnSignal;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+
+    const int listening = Listen();
+    if (listening <= 0) return listening == 0 ? 0 : 1;
+    // before the bus connection, which the portal tells apart by the process that opened it
+    const int readyFd = daemon ? Daemonize() : -1;
+    if (daemon && readyFd == -1) return 1;
+
+    int nfdFds[NFD_POLL_DESCRIPTORS];
+    if (NFD_Init() != NFD_OKAY || NFD_GetPollDescriptors(nfdFds) != NFD_OKAY) {
+        fprintf(stderr, "nfd-broker: %s\n", NFD_GetError());
+        StopListening();
+        return 1;
+    }
+    if (readyFd != -1) Detach(readyFd);
+    // start the portal and read its version now, rather than in the first dialog
+    NFD_Prewarm();
+
+    const int status = Serve(nfdFds, idleTimeoutS);
+    StopListening();
+    NFD_Quit();
+    return status;
+}
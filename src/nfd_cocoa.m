@@ -28,7 +28,8 @@
 #include <UniformTypeIdentifiers/UniformTypeIdentifiers.h>
 #endif
 
-static const char* g_errorstr = NULL;
+/* current error of this thread */
+static _Thread_local const char* g_errorstr = NULL;
 
 static void NFDi_SetError(const char* msg) {
     g_errorstr = msg;
@@ -8,16 +8,26 @@
 */
 
 #include <assert.h>
+#include <fcntl.h>
 #include <gtk/gtk.h>
 #if defined(GDK_WINDOWING_X11)
 #include <gdk/gdkx.h>
 #endif
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>     // for statx()
+#include <sys/syscall.h>  // for SYS_getdents64
+#include <time.h>
+#include <unistd.h>
 
 #include "nfd.h"
+#ifdef NFD_BACKEND_MODULE
+#include "nfd_backend.h"
+#endif
 
 namespace {
 
@@ -37,8 +47,8 @@ struct FreeCheck_Guard {
     }
 };
 
-/* current error */
-const char* g_errorstr = nullptr;
+/* current error of this thread */
+thread_local const char* g_errorstr = nullptr;
 
 void NFDi_SetError(const char* msg) {
     g_errorstr = msg;
@@ -78,20 +88,79 @@ struct ButtonClickedArgs {
     GtkFileChooser* chooser;
 };
 
-void AddFiltersToDialog(GtkFileChooser* chooser,
-                        const nfdnfilteritem_t* filterList,
-                        nfdfiltersize_t filterCount) {
+/*
+Filters are cached by the content of the filter list, so that a dialog with the same filters as a
+recent one attaches the same GtkFileFilters instead of building them (and their names) again.  A
+filter set keeps its own copy of the list's strings, which its extension map points into.  Like
+the dialog pool, the cache belongs to the GTK main thread.
+*/
+
+struct FilterSet {
+    nfdfiltersize_t count;
+    /* the names and specs of the filter list: name 0, spec 0, name 1, ..., each null-terminated */
+    nfdnchar_t* strings;
+    /* one filter per item of the list, each holding a reference */
+    GtkFileFilter** filters;
+    /* null-terminated map (trailing .filter is null), for FileActivatedSignalHandler */
+    Pair_GtkFileFilter_FileExtension* map;
+    /* dialogs that are showing the set; it is not evicted while there are any */
+    unsigned users;
+    /* whether the set is in g_filterCache; if not, its last user frees it */
+    bool cached;
+};
+
+/* most recently used first */
+constexpr size_t FILTER_CACHE_SIZE = 8;
+FilterSet* g_filterCache[FILTER_CACHE_SIZE];
+
+/* shared by every dialog, since it never changes */
+GtkFileFilter* g_allFilesFilter = nullptr;
+
+FilterSet* CreateFilterSet(const nfdnfilteritem_t* filterList, nfdfiltersize_t filterCount) {
+    FilterSet* set = NFDi_Malloc<FilterSet>(sizeof(FilterSet));
+    set->count = filterCount;
+    set->filters = NFDi_Malloc<GtkFileFilter*>(sizeof(GtkFileFilter*) * (filterCount + 1));
+    set->map = NFDi_Malloc<Pair_GtkFileFilter_FileExtension>(
+        sizeof(Pair_GtkFileFilter_FileExtension) * (filterCount + 1));
+    set->users = 0;
+    set->cached = false;
+
+    // copy the strings, so that the set does not depend on the caller's list
+    size_t stringsSize = 0;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        stringsSize += strlen(filterList[index].name) + strlen(filterList[index].spec) + 2;
+    }
+    set->strings = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * (stringsSize + 1));
+    nfdnchar_t* p_strings = set->strings;
+
     if (filterCount) {
         assert(filterList);
 
         // we have filters to add ... format and add them
 
         for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
-            GtkFileFilter* filter = gtk_file_filter_new();
+            const nfdnchar_t* name = p_strings;
+            p_strings = copy(filterList[index].name,
+                             filterList[index].name + strlen(filterList[index].name),
+                             p_strings);
+            *p_strings++ = '\0';
+            const nfdnchar_t* spec = p_strings;
+            p_strings = copy(filterList[index].spec,
+                             filterList[index].spec + strlen(filterList[index].spec),
+                             p_strings);
+            *p_strings++ = '\0';
+
+            GtkFileFilter* filter = GTK_FILE_FILTER(g_object_ref_sink(gtk_file_filter_new()));
+            set->filters[index] = filter;
+
+            // store filter in map
+            set->map[index].filter = filter;
+            set->map[index].extensionBegin = spec;
+            set->map[index].extensionEnd = nullptr;
 
             // count number of file extensions
             size_t sep = 1;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
+            for (const nfdnchar_t* p_spec = spec; *p_spec; ++p_spec) {
                 if (*p_spec == L',') {
                     ++sep;
                 }
@@ -101,21 +170,19 @@ void AddFiltersToDialog(GtkFileChooser* chooser,
             // (png, jpg)"
 
             // calculate space needed (including the trailing '\0')
-            size_t nameSize =
-                sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+            size_t nameSize = sep + strlen(spec) + 3 + strlen(name);
 
             // malloc the required memory
             nfdnchar_t* nameBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * nameSize);
 
             nfdnchar_t* p_nameBuf = nameBuf;
-            for (const nfdnchar_t* p_filterName = filterList[index].name; *p_filterName;
-                 ++p_filterName) {
+            for (const nfdnchar_t* p_filterName = name; *p_filterName; ++p_filterName) {
                 *p_nameBuf++ = *p_filterName;
             }
             *p_nameBuf++ = ' ';
             *p_nameBuf++ = '(';
-            const nfdnchar_t* p_extensionStart = filterList[index].spec;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; true; ++p_spec) {
+            const nfdnchar_t* p_extensionStart = spec;
+            for (const nfdnchar_t* p_spec = spec; true; ++p_spec) {
                 if (*p_spec == ',' || !*p_spec) {
                     if (*p_spec == ',') {
                         *p_nameBuf++ = ',';
@@ -135,6 +202,12 @@ void AddFiltersToDialog(GtkFileChooser* chooser,
                     gtk_file_filter_add_pattern(filter, extnBuf);
                     NFDi_Free(extnBuf);
 
+                    // store current pointer in map (if it's
+                    // the first one)
+                    if (set->map[index].extensionEnd == nullptr) {
+                        set->map[index].extensionEnd = p_spec;
+                    }
+
                     if (*p_spec) {
                         // update the extension start point
                         p_extensionStart = p_spec + 1;
@@ -155,127 +228,270 @@ void AddFiltersToDialog(GtkFileChooser* chooser,
 
             // free the memory
             NFDi_Free(nameBuf);
-
-            // add filter to chooser
-            gtk_file_chooser_add_filter(chooser, filter);
         }
     }
+    *p_strings = '\0';
+    // set trailing map index to null
+    set->map[filterCount].filter = nullptr;
 
-    /* always append a wildcard option to the end*/
+    return set;
+}
 
-    GtkFileFilter* filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "All files");
-    gtk_file_filter_add_pattern(filter, "*");
-    gtk_file_chooser_add_filter(chooser, filter);
+void FreeFilterSet(FilterSet* set) {
+    for (nfdfiltersize_t index = 0; index != set->count; ++index) {
+        g_object_unref(set->filters[index]);
+    }
+    NFDi_Free(set->filters);
+    NFDi_Free(set->map);
+    NFDi_Free(set->strings);
+    NFDi_Free(set);
 }
 
-// returns null-terminated map (trailing .filter is null)
-Pair_GtkFileFilter_FileExtension* AddFiltersToDialogWithMap(GtkFileChooser* chooser,
-                                                            const nfdnfilteritem_t* filterList,
-                                                            nfdfiltersize_t filterCount) {
-    Pair_GtkFileFilter_FileExtension* map = NFDi_Malloc<Pair_GtkFileFilter_FileExtension>(
-        sizeof(Pair_GtkFileFilter_FileExtension) * (filterCount + 1));
+bool FilterSetMatches(const FilterSet* set,
+                      const nfdnfilteritem_t* filterList,
+                      nfdfiltersize_t filterCount) {
+    if (set->count != filterCount) return false;
+    const nfdnchar_t* p_strings = set->strings;
+    for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
+        if (strcmp(p_strings, filterList[index].name) != 0) return false;
+        p_strings += strlen(p_strings) + 1;
+        if (strcmp(p_strings, filterList[index].spec) != 0) return false;
+        p_strings += strlen(p_strings) + 1;
+    }
+    return true;
+}
 
-    if (filterCount) {
-        assert(filterList);
+// Returns the filter set for the list, from the cache if it has one.  Must be balanced by
+// ReleaseFilterSet().
+FilterSet* AcquireFilterSet(const nfdnfilteritem_t* filterList, nfdfiltersize_t filterCount) {
+    for (size_t i = 0; i != FILTER_CACHE_SIZE && g_filterCache[i]; ++i) {
+        FilterSet* set = g_filterCache[i];
+        if (FilterSetMatches(set, filterList, filterCount)) {
+            memmove(&g_filterCache[1], &g_filterCache[0], sizeof(FilterSet*) * i);
+            g_filterCache[0] = set;
+            ++set->users;
+            return set;
+        }
+    }
 
-        // we have filters to add ... format and add them
+    FilterSet* set = CreateFilterSet(filterList, filterCount);
+    set->users = 1;
+    // cache it in place of the least recently used set that no dialog is showing (if they all are,
+    // which takes nested dialogs, the new set is freed after use)
+    for (size_t i = FILTER_CACHE_SIZE; i-- != 0;) {
+        if (!g_filterCache[i] || !g_filterCache[i]->users) {
+            if (g_filterCache[i]) FreeFilterSet(g_filterCache[i]);
+            memmove(&g_filterCache[1], &g_filterCache[0], sizeof(FilterSet*) * i);
+            g_filterCache[0] = set;
+            set->cached = true;
+            break;
+        }
+    }
+    return set;
+}
 
-        for (nfdfiltersize_t index = 0; index != filterCount; ++index) {
-            GtkFileFilter* filter = gtk_file_filter_new();
+void ReleaseFilterSet(FilterSet* set) {
+    if (--set->users == 0 && !set->cached) FreeFilterSet(set);
+}
 
-            // store filter in map
-            map[index].filter = filter;
-            map[index].extensionBegin = filterList[index].spec;
-            map[index].extensionEnd = nullptr;
+void ClearFilterCache() {
+    for (size_t i = 0; i != FILTER_CACHE_SIZE && g_filterCache[i]; ++i) {
+        FilterSet* set = g_filterCache[i];
+        g_filterCache[i] = nullptr;
+        set->cached = false;
+        if (!set->users) FreeFilterSet(set);
+    }
+    if (g_allFilesFilter) {
+        g_object_unref(g_allFilesFilter);
+        g_allFilesFilter = nullptr;
+    }
+}
 
-            // count number of file extensions
-            size_t sep = 1;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; *p_spec; ++p_spec) {
-                if (*p_spec == L',') {
-                    ++sep;
-                }
-            }
+struct FilterSet_Guard {
+    FilterSet* data;
+    FilterSet_Guard(const nfdnfilteritem_t* filterList, nfdfiltersize_t filterCount)
+        : data(AcquireFilterSet(filterList, filterCount)) {}
+    ~FilterSet_Guard() { ReleaseFilterSet(data); }
+};
 
-            // friendly name conversions: "png,jpg" -> "Image files
-            // (png, jpg)"
+void AddFiltersToDialog(GtkFileChooser* chooser, const FilterSet* set) {
+    for (nfdfiltersize_t index = 0; index != set->count; ++index) {
+        gtk_file_chooser_add_filter(chooser, set->filters[index]);
+    }
 
-            // calculate space needed (including the trailing '\0')
-            size_t nameSize =
-                sep + strlen(filterList[index].spec) + 3 + strlen(filterList[index].name);
+    /* always append a wildcard option to the end*/
+    if (!g_allFilesFilter) {
+        g_allFilesFilter = GTK_FILE_FILTER(g_object_ref_sink(gtk_file_filter_new()));
+        gtk_file_filter_set_name(g_allFilesFilter, "All files");
+        gtk_file_filter_add_pattern(g_allFilesFilter, "*");
+    }
+    gtk_file_chooser_add_filter(chooser, g_allFilesFilter);
+}
 
-            // malloc the required memory
-            nfdnchar_t* nameBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) * nameSize);
+/*
+Directory prefetch (NFD_SetDirectoryPrefetch): when a dialog opens in a default path, a background
+thread reads that directory with getdents64, and then it and a few helpers statx() its entries,
+while the dialog is being built.  The chooser's own enumeration then finds the entries and their
+attributes in the kernel's dentry and inode caches, instead of waiting for the disk (or the NFS
+server) one entry at a time after the dialog has painted.  The entry cap and the time budget are
+checked between system calls, so a single call that hangs can still overrun the budget.  A
+prefetch is not started while another one is running.
+*/
 
-            nfdnchar_t* p_nameBuf = nameBuf;
-            for (const nfdnchar_t* p_filterName = filterList[index].name; *p_filterName;
-                 ++p_filterName) {
-                *p_nameBuf++ = *p_filterName;
-            }
-            *p_nameBuf++ = ' ';
-            *p_nameBuf++ = '(';
-            const nfdnchar_t* p_extensionStart = filterList[index].spec;
-            for (const nfdnchar_t* p_spec = filterList[index].spec; true; ++p_spec) {
-                if (*p_spec == ',' || !*p_spec) {
-                    if (*p_spec == ',') {
-                        *p_nameBuf++ = ',';
-                        *p_nameBuf++ = ' ';
-                    }
+/* threads that statx() the entries, including the one that read the directory */
+constexpr int PREFETCH_THREADS = 4;
+
+/* set by NFD_SetDirectoryPrefetch, with atomic operations since a dialog on another thread may
+ * read them; prefetch is off while either is 0 */
+size_t g_prefetchMaxEntries = 0;
+int g_prefetchBudgetMs = 0;
+/* whether a prefetch is running; set and cleared with atomic operations */
+bool g_prefetchRunning = false;
+
+struct PrefetchJob {
+    int dirFd;
+    size_t maxEntries;
+    uint64_t deadlineNs;
+    /* the names read from the directory, each null-terminated, back to back */
+    char* names;
+    size_t namesSize;
+    size_t namesCapacity;
+    /* where each name starts in `names`; grows with the names, up to maxEntries */
+    size_t* offsets;
+    size_t count;
+    size_t offsetsCapacity;
+    /* the next entry to statx(); taken with an atomic increment */
+    size_t next;
+    /* threads still using the job; the last one frees it */
+    int refs;
+};
 
-                    // +1 for the trailing '\0'
-                    nfdnchar_t* extnBuf = NFDi_Malloc<nfdnchar_t>(sizeof(nfdnchar_t) *
-                                                                  (p_spec - p_extensionStart + 3));
-                    nfdnchar_t* p_extnBufEnd = extnBuf;
-                    *p_extnBufEnd++ = '*';
-                    *p_extnBufEnd++ = '.';
-                    p_extnBufEnd = copy(p_extensionStart, p_spec, p_extnBufEnd);
-                    *p_extnBufEnd++ = '\0';
-                    assert((size_t)(p_extnBufEnd - extnBuf) ==
-                           sizeof(nfdnchar_t) * (p_spec - p_extensionStart + 3));
-                    gtk_file_filter_add_pattern(filter, extnBuf);
-                    NFDi_Free(extnBuf);
+/* the start of a record returned by getdents64 (struct linux_dirent64) */
+struct Dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    /* the start of the null-terminated name, which runs past the struct (ISO C++ has no flexible
+     * array members) */
+    char d_name[1];
+};
 
-                    // store current pointer in map (if it's
-                    // the first one)
-                    if (map[index].extensionEnd == nullptr) {
-                        map[index].extensionEnd = p_spec;
-                    }
+uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+}
 
-                    if (*p_spec) {
-                        // update the extension start point
-                        p_extensionStart = p_spec + 1;
-                    } else {
-                        // reached the '\0' character
-                        break;
-                    }
-                } else {
-                    *p_nameBuf++ = *p_spec;
-                }
-            }
-            *p_nameBuf++ = ')';
-            *p_nameBuf++ = '\0';
-            assert((size_t)(p_nameBuf - nameBuf) == sizeof(nfdnchar_t) * nameSize);
+// Appends the name to the job; returns false if it is out of memory.
+bool AddPrefetchName(PrefetchJob* job, const char* name) {
+    const size_t length = strlen(name) + 1;
+    if (job->namesSize + length > job->namesCapacity) {
+        size_t capacity = job->namesCapacity ? job->namesCapacity * 2 : 16384;
+        while (capacity < job->namesSize + length) capacity *= 2;
+        char* names = static_cast<char*>(realloc(job->names, capacity));
+        if (!names) return false;
+        job->names = names;
+        job->namesCapacity = capacity;
+    }
+    if (job->count == job->offsetsCapacity) {
+        size_t capacity = job->offsetsCapacity ? job->offsetsCapacity * 2 : 1024;
+        if (capacity > job->maxEntries) capacity = job->maxEntries;
+        if (capacity > SIZE_MAX / sizeof(size_t)) return false;
+        size_t* offsets = static_cast<size_t*>(realloc(job->offsets, sizeof(size_t) * capacity));
+        if (!offsets) return false;
+        job->offsets = offsets;
+        job->offsetsCapacity = capacity;
+    }
+    memcpy(job->names + job->namesSize, name, length);
+    job->offsets[job->count++] = job->namesSize;
+    job->namesSize += length;
+    return true;
+}
 
-            // add to the filter
-            gtk_file_filter_set_name(filter, nameBuf);
+// Reads the names in the directory, up to the cap and the deadline.
+void ReadPrefetchNames(PrefetchJob* job) {
+    // 32 KiB holds hundreds of entries, so that a large directory takes few round trips
+    alignas(Dirent64) char buf[32768];
+    while (job->count != job->maxEntries && NowNs() < job->deadlineNs) {
+        const long read = syscall(SYS_getdents64, job->dirFd, buf, sizeof(buf));
+        if (read <= 0) return;
+        for (long pos = 0; pos < read;) {
+            const Dirent64* entry = reinterpret_cast<const Dirent64*>(buf + pos);
+            const char* name = buf + pos + offsetof(Dirent64, d_name);
+            pos += entry->d_reclen;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            if (!AddPrefetchName(job, name)) return;
+            if (job->count == job->maxEntries) return;
+        }
+    }
+}
 
-            // free the memory
-            NFDi_Free(nameBuf);
+void ReleasePrefetchJob(PrefetchJob* job) {
+    if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    close(job->dirFd);
+    free(job->names);
+    free(job->offsets);
+    free(job);
+    __atomic_store_n(&g_prefetchRunning, false, __ATOMIC_RELEASE);
+}
 
-            // add filter to chooser
-            gtk_file_chooser_add_filter(chooser, filter);
-        }
+void* StatPrefetchEntries(void* arg) {
+    PrefetchJob* job = static_cast<PrefetchJob*>(arg);
+    for (;;) {
+        const size_t index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (index >= job->count || NowNs() >= job->deadlineNs) break;
+        // the result is not needed: the point is that the kernel caches the inode
+        struct statx stx;
+        statx(job->dirFd,
+              job->names + job->offsets[index],
+              AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+              STATX_BASIC_STATS,
+              &stx);
     }
-    // set trailing map index to null
-    map[filterCount].filter = nullptr;
+    ReleasePrefetchJob(job);
+    return nullptr;
+}
 
-    /* always append a wildcard option to the end*/
-    GtkFileFilter* filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "All files");
-    gtk_file_filter_add_pattern(filter, "*");
-    gtk_file_chooser_add_filter(chooser, filter);
+void* RunPrefetch(void* arg) {
+    PrefetchJob* job = static_cast<PrefetchJob*>(arg);
+    ReadPrefetchNames(job);
+    // the helpers each hold a reference, taken before they start
+    for (int i = 1; i != PREFETCH_THREADS && job->count > static_cast<size_t>(i); ++i) {
+        __atomic_add_fetch(&job->refs, 1, __ATOMIC_RELAXED);
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, StatPrefetchEntries, job) != 0) {
+            __atomic_sub_fetch(&job->refs, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        pthread_detach(thread);
+    }
+    return StatPrefetchEntries(job);
+}
 
-    return map;
+// Starts prefetching the directory in the background, if prefetch is on and none is running.
+// Failures are ignored: the dialog lists the directory itself anyway.
+void StartPrefetch(const char* defaultPath) {
+    const size_t maxEntries = __atomic_load_n(&g_prefetchMaxEntries, __ATOMIC_RELAXED);
+    const int budgetMs = __atomic_load_n(&g_prefetchBudgetMs, __ATOMIC_RELAXED);
+    if (!defaultPath || !*defaultPath || !maxEntries || budgetMs <= 0) return;
+    if (__atomic_exchange_n(&g_prefetchRunning, true, __ATOMIC_ACQ_REL)) return;
+
+    PrefetchJob* job = static_cast<PrefetchJob*>(calloc(1, sizeof(PrefetchJob)));
+    if (job) {
+        job->dirFd = open(defaultPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        job->maxEntries = maxEntries;
+        job->deadlineNs = NowNs() + static_cast<uint64_t>(budgetMs) * 1000000u;
+        job->refs = 1;
+        pthread_t thread;
+        if (job->dirFd != -1 && pthread_create(&thread, nullptr, RunPrefetch, job) == 0) {
+            pthread_detach(thread);
+            return;
+        }
+        if (job->dirFd != -1) close(job->dirFd);
+        free(job);
+    }
+    __atomic_store_n(&g_prefetchRunning, false, __ATOMIC_RELEASE);
 }
 
 void SetDefaultPath(GtkFileChooser* chooser, const char* defaultPath) {
@@ -295,20 +511,229 @@ void SetDefaultName(GtkFileChooser* chooser, const char* defaultName) {
     gtk_file_chooser_set_current_name(chooser, defaultName);
 }
 
+/* the most pending events that WaitForCleanup() processes, so that a busy display cannot keep it
+ * from returning */
+constexpr int MAX_CLEANUP_ITERATIONS = 64;
+
 void WaitForCleanup() {
-    while (gtk_events_pending()) gtk_main_iteration();
+    for (int i = 0; i != MAX_CLEANUP_ITERATIONS && gtk_events_pending(); ++i) {
+        gtk_main_iteration_do(FALSE);
+    }
 }
 
-struct Widget_Guard {
-    GtkWidget* data;
-    Widget_Guard(GtkWidget* widget) : data(widget) {}
-    ~Widget_Guard() {
-        WaitForCleanup();
-        gtk_widget_destroy(data);
-        WaitForCleanup();
+gboolean DestroyWidgetCallback(gpointer widget) {
+    gtk_widget_destroy(static_cast<GtkWidget*>(widget));
+    return G_SOURCE_REMOVE;
+}
+
+// Destroys the widget once the GTK main loop is idle: by the application's main loop if it runs
+// one, or else by the next dialog's.
+void DestroyWidgetLater(GtkWidget* widget) {
+    g_idle_add(DestroyWidgetCallback, widget);
+}
+
+/*
+GTK is initialized by the first dialog rather than by NFD_Init(), so that programs that call
+NFD_Init() at startup but rarely show a dialog do not pay for connecting to the display.
+
+Building a GtkFileChooserDialog costs more than showing it, so dialogs are not destroyed when they
+close: they are hidden, reset and kept in a small pool per action, and the next dialog of the same
+action reuses one.  All of this state belongs to the GTK main thread (the one that shows dialogs),
+so it needs no lock.  NFD_Quit() destroys the pool when the last NFD_Init() is balanced.
+*/
+
+/* the pools; dialogs to open one file and to open several share one */
+enum DialogKind { DIALOG_OPEN, DIALOG_SAVE, DIALOG_FOLDER, DIALOG_KIND_COUNT };
+/* more than one dialog of an action is only built if one is shown while another is open, e.g. from
+ * a callback of the application run by the nested main loop of the first */
+constexpr size_t DIALOG_POOL_SIZE = 2;
+GtkWidget* g_dialogPool[DIALOG_KIND_COUNT][DIALOG_POOL_SIZE];
+
+/* NFD_Init() calls without a matching NFD_Quit() */
+size_t g_initCount = 0;
+bool g_gtkInitialized = false;
+
+bool EnsureGtk() {
+    if (g_gtkInitialized) return true;
+    // not remembered if it fails, so that a later dialog may find a display
+    if (!gtk_init_check(NULL, NULL)) {
+        NFDi_SetError("Failed to initialize GTK+ with gtk_init_check.");
+        return false;
     }
+    g_gtkInitialized = true;
+    return true;
+}
+
+GtkWidget* CreateDialog(DialogKind kind) {
+    switch (kind) {
+        case DIALOG_OPEN:
+            return gtk_file_chooser_dialog_new("Open File",
+                                               nullptr,
+                                               GTK_FILE_CHOOSER_ACTION_OPEN,
+                                               "_Cancel",
+                                               GTK_RESPONSE_CANCEL,
+                                               "_Open",
+                                               GTK_RESPONSE_ACCEPT,
+                                               nullptr);
+        case DIALOG_SAVE: {
+            GtkWidget* widget = gtk_file_chooser_dialog_new("Save File",
+                                                            nullptr,
+                                                            GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                            "_Cancel",
+                                                            GTK_RESPONSE_CANCEL,
+                                                            "_Save",
+                                                            GTK_RESPONSE_ACCEPT,
+                                                            nullptr);
+            // Prompt on overwrite
+            gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(widget), TRUE);
+            return widget;
+        }
+        default:
+            return gtk_file_chooser_dialog_new("Select folder",
+                                               nullptr,
+                                               GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+                                               "_Cancel",
+                                               GTK_RESPONSE_CANCEL,
+                                               "_Select",
+                                               GTK_RESPONSE_ACCEPT,
+                                               nullptr);
+    }
+}
+
+/*
+Performance profile (NfdDialogParams.gtkFlags): the chooser features that cost the most in folders
+with very many entries.  GtkFileChooserWidget has no API for hiding Recent, so the flags are set on
+the widgets inside it, once, when a dialog is built for them; the pool only hands a dialog out
+again for the same flags.  The chooser still asks GIO for the attributes of every entry, and sorts
+them (it sets up the sorting of every folder's model itself).
+*/
+
+/* the key of the NfdGtkFlags that a dialog was built with, in its object data */
+constexpr const char DIALOG_FLAGS_KEY[] = "nfd-gtk-flags";
+
+struct FindWidgetArgs {
+    GType type;
+    GtkWidget* found;
 };
 
+void FindWidgetCallback(GtkWidget* widget, gpointer data) {
+    FindWidgetArgs* args = static_cast<FindWidgetArgs*>(data);
+    if (args->found) return;
+    if (G_TYPE_CHECK_INSTANCE_TYPE(widget, args->type)) {
+        args->found = widget;
+    } else if (GTK_IS_CONTAINER(widget)) {
+        gtk_container_forall(GTK_CONTAINER(widget), FindWidgetCallback, data);
+    }
+}
+
+// Returns the first widget of the given type under `root` (internal children included), or null.
+GtkWidget* FindWidget(GtkWidget* root, GType type) {
+    FindWidgetArgs args = {type, nullptr};
+    FindWidgetCallback(root, &args);
+    return args.found;
+}
+
+void ApplyProfile(GtkWidget* widget, unsigned int flags) {
+    g_object_set_data(G_OBJECT(widget), DIALOG_FLAGS_KEY, GUINT_TO_POINTER(flags));
+    if (!flags) return;
+
+    // the places on the left of the file list
+    GtkWidget* sidebar = FindWidget(widget, GTK_TYPE_PLACES_SIDEBAR);
+
+    if (sidebar && (flags & NFD_GTK_NO_RECENT)) {
+        gtk_places_sidebar_set_show_recent(GTK_PLACES_SIDEBAR(sidebar), FALSE);
+    }
+    if (flags & NFD_GTK_LOCAL_ONLY) {
+        gtk_file_chooser_set_local_only(GTK_FILE_CHOOSER(widget), TRUE);
+        if (sidebar) {
+            gtk_places_sidebar_set_local_only(GTK_PLACES_SIDEBAR(sidebar), TRUE);
+            gtk_places_sidebar_set_show_other_locations(GTK_PLACES_SIDEBAR(sidebar), FALSE);
+        }
+    }
+}
+
+// Returns a hidden dialog of the given kind, built for the given NfdGtkFlags, from the pool if it
+// has one and the caller sets the folder (`setsFolder`).  Otherwise, the dialog is a new one, which
+// starts where GTK chooses (e.g. in Recent), not where the last user of a pooled one left it.
+GtkWidget* AcquireDialog(DialogKind kind, const char* title, unsigned int flags, bool setsFolder) {
+    GtkWidget* widget = nullptr;
+    for (size_t i = DIALOG_POOL_SIZE; setsFolder && i-- != 0;) {
+        GtkWidget* pooled = g_dialogPool[kind][i];
+        if (pooled &&
+            GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(pooled), DIALOG_FLAGS_KEY)) == flags) {
+            widget = pooled;
+            g_dialogPool[kind][i] = nullptr;
+            break;
+        }
+    }
+    if (!widget) {
+        widget = CreateDialog(kind);
+        ApplyProfile(widget, flags);
+    }
+    gtk_window_set_title(GTK_WINDOW(widget), title);
+    return widget;
+}
+
+// Hides the dialog and undoes what the last caller set on it, so that it can be reused.  The folder
+// is left as it is (GTK cannot unset it, and changing it would list another directory in the
+// background): only callers that set it get a pooled dialog.
+void ResetDialog(GtkWidget* widget) {
+    GtkFileChooser* chooser = GTK_FILE_CHOOSER(widget);
+    gtk_widget_hide(widget);
+    // removing the current filter leaves the chooser with none, as a new one has
+    GSList* filters = gtk_file_chooser_list_filters(chooser);
+    for (GSList* node = filters; node; node = node->next) {
+        gtk_file_chooser_remove_filter(chooser, GTK_FILE_FILTER(node->data));
+    }
+    g_slist_free(filters);
+    gtk_file_chooser_unselect_all(chooser);
+    gtk_file_chooser_set_select_multiple(chooser, FALSE);
+    if (gtk_file_chooser_get_action(chooser) == GTK_FILE_CHOOSER_ACTION_SAVE) {
+        gtk_file_chooser_set_current_name(chooser, "");
+    }
+}
+
+// Returns the dialog to its pool, or destroys it if the pool is full.  Returns as soon as the
+// window is hidden: the events that are still pending (e.g. the release of the button that closed
+// it) are left to the next main loop iteration, instead of being processed before the result.
+void ReleaseDialog(DialogKind kind, GtkWidget* widget) {
+    ResetDialog(widget);
+    // the window must disappear now, even if nothing processes GTK events until the next dialog,
+    // so send the unmap request to the display server
+    gdk_display_flush(gtk_widget_get_display(widget));
+    for (size_t i = 0; i != DIALOG_POOL_SIZE; ++i) {
+        if (!g_dialogPool[kind][i]) {
+            g_dialogPool[kind][i] = widget;
+            return;
+        }
+    }
+    DestroyWidgetLater(widget);
+}
+
+void DestroyDialogPool() {
+    bool destroyed = false;
+    for (size_t kind = 0; kind != DIALOG_KIND_COUNT; ++kind) {
+        for (size_t i = 0; i != DIALOG_POOL_SIZE; ++i) {
+            if (g_dialogPool[kind][i]) {
+                gtk_widget_destroy(g_dialogPool[kind][i]);
+                g_dialogPool[kind][i] = nullptr;
+                destroyed = true;
+            }
+        }
+    }
+    // NFD_Quit() may be the last GTK call of the program, so the windows are destroyed now
+    if (destroyed) WaitForCleanup();
+}
+
+struct Dialog_Guard {
+    DialogKind kind;
+    GtkWidget* data;
+    Dialog_Guard(DialogKind dialogKind, const char* title, bool setsFolder, unsigned int flags = 0)
+        : kind(dialogKind), data(AcquireDialog(dialogKind, title, flags, setsFolder)) {}
+    ~Dialog_Guard() { ReleaseDialog(kind, data); }
+};
+
+
 void FileActivatedSignalHandler(GtkButton* saveButton, void* userdata) {
     (void)saveButton;  // silence the unused arg warning
 
@@ -381,6 +806,139 @@ gint RunDialogWithFocus(GtkDialog* dialog) {
     return gtk_dialog_run(dialog);
 }
 
+// Adds the filters of a Windows-style filter string ("name\0pattern;pattern\0...\0") to the
+// chooser, and selects the one at the 1-based `filterIndex`.
+void AddWinFiltersToDialog(GtkFileChooser* chooser,
+                           const char* winFilter,
+                           unsigned long filterIndex) {
+    if (!winFilter) return;
+    const char* ptr = winFilter;
+    for (unsigned long i = 1; *ptr; ++i) {
+        GtkFileFilter* filter = gtk_file_filter_new();
+        gtk_file_filter_set_name(filter, ptr);
+        ptr += strlen(ptr) + 1;
+        // malformed filter behaves similar to *.* (as on the portal backend)
+        const bool malformed = !*ptr;
+        for (const char* pattern = ptr; *pattern;) {
+            const char* end = strchr(pattern, ';');
+            if (!end) end = pattern + strlen(pattern);
+            gchar* copy = g_strndup(pattern, end - pattern);
+            // "*.*" means every file on Windows, even those without an extension
+            gtk_file_filter_add_pattern(filter, strcmp(copy, "*.*") == 0 ? "*" : copy);
+            g_free(copy);
+            pattern = *end ? end + 1 : end;
+        }
+        if (malformed) gtk_file_filter_add_pattern(filter, "*");
+        gtk_file_chooser_add_filter(chooser, filter);
+        if (i == filterIndex) gtk_file_chooser_set_filter(chooser, filter);
+        if (malformed) break;
+        ptr += strlen(ptr) + 1;
+    }
+}
+
+// Copies the paths into one list, as NFD_OpenDialogMultipleWin returns them: a single path, or the
+// directory followed by the name of every file, each null-terminated, and then an empty string.
+void CopyPathListWin(GSList* fileList, char*& outPathList, size_t& outPathListSize) {
+    gchar* dir = nullptr;
+    size_t size = 1;
+    if (fileList && fileList->next) {
+        dir = g_path_get_dirname(static_cast<const gchar*>(fileList->data));
+        size += strlen(dir) + 1;
+        for (GSList* node = fileList; node; node = node->next) {
+            size += strlen(strrchr(static_cast<const gchar*>(node->data), '/') + 1) + 1;
+        }
+    } else if (fileList) {
+        size += strlen(static_cast<const gchar*>(fileList->data)) + 1;
+    }
+
+    char* pathList = static_cast<char*>(g_malloc(size));
+    char* p_pathList = pathList;
+    auto append = [&p_pathList](const char* path) {
+        const size_t length = strlen(path) + 1;
+        memcpy(p_pathList, path, length);
+        p_pathList += length;
+    };
+    if (dir) {
+        append(dir);
+        // every file is in that directory
+        for (GSList* node = fileList; node; node = node->next) {
+            append(strrchr(static_cast<const gchar*>(node->data), '/') + 1);
+        }
+        g_free(dir);
+    } else if (fileList) {
+        append(static_cast<const gchar*>(fileList->data));
+    }
+    *p_pathList++ = '\0';  // double null-terminate
+    assert(static_cast<size_t>(p_pathList - pathList) == size);
+    outPathList = pathList;
+    outPathListSize = size;
+}
+
+// Shows a dialog for the NFD_*Win functions.
+nfdresult_t ShowDialogWin(NfdDialogParams* params,
+                          DialogKind kind,
+                          bool multiple,
+                          const char* defaultTitle) {
+    if (params->outAsyncOpHandle) {
+        NFDi_SetError("Async dialogs are not supported by the GTK backend.");
+        return NFD_ERROR;
+    }
+
+    // overlaps with building the dialog
+    StartPrefetch(params->defaultPath);
+
+    if (!EnsureGtk()) return NFD_ERROR;
+
+    // guard to return the widget to the pool when returning from this function
+    const bool hasDefaultPath = params->defaultPath && *params->defaultPath;
+    Dialog_Guard dialogGuard(kind,
+                             params->title && *params->title ? params->title : defaultTitle,
+                             hasDefaultPath || (params->gtkFlags & NFD_GTK_NO_RECENT),
+                             params->gtkFlags);
+    GtkWidget* widget = dialogGuard.data;
+    GtkFileChooser* chooser = GTK_FILE_CHOOSER(widget);
+
+    if (multiple) gtk_file_chooser_set_select_multiple(chooser, TRUE);
+    if (kind != DIALOG_FOLDER) {
+        AddWinFiltersToDialog(chooser, params->winFilter, params->filterIndex);
+    }
+
+    /* Set the default path; without one, start in the current directory rather than in Recent */
+    if (hasDefaultPath) {
+        SetDefaultPath(chooser, params->defaultPath);
+    } else if (params->gtkFlags & NFD_GTK_NO_RECENT) {
+        gchar* currentDir = g_get_current_dir();
+        gtk_file_chooser_set_current_folder(chooser, currentDir);
+        g_free(currentDir);
+    }
+    if (kind == DIALOG_SAVE) SetDefaultName(chooser, params->defaultName);
+
+    if (RunDialogWithFocus(GTK_DIALOG(widget)) != GTK_RESPONSE_ACCEPT) return NFD_CANCEL;
+
+    if (multiple) {
+        GSList* fileList = gtk_file_chooser_get_filenames(chooser);
+        CopyPathListWin(fileList, *params->outPath, params->outPathSize);
+        g_slist_free_full(fileList, g_free);
+        return NFD_OKAY;
+    }
+
+    char* path = gtk_file_chooser_get_filename(chooser);
+    if (!path) {
+        NFDi_SetError("The chooser did not return a local path.");
+        return NFD_ERROR;
+    }
+    // the default extension, if the name has none
+    if (kind == DIALOG_SAVE && params->defExt && *params->defExt &&
+        !strchr(strrchr(path, '/'), '.')) {
+        char* withExtension = g_strconcat(path, ".", params->defExt, nullptr);
+        g_free(path);
+        path = withExtension;
+    }
+    *params->outPath = path;
+    params->outPathSize = strlen(path) + 1;
+    return NFD_OKAY;
+}
+
 }  // namespace
 
 const char* NFD_GetError(void) {
@@ -394,15 +952,21 @@ void NFD_ClearError(void) {
 /* public */
 
 nfdresult_t NFD_Init(void) {
-    // Init GTK
-    if (!gtk_init_check(NULL, NULL)) {
-        NFDi_SetError("Failed to initialize GTK+ with gtk_init_check.");
-        return NFD_ERROR;
-    }
+    // GTK itself is initialized by the first dialog
+    ++g_initCount;
     return NFD_OKAY;
 }
+void NFD_SetDirectoryPrefetch(size_t maxEntries, int budgetMs) {
+    __atomic_store_n(&g_prefetchMaxEntries, maxEntries, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_prefetchBudgetMs, budgetMs, __ATOMIC_RELAXED);
+}
+
 void NFD_Quit(void) {
-    // do nothing, GTK cannot be de-initialized
+    // GTK cannot be de-initialized, but the dialogs and filters kept for reuse can be destroyed
+    if (g_initCount && --g_initCount == 0) {
+        DestroyDialogPool();
+        ClearFilterCache();
+    }
 }
 
 void NFD_FreePathN(nfdnchar_t* filePath) {
@@ -414,20 +978,18 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
                             const nfdnfilteritem_t* filterList,
                             nfdfiltersize_t filterCount,
                             const nfdnchar_t* defaultPath) {
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Open File",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_OPEN,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Open",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
+    // overlaps with building the dialog
+    StartPrefetch(defaultPath);
+
+    if (!EnsureGtk()) return NFD_ERROR;
+
+    // guard to return the widget to the pool when returning from this function
+    Dialog_Guard dialogGuard(DIALOG_OPEN, "Open File", defaultPath && *defaultPath);
+    GtkWidget* widget = dialogGuard.data;
 
     /* Build the filter list */
-    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), filterList, filterCount);
+    FilterSet_Guard filterSetGuard(filterList, filterCount);
+    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), filterSetGuard.data);
 
     /* Set the default path */
     SetDefaultPath(GTK_FILE_CHOOSER(widget), defaultPath);
@@ -446,23 +1008,21 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
                                     const nfdnfilteritem_t* filterList,
                                     nfdfiltersize_t filterCount,
                                     const nfdnchar_t* defaultPath) {
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Open Files",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_OPEN,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Open",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
+    // overlaps with building the dialog
+    StartPrefetch(defaultPath);
+
+    if (!EnsureGtk()) return NFD_ERROR;
+
+    // guard to return the widget to the pool when returning from this function
+    Dialog_Guard dialogGuard(DIALOG_OPEN, "Open Files", defaultPath && *defaultPath);
+    GtkWidget* widget = dialogGuard.data;
 
     // set select multiple
     gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(widget), TRUE);
 
     /* Build the filter list */
-    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), filterList, filterCount);
+    FilterSet_Guard filterSetGuard(filterList, filterCount);
+    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), filterSetGuard.data);
 
     /* Set the default path */
     SetDefaultPath(GTK_FILE_CHOOSER(widget), defaultPath);
@@ -483,26 +1043,24 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
                             nfdfiltersize_t filterCount,
                             const nfdnchar_t* defaultPath,
                             const nfdnchar_t* defaultName) {
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Save File",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_SAVE,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    nullptr);
+    // overlaps with building the dialog
+    StartPrefetch(defaultPath);
 
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
+    if (!EnsureGtk()) return NFD_ERROR;
 
-    GtkWidget* saveButton = gtk_dialog_add_button(GTK_DIALOG(widget), "_Save", GTK_RESPONSE_ACCEPT);
+    // guard to return the widget to the pool when returning from this function
+    Dialog_Guard dialogGuard(DIALOG_SAVE, "Save File", defaultPath && *defaultPath);
+    GtkWidget* widget = dialogGuard.data;
 
-    // Prompt on overwrite
-    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(widget), TRUE);
+    GtkWidget* saveButton =
+        gtk_dialog_get_widget_for_response(GTK_DIALOG(widget), GTK_RESPONSE_ACCEPT);
 
     /* Build the filter list */
+    FilterSet_Guard filterSetGuard(filterList, filterCount);
+    AddFiltersToDialog(GTK_FILE_CHOOSER(widget), filterSetGuard.data);
     ButtonClickedArgs buttonClickedArgs;
     buttonClickedArgs.chooser = GTK_FILE_CHOOSER(widget);
-    buttonClickedArgs.map =
-        AddFiltersToDialogWithMap(GTK_FILE_CHOOSER(widget), filterList, filterCount);
+    buttonClickedArgs.map = filterSetGuard.data->map;
 
     /* Set the default path */
     SetDefaultPath(GTK_FILE_CHOOSER(widget), defaultPath);
@@ -521,9 +1079,6 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
     /* unset the handler */
     g_signal_handler_disconnect(G_OBJECT(saveButton), handlerID);
 
-    /* free the filter map */
-    NFDi_Free(buttonClickedArgs.map);
-
     if (result == GTK_RESPONSE_ACCEPT) {
         // write out the file name
         *outPath = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(widget));
@@ -535,17 +1090,14 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
 }
 
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
-    GtkWidget* widget = gtk_file_chooser_dialog_new("Select folder",
-                                                    nullptr,
-                                                    GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
-                                                    "_Cancel",
-                                                    GTK_RESPONSE_CANCEL,
-                                                    "_Select",
-                                                    GTK_RESPONSE_ACCEPT,
-                                                    nullptr);
-
-    // guard to destroy the widget when returning from this function
-    Widget_Guard widgetGuard(widget);
+    // overlaps with building the dialog
+    StartPrefetch(defaultPath);
+
+    if (!EnsureGtk()) return NFD_ERROR;
+
+    // guard to return the widget to the pool when returning from this function
+    Dialog_Guard dialogGuard(DIALOG_FOLDER, "Select folder", defaultPath && *defaultPath);
+    GtkWidget* widget = dialogGuard.data;
 
     /* Set the default path */
     SetDefaultPath(GTK_FILE_CHOOSER(widget), defaultPath);
@@ -560,6 +1112,22 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
     }
 }
 
+nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, DIALOG_OPEN, false, "Open File");
+}
+
+nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, DIALOG_OPEN, true, "Open Files");
+}
+
+nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, DIALOG_SAVE, false, "Save File");
+}
+
+nfdresult_t NFD_PickFolderWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, DIALOG_FOLDER, false, "Select folder");
+}
+
 nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
     assert(pathSet);
     // const_cast because methods on GSList aren't const, but it should act
@@ -629,3 +1197,57 @@ nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** out
 
     return NFD_OKAY;
 }
+
+#ifdef NFD_BACKEND_MODULE
+namespace {
+
+// The basic API, synchronous NFD_*Win dialogs and prefetch; nfd_runtime.cpp reports the rest as
+// unsupported.  GTK is always available,
+// since it is the fallback (the first dialog reports if there is no display).
+constexpr NfdBackend gtk_backend = {
+    .abiVersion = NFD_BACKEND_ABI_VERSION,
+    .name = "gtk",
+    .IsAvailable = nullptr,
+    .GetError = NFD_GetError,
+    .ClearError = NFD_ClearError,
+    .Init = NFD_Init,
+    .InitWithConnection = nullptr,
+    .Quit = NFD_Quit,
+    .Prewarm = nullptr,
+    .SetTimeout = nullptr,
+    .GetPollDescriptors = nullptr,
+    .Dispatch = nullptr,
+    .FreePathN = NFD_FreePathN,
+    .OpenDialogN = NFD_OpenDialogN,
+    .OpenDialogWin = NFD_OpenDialogWin,
+    .OpenDialogMultipleWin = NFD_OpenDialogMultipleWin,
+    .SaveDialogWin = NFD_SaveDialogWin,
+    .PickFolderWin = NFD_PickFolderWin,
+    .HasAsyncOpCompleted = nullptr,
+    .GetAsyncOpResult = nullptr,
+    .FreeHandle = nullptr,
+    .GetLastTimings = nullptr,
+    .GetAsyncOpTimings = nullptr,
+    .GetStats = nullptr,
+    .ResetStats = nullptr,
+    .SetTraceFile = nullptr,
+    .OpenFileManager = nullptr,
+    .OpenDialogMultipleN = NFD_OpenDialogMultipleN,
+    .SaveDialogN = NFD_SaveDialogN,
+    .PickFolderN = NFD_PickFolderN,
+    .PathSet_GetCount = NFD_PathSet_GetCount,
+    .PathSet_GetPathN = NFD_PathSet_GetPathN,
+    .PathSet_FreePathN = NFD_PathSet_FreePathN,
+    .PathSet_Free = NFD_PathSet_Free,
+    .PathSet_GetEnum = NFD_PathSet_GetEnum,
+    .PathSet_FreeEnum = NFD_PathSet_FreeEnum,
+    .PathSet_EnumNextN = NFD_PathSet_EnumNextN,
+    .SetDirectoryPrefetch = NFD_SetDirectoryPrefetch,
+};
+
+}  // namespace
+
+const NfdBackend* NFDi_GetBackend(void) {
+    return &gtk_backend;
+}
+#endif
@@ -0,0 +1,159 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  nfd-gtk-helper: shows the dialogs of the helper client (nfd_helper_client.cpp) with the GTK
+  backend (nfd_gtk.cpp), in a process of its own; see nfd_helper.h.  It is started by the
+  client, never by hand.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nfd.h"
+#include "nfd_helper.h"
+#include "nfd_helper_server.h"
+
+namespace {
+
+/* what the errors that the helper sends call it */
+constexpr const char* PROGRAM = "nfd-gtk-helper";
+
+void SendPathSet(const nfdpathset_t* pathSet) {
+    nfdpathsetsize_t count = 0;
+    uint64_t size = 1;  // the empty string at the end
+    nfdpathsetenum_t enumerator;
+    NFD_PathSet_GetEnum(pathSet, &enumerator);
+    nfdnchar_t* path;
+    while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path) {
+        size += strlen(path) + 1;
+        ++count;
+        NFD_PathSet_FreePathN(path);
+    }
+    NFD_PathSet_FreeEnum(&enumerator);
+
+    NFDi_SendHelperPaths(NFD_HELPER_FD, PROGRAM, count, size, [pathSet](char* out) {
+        nfdpathsetenum_t enumerator;
+        NFD_PathSet_GetEnum(pathSet, &enumerator);
+        nfdnchar_t* path;
+        while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path) {
+            const size_t length = strlen(path) + 1;
+            memcpy(out, path, length);
+            out += length;
+            NFD_PathSet_FreePathN(path);
+        }
+        NFD_PathSet_FreeEnum(&enumerator);
+        *out = '\0';
+    });
+    NFD_PathSet_Free(pathSet);
+}
+
+void HandleRequest(const char* message, size_t messageSize) {
+    NfdHelperDialog dialog;
+    if (!NFDi_ReadHelperRequest(NFD_HELPER_FD, PROGRAM, message, messageSize, dialog)) return;
+    const NfdHelperRequest& request = dialog.request;
+    if (request.op == NFD_HELPER_PREWARM) {
+        gtk_init_check(nullptr, nullptr);
+        return;
+    }
+
+    NFD_SetDirectoryPrefetch(request.prefetchMaxEntries, request.prefetchBudgetMs);
+    nfdnchar_t* outPath = nullptr;
+    const nfdpathset_t* outPaths = nullptr;
+    NfdDialogParams params = {};
+    params.outPath = &outPath;
+    params.winFilter = dialog.winFilter;
+    params.filterIndex = request.filterIndex;
+    params.defaultName = dialog.defaultName;
+    params.defaultPath = dialog.defaultPath;
+    params.title = dialog.title;
+    params.defExt = dialog.defExt;
+    params.gtkFlags = request.gtkFlags;
+    nfdresult_t result;
+    switch (request.op) {
+        case NFD_HELPER_OPEN:
+            result = NFD_OpenDialogN(
+                &outPath, dialog.filters, request.filterCount, dialog.defaultPath);
+            break;
+        case NFD_HELPER_OPEN_MULTIPLE:
+            result = NFD_OpenDialogMultipleN(
+                &outPaths, dialog.filters, request.filterCount, dialog.defaultPath);
+            break;
+        case NFD_HELPER_SAVE:
+            result = NFD_SaveDialogN(&outPath,
+                                     dialog.filters,
+                                     request.filterCount,
+                                     dialog.defaultPath,
+                                     dialog.defaultName);
+            break;
+        case NFD_HELPER_PICK_FOLDER:
+            result = NFD_PickFolderN(&outPath, dialog.defaultPath);
+            break;
+        case NFD_HELPER_OPEN_WIN:
+            result = NFD_OpenDialogWin(&params);
+            break;
+        case NFD_HELPER_OPEN_MULTIPLE_WIN:
+            result = NFD_OpenDialogMultipleWin(&params);
+            break;
+        case NFD_HELPER_SAVE_WIN:
+            result = NFD_SaveDialogWin(&params);
+            break;
+        default:
+            result = NFD_PickFolderWin(&params);
+            break;
+    }
+    free(dialog.filters);
+
+    if (result != NFD_OKAY) {
+        NFDi_SendHelperResult(NFD_HELPER_FD, result);
+    } else if (outPaths) {
+        SendPathSet(outPaths);
+    } else {
+        const size_t size =
+            request.op >= NFD_HELPER_OPEN_WIN ? params.outPathSize : strlen(outPath) + 1;
+        NFDi_SendHelperPath(NFD_HELPER_FD, PROGRAM, outPath, size);
+        NFD_FreePathN(outPath);
+    }
+}
+
+// Ends the helper, closing its dialog, when the client has gone away.
+gboolean ClientGone(gint, GIOCondition, gpointer) {
+    _exit(0);
+}
+
+}  // namespace
+
+int main(int, char** argv) {
+    if (fcntl(NFD_HELPER_FD, F_GETFD) == -1) {
+        fprintf(stderr, "%s: this program is started by the nfd library\n", argv[0]);
+        return 2;
+    }
+    if (NFD_Init() != NFD_OKAY) return 1;
+
+    // watched while a dialog runs the main loop; between dialogs, recv() sees the end of the stream
+    g_unix_fd_add(
+        NFD_HELPER_FD, static_cast<GIOCondition>(G_IO_HUP | G_IO_ERR), ClientGone, nullptr);
+
+    char* message = static_cast<char*>(malloc(NFD_HELPER_MAX_MESSAGE));
+    for (;;) {
+        const ssize_t size = recv(NFD_HELPER_FD, message, NFD_HELPER_MAX_MESSAGE, MSG_TRUNC);
+        if (size == -1 && errno == EINTR) continue;
+        if (size <= 0) break;
+        if (size > NFD_HELPER_MAX_MESSAGE) {
+            NFDi_SendHelperError(NFD_HELPER_FD, PROGRAM, "received a request that is too long.");
+            continue;
+        }
+        HandleRequest(message, static_cast<size_t>(size));
+    }
+    free(message);
+    NFD_Quit();
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  The protocol between the helper client (nfd_helper_client.cpp) and the programs that show its
+  dialogs: nfd-gtk-helper (nfd_gtk_helper.cpp) and nfd-broker (nfd_broker.cpp).
+
+  With -DNFD_GTK_HELPER=ON, the GTK backend (the nfd library, or libnfd_gtk.so with
+  NFD_RUNTIME_BACKEND) is nfd_helper_client.cpp, which does not link with GTK.  The first dialog (or
+  NFD_Prewarm) starts nfd-gtk-helper, which is nfd_gtk.cpp compiled into a program of its own, with
+  one end of a SOCK_SEQPACKET socketpair as descriptor NFD_HELPER_FD, and the helper keeps running
+  until the last NFD_Quit, so that later dialogs find GTK initialized.  Each dialog is one request
+  and one response, each a single message:
+
+    request:  NfdHelperRequest, then its strings (see below)
+    response: NfdHelperResponse, then the error message if the result is NFD_ERROR; if it is
+              NFD_OKAY, the paths are in a sealed memfd that comes with the message (SCM_RIGHTS),
+              which the client maps and returns from, without copying them again
+
+  The helper exits when the socket is closed, even if it is showing a dialog.
+
+  With -DNFD_BROKER=ON, the client is compiled with NFD_BROKER_CLIENT instead (into libnfd_broker.so,
+  since the broker needs NFD_RUNTIME_BACKEND), and connects to nfd-broker, a per-user daemon that
+  keeps one connection to xdg-desktop-portal open and shows the dialogs of every client on it.  The
+  broker listens on a SOCK_SEQPACKET socket at NFDi_BrokerSocketPath() (and is started by the first
+  client that finds nobody listening there); each connection is one client, which sends the same
+  requests and gets the same responses as from nfd-gtk-helper, one dialog at a time.  The broker
+  shows the dialogs as async portal dialogs, so that the dialogs of all of its clients may be open
+  at once.  When a client disconnects, the response to its dialog is dropped.
+
+  The two programs share their end of the protocol, in nfd_helper_server.h.
+
+  Internal: not installed, and not part of the API.
+*/
+
+#ifndef _NFD_HELPER_H
+#define _NFD_HELPER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* bumped whenever the messages change; the helper answers requests of any other version with an
+ * error */
+#define NFD_HELPER_PROTOCOL_VERSION 1
+
+/* the helper's end of the socket (nfd-broker has one socket for each client instead) */
+#define NFD_HELPER_FD 3
+
+/* the largest message, in either direction */
+#define NFD_HELPER_MAX_MESSAGE (64 * 1024)
+
+typedef enum {
+    NFD_HELPER_PREWARM, /* initialize GTK without showing a dialog (nfd-broker ignores it); there
+                           is no response */
+    NFD_HELPER_OPEN,
+    NFD_HELPER_OPEN_MULTIPLE,
+    NFD_HELPER_SAVE,
+    NFD_HELPER_PICK_FOLDER,
+    NFD_HELPER_OPEN_WIN,
+    NFD_HELPER_OPEN_MULTIPLE_WIN,
+    NFD_HELPER_SAVE_WIN,
+    NFD_HELPER_PICK_FOLDER_WIN
+} NfdHelperOp;
+
+typedef struct {
+    uint32_t version; /* NFD_HELPER_PROTOCOL_VERSION */
+    uint32_t op;      /* NfdHelperOp */
+    /* NFD_SetDirectoryPrefetch of the client, applied before the dialog */
+    uint64_t prefetchMaxEntries;
+    int32_t prefetchBudgetMs;
+    /* the NfdDialogParams fields of the NFD_*Win ops */
+    uint32_t gtkFlags;
+    uint32_t filterIndex;
+    uint32_t winFilterSize; /* bytes of winFilter at the end of the strings; 0 if it is not set */
+    uint32_t filterCount;   /* name and spec pairs in the strings */
+    uint32_t reserved;
+} NfdHelperRequest;
+/* The strings that follow are, each null-terminated and empty if not set: title, defaultPath,
+ * defaultName, defExt, then the name and spec of each filter; then the `winFilterSize` bytes of
+ * winFilter, including its final terminator. */
+
+typedef struct {
+    uint32_t version; /* NFD_HELPER_PROTOCOL_VERSION */
+    uint32_t result;  /* nfdresult_t */
+    uint32_t count;   /* paths in the memfd */
+    uint32_t reserved;
+    uint64_t size; /* bytes of paths in the memfd, after NFD_HELPER_PATHS_OFFSET */
+} NfdHelperResponse;
+/* The paths start NFD_HELPER_PATHS_OFFSET bytes into the memfd; the bytes before them are left for
+ * the client.  For the NFD_*Win ops, they are the outPath of the NFD_*Win function (and `size` is
+ * its outPathSize); for the others, `count` null-terminated paths, then an empty string. */
+#define NFD_HELPER_PATHS_OFFSET 16
+
+/* Writes the path of nfd-broker's socket into `out`: $NFD_BROKER_SOCKET, or nfd-broker in
+ * $XDG_RUNTIME_DIR (which only its user may enter).  Returns 0 if neither is set, or the path does
+ * not fit. */
+static inline int NFDi_BrokerSocketPath(char* out, size_t size) {
+    const char* socket = getenv("NFD_BROKER_SOCKET");
+    const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+    int length;
+    if (socket && *socket)
+        length = snprintf(out, size, "%s", socket);
+    else if (runtimeDir && *runtimeDir)
+        length = snprintf(out, size, "%s/nfd-broker", runtimeDir);
+    else
+        return 0;
+    return length > 0 && (size_t)length < size;
+}
+
+#endif  // _NFD_HELPER_H
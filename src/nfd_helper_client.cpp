@@ -0,0 +1,812 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  The GTK backend without GTK (-DNFD_GTK_HELPER=ON): each dialog is shown by nfd-gtk-helper, which
+  this file starts on first use.  Compiled with NFD_BROKER_CLIENT (-DNFD_BROKER=ON), it is the
+  portal backend without D-Bus instead: each dialog is shown by nfd-broker.  See nfd_helper.h.
+*/
+
+/*
+nfd-gtk-helper is looked for at $NFD_GTK_HELPER, next to the nfd library (or the module, or the
+program that it is linked into), and in the directories compiled into NFD_HELPER_DIRS.  It is
+started by the first dialog, or by NFD_Prewarm(), and stopped by the last NFD_Quit().  If it exits
+in between (e.g. it crashed), the dialog that it was showing fails, and the next one starts it
+again.
+
+With NFD_BROKER_CLIENT, the first dialog (or NFD_Prewarm()) connects to the socket of nfd-broker
+instead.  If nobody listens there, it starts nfd-broker (which is looked for in the same places,
+with $NFD_BROKER instead of $NFD_GTK_HELPER), and waits until the broker listens.  The last
+NFD_Quit() only disconnects: the broker keeps its portal connection for the next process, and exits
+once it has had no clients for a while.  Every error of the helper above is one of the broker's.
+
+The paths that a dialog returns are in the memfd of the response, which is mapped privately;
+NFD_FreePathN() and NFD_PathSet_Free() unmap it.  Dialogs may be shown from any thread, one at a
+time: a dialog waits for the one that is shown to be closed, but the other functions do not (the
+lock is not held while the user picks), and NFD_Prewarm() returns at once.
+*/
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nfd.h"
+#include "nfd_helper.h"
+#ifdef NFD_BACKEND_MODULE
+#include "nfd_backend.h"
+#endif
+
+/* the program that shows the dialogs, the variable that overrides where it is, and what the errors
+ * call it */
+#ifdef NFD_BROKER_CLIENT
+#define HELPER_PROGRAM "nfd-broker"
+#define HELPER_ENV "NFD_BROKER"
+#define HELPER_NAME "dialog broker"
+#else
+#define HELPER_PROGRAM "nfd-gtk-helper"
+#define HELPER_ENV "NFD_GTK_HELPER"
+#define HELPER_NAME "GTK helper"
+#endif
+
+extern char** environ;
+
+namespace {
+
+/* current error of this thread */
+thread_local const char* g_errorstr = nullptr;
+/* room for an error that comes from the helper, or is formatted at run time */
+thread_local char g_errorbuf[1024];
+/* the most of a path that is quoted in g_errorbuf, which leaves room for the message around it
+ * (longer ones are cut short) */
+constexpr int g_pathQuoteMax = sizeof(g_errorbuf) - 256;
+
+void NFDi_SetError(const char* msg) {
+    g_errorstr = msg;
+}
+
+template <typename T = void>
+T* NFDi_Malloc(size_t bytes) {
+    void* ptr = malloc(bytes);
+    if (!ptr) NFDi_SetError("NFDi_Malloc failed.");
+
+    return static_cast<T*>(ptr);
+}
+
+template <typename T>
+void NFDi_Free(T* ptr) {
+    assert(ptr);
+    free(static_cast<void*>(ptr));
+}
+
+template <typename T>
+struct Free_Guard {
+    T* data;
+    Free_Guard(T* freeable) noexcept : data(freeable) {}
+    ~Free_Guard() { NFDi_Free(data); }
+};
+
+/* guards everything below */
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* NFD_Init() calls without a matching NFD_Quit() */
+size_t g_initCount = 0;
+/* our end of the socket, and the helper's process; -1 while the helper is not running (or, with
+ * NFD_BROKER_CLIENT, while we are not connected to the broker, whose process is not ours) */
+int g_socket = -1;
+#ifndef NFD_BROKER_CLIENT
+pid_t g_helperPid = -1;
+#endif
+/* whether a thread waits for the response to a dialog on g_socket, without the lock (another dialog
+ * waits for g_dialogDone; the last NFD_Quit() leaves it to that thread to stop the helper) */
+bool g_dialogShown = false;
+pthread_cond_t g_dialogDone = PTHREAD_COND_INITIALIZER;
+/* NFD_SetDirectoryPrefetch(), passed on with every dialog */
+size_t g_prefetchMaxEntries = 0;
+int g_prefetchBudgetMs = 0;
+
+struct Mutex_Guard {
+    Mutex_Guard() { pthread_mutex_lock(&g_mutex); }
+    ~Mutex_Guard() { pthread_mutex_unlock(&g_mutex); }
+};
+
+// Sets `path` to the helper program in `dir`, and returns whether it is there.
+bool HelperIn(const char* dir, size_t dirLength, char (&path)[PATH_MAX]) {
+    const int length = snprintf(
+        path, sizeof(path), "%.*s/" HELPER_PROGRAM, static_cast<int>(dirLength), dir);
+    return length > 0 && static_cast<size_t>(length) < sizeof(path) && access(path, X_OK) == 0;
+}
+
+// Finds the helper program (see the top of this file).  Otherwise, sets the error and returns
+// false.
+bool FindHelper(char (&path)[PATH_MAX]) {
+    if (const char* helper = getenv(HELPER_ENV); helper && *helper) {
+        snprintf(path, sizeof(path), "%s", helper);
+        if (access(path, X_OK) == 0) return true;
+        NFDi_SetError("$" HELPER_ENV " is not the path of the " HELPER_NAME
+                      " (" HELPER_PROGRAM ").");
+        return false;
+    }
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&NFD_Init), &info) && info.dli_fname) {
+        char self[PATH_MAX];
+        snprintf(self, sizeof(self), "%s", info.dli_fname);
+        const char* dir = dirname(self);
+        if (HelperIn(dir, strlen(dir), path)) return true;
+    }
+#ifdef NFD_HELPER_DIRS
+    // a ':'-separated list: the build tree, then the install location
+    for (const char* dirs = NFD_HELPER_DIRS; *dirs;) {
+        const char* end = strchr(dirs, ':');
+        if (!end) end = dirs + strlen(dirs);
+        if (end != dirs && HelperIn(dirs, end - dirs, path)) return true;
+        dirs = *end ? end + 1 : end;
+    }
+#endif
+    NFDi_SetError("The " HELPER_NAME " (" HELPER_PROGRAM ") was not found; set " HELPER_ENV
+                  " to its path.");
+    return false;
+}
+
+// Sets the error to "<what> <path>: <the reason for errno `err`>".
+void SetErrorWithReason(const char* what, const char* path, int err) {
+    snprintf(g_errorbuf,
+             sizeof(g_errorbuf),
+             "%s %.*s: %s",
+             what,
+             g_pathQuoteMax,
+             path,
+             strerror(err));
+    NFDi_SetError(g_errorbuf);
+}
+
+// posix_spawn() attributes that give the program an empty signal mask, not the one of the thread
+// that happens to show the first dialog.
+struct SpawnAttr_Guard {
+    posix_spawnattr_t attr;
+    SpawnAttr_Guard() {
+        posix_spawnattr_init(&attr);
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        posix_spawnattr_setsigmask(&attr, &noSignals);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    }
+    ~SpawnAttr_Guard() { posix_spawnattr_destroy(&attr); }
+};
+
+#ifdef NFD_BROKER_CLIENT
+// Connects to the broker at `addr`; returns the socket, or -1 with errno set.
+int ConnectBroker(const struct sockaddr_un& addr) {
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) == 0) {
+        // not a socket that someone else has put there, which would see every path that we pick
+        struct ucred cred;
+        socklen_t length = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 &&
+            cred.uid == geteuid()) {
+            return fd;
+        }
+        errno = EACCES;
+    }
+    const int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+// Starts nfd-broker, which exits once the broker that it forks listens on the socket (or if another
+// one already does).  Otherwise, sets the error and returns false.
+bool SpawnBroker() {
+    char path[PATH_MAX];
+    if (!FindHelper(path)) return false;
+    SpawnAttr_Guard attr;
+    char* argv[] = {const_cast<char*>("nfd-broker"), const_cast<char*>("--daemon"), nullptr};
+    pid_t pid;
+    const int err = posix_spawn(&pid, path, nullptr, &attr.attr, argv, environ);
+    if (err) {
+        SetErrorWithReason("Unable to start", path, err);
+        return false;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        snprintf(g_errorbuf,
+                 sizeof(g_errorbuf),
+                 "%.*s did not start; run it to see why.",
+                 g_pathQuoteMax,
+                 path);
+        NFDi_SetError(g_errorbuf);
+        return false;
+    }
+    return true;
+}
+
+// Connects to the broker, starting it first if nobody listens on its socket and `start` is set.
+// Otherwise, sets the error and returns false.
+bool StartHelper(bool start = true) {
+    if (g_socket != -1) return true;
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (!NFDi_BrokerSocketPath(addr.sun_path, sizeof(addr.sun_path))) {
+        NFDi_SetError("The dialog broker has no socket; set XDG_RUNTIME_DIR or NFD_BROKER_SOCKET.");
+        return false;
+    }
+    int fd = ConnectBroker(addr);
+    if (fd == -1 && start && (errno == ENOENT || errno == ECONNREFUSED)) {
+        if (!SpawnBroker()) return false;
+        // if another client started a broker at the same time, ours has left the socket to that
+        // one, which may not listen yet
+        for (int attempt = 0;; ++attempt) {
+            fd = ConnectBroker(addr);
+            if (fd != -1 || (errno != ENOENT && errno != ECONNREFUSED) || attempt == 100) break;
+            usleep(20 * 1000);
+        }
+    }
+    if (fd == -1) {
+        SetErrorWithReason("Unable to connect to the dialog broker at", addr.sun_path, errno);
+        return false;
+    }
+    g_socket = fd;
+    return true;
+}
+
+void StopHelper() {
+    // the broker drops the response to the dialog that it may be showing for us
+    close(g_socket);
+    g_socket = -1;
+}
+#else
+
+// Starts the helper, if it is not running.  Otherwise, sets the error and returns false.
+bool StartHelper() {
+    if (g_socket != -1) return true;
+    char path[PATH_MAX];
+    if (!FindHelper(path)) return false;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        NFDi_SetError("Unable to create the socket for the GTK helper.");
+        return false;
+    }
+    // dup2() onto NFD_HELPER_FD clears close-on-exec, unless the descriptor is already there
+    if (fds[1] == NFD_HELPER_FD) {
+        const int moved = fcntl(fds[1], F_DUPFD_CLOEXEC, NFD_HELPER_FD + 1);
+        close(fds[1]);
+        fds[1] = moved;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], NFD_HELPER_FD);
+    SpawnAttr_Guard attr;
+    char* argv[] = {const_cast<char*>("nfd-gtk-helper"), nullptr};
+    pid_t pid;
+    const int err =
+        fds[1] == -1 ? errno : posix_spawn(&pid, path, &actions, &attr.attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (fds[1] != -1) close(fds[1]);
+    if (err) {
+        close(fds[0]);
+        SetErrorWithReason("Unable to start", path, err);
+        return false;
+    }
+    g_socket = fds[0];
+    g_helperPid = pid;
+    return true;
+}
+
+void StopHelper() {
+    // the helper exits when its end of the socket is closed, even in the middle of a dialog
+    close(g_socket);
+    g_socket = -1;
+    while (waitpid(g_helperPid, nullptr, 0) == -1 && errno == EINTR) {
+    }
+    g_helperPid = -1;
+}
+#endif
+
+// What a request asks for; the NFD_*Win fields are null or zero for the other dialogs.
+struct RequestArgs {
+    NfdHelperOp op;
+    const char* title;
+    const char* defaultPath;
+    const char* defaultName;
+    const char* defExt;
+    const nfdnfilteritem_t* filterList;
+    nfdfiltersize_t filterCount;
+    const char* winFilter;
+    unsigned long filterIndex;
+    unsigned int gtkFlags;
+};
+
+size_t StringSize(const char* str) {
+    return (str ? strlen(str) : 0) + 1;
+}
+
+char* AppendString(char* out, const char* str) {
+    const size_t size = StringSize(str);
+    memcpy(out, str ? str : "", size);
+    return out + size;
+}
+
+// Builds the request message (see nfd_helper.h).  Otherwise, sets the error and returns null.
+// Called with the lock held.
+char* BuildRequest(const RequestArgs& args, size_t& outSize) {
+    // up to and including the empty string at the end of winFilter
+    size_t winFilterSize = 0;
+    if (args.winFilter && *args.winFilter) {
+        const char* ptr = args.winFilter;
+        while (*ptr) ptr += strlen(ptr) + 1;
+        winFilterSize = ptr + 1 - args.winFilter;
+    }
+
+    size_t size = sizeof(NfdHelperRequest) + StringSize(args.title) +
+                  StringSize(args.defaultPath) + StringSize(args.defaultName) +
+                  StringSize(args.defExt) + winFilterSize;
+    for (nfdfiltersize_t i = 0; i != args.filterCount; ++i) {
+        size += StringSize(args.filterList[i].name) + StringSize(args.filterList[i].spec);
+    }
+    if (size > NFD_HELPER_MAX_MESSAGE) {
+        NFDi_SetError("The filters and paths of the dialog are too long for the " HELPER_NAME ".");
+        return nullptr;
+    }
+
+    char* message = NFDi_Malloc<char>(size);
+    if (!message) return nullptr;
+    NfdHelperRequest request = {};
+    request.version = NFD_HELPER_PROTOCOL_VERSION;
+    request.op = args.op;
+    request.prefetchMaxEntries = g_prefetchMaxEntries;
+    request.prefetchBudgetMs = g_prefetchBudgetMs;
+    request.gtkFlags = args.gtkFlags;
+    request.filterIndex = static_cast<uint32_t>(args.filterIndex);
+    request.winFilterSize = static_cast<uint32_t>(winFilterSize);
+    request.filterCount = args.filterCount;
+    memcpy(message, &request, sizeof(request));
+
+    char* out = message + sizeof(request);
+    out = AppendString(out, args.title);
+    out = AppendString(out, args.defaultPath);
+    out = AppendString(out, args.defaultName);
+    out = AppendString(out, args.defExt);
+    for (nfdfiltersize_t i = 0; i != args.filterCount; ++i) {
+        out = AppendString(out, args.filterList[i].name);
+        out = AppendString(out, args.filterList[i].spec);
+    }
+    if (winFilterSize) memcpy(out, args.winFilter, winFilterSize);
+    assert(out + winFilterSize == message + size);
+    outSize = size;
+    return message;
+}
+
+// Sends the request and waits for the response; on NFD_OKAY, `outFd` is the memfd of the paths.
+// On NFD_ERROR, sets the error.
+nfdresult_t Exchange(const RequestArgs& args, NfdHelperResponse& response, int& outFd) {
+    Mutex_Guard lock;
+    // the helper is already running (and warm) if it shows a dialog
+    if (args.op == NFD_HELPER_PREWARM && g_dialogShown) return NFD_OKAY;
+    // the socket carries one dialog at a time
+    while (g_dialogShown) pthread_cond_wait(&g_dialogDone, &g_mutex);
+    size_t messageSize;
+    char* message = BuildRequest(args, messageSize);
+    if (!message) return NFD_ERROR;
+    Free_Guard<char> messageGuard(message);
+
+    // once more if the helper had exited since the last dialog
+    for (int attempt = 0;; ++attempt) {
+        if (!StartHelper()) return NFD_ERROR;
+        ssize_t sent;
+        do {
+            sent = send(g_socket, message, messageSize, MSG_NOSIGNAL);
+        } while (sent == -1 && errno == EINTR);
+        if (sent != -1) break;
+        StopHelper();
+        if (attempt == 1) {
+            NFDi_SetError("Unable to send the dialog to the " HELPER_NAME ".");
+            return NFD_ERROR;
+        }
+    }
+    if (args.op == NFD_HELPER_PREWARM) return NFD_OKAY;
+
+    // the user takes their time, during which the other functions must not wait for the lock
+    g_dialogShown = true;
+    const int socket = g_socket;
+    pthread_mutex_unlock(&g_mutex);
+    char text[sizeof(g_errorbuf)];
+    struct iovec iov[2] = {{&response, sizeof(response)}, {text, sizeof(text) - 1}};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t received;
+    while ((received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+    }
+    pthread_mutex_lock(&g_mutex);
+    g_dialogShown = false;
+    pthread_cond_signal(&g_dialogDone);
+    int fd = -1;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (received <= 0) {
+        StopHelper();
+        NFDi_SetError("The " HELPER_NAME " exited while it was showing the dialog.");
+        return NFD_ERROR;
+    }
+    // the last NFD_Quit() came while the dialog was shown
+    if (g_initCount == 0) StopHelper();
+    if (static_cast<size_t>(received) < sizeof(response) ||
+        response.version != NFD_HELPER_PROTOCOL_VERSION || response.result > NFD_TIMEOUT ||
+        (response.result == NFD_OKAY) != (fd != -1)) {
+        if (fd != -1) close(fd);
+        NFDi_SetError("The " HELPER_NAME " sent a malformed response.");
+        return NFD_ERROR;
+    }
+    if (response.result == NFD_ERROR) {
+        text[received - sizeof(response)] = '\0';
+        memcpy(g_errorbuf, text, sizeof(g_errorbuf));
+        NFDi_SetError(g_errorbuf);
+    }
+    outFd = fd;
+    return static_cast<nfdresult_t>(response.result);
+}
+
+// The start of every mapping of paths, in the bytes before NFD_HELPER_PATHS_OFFSET.
+struct PathMapping {
+    size_t mapSize;
+};
+
+// Maps the `size` bytes of paths in `fd`, and closes it; returns the paths, which end with a
+// terminator.  Otherwise, sets the error and returns null.
+char* MapPaths(int fd, uint64_t size) {
+    const size_t mapSize = NFD_HELPER_PATHS_OFFSET + size;
+    struct stat st;
+    // sealed, so that the helper cannot shrink it under the mapping
+    const bool valid = size != 0 && fstat(fd, &st) == 0 &&
+                       static_cast<uint64_t>(st.st_size) >= mapSize &&
+                       (fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK);
+    void* map =
+        valid ? mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        NFDi_SetError("Unable to map the paths from the " HELPER_NAME ".");
+        return nullptr;
+    }
+    static_cast<PathMapping*>(map)->mapSize = mapSize;
+    char* paths = static_cast<char*>(map) + NFD_HELPER_PATHS_OFFSET;
+    if (paths[size - 1] != '\0') {
+        munmap(map, mapSize);
+        NFDi_SetError("The " HELPER_NAME " sent a malformed response.");
+        return nullptr;
+    }
+    return paths;
+}
+
+void UnmapPaths(const char* paths) {
+    void* map = const_cast<char*>(paths) - NFD_HELPER_PATHS_OFFSET;
+    munmap(map, static_cast<PathMapping*>(map)->mapSize);
+}
+
+// A path set: the mapping of paths, and where each path starts in it.
+struct PathSet {
+    char* paths;
+    nfdpathsetsize_t count;
+
+    char** Index() { return reinterpret_cast<char**>(this + 1); }
+};
+
+// Shows a dialog in the helper.  On NFD_OKAY, returns the paths and their response.
+nfdresult_t ShowDialog(const RequestArgs& args, char*& outPaths, NfdHelperResponse& outResponse) {
+    int fd;
+    const nfdresult_t result = Exchange(args, outResponse, fd);
+    if (result != NFD_OKAY) return result;
+    outPaths = MapPaths(fd, outResponse.size);
+    return outPaths ? NFD_OKAY : NFD_ERROR;
+}
+
+nfdresult_t ShowDialogN(const RequestArgs& args, nfdnchar_t** outPath) {
+    char* paths;
+    NfdHelperResponse response;
+    const nfdresult_t result = ShowDialog(args, paths, response);
+    if (result == NFD_OKAY) *outPath = paths;
+    return result;
+}
+
+nfdresult_t ShowDialogWin(NfdDialogParams* params, NfdHelperOp op) {
+    if (params->outAsyncOpHandle) {
+        NFDi_SetError("Async dialogs are not supported by the " HELPER_NAME ".");
+        return NFD_ERROR;
+    }
+    RequestArgs args = {};
+    args.op = op;
+    args.title = params->title;
+    args.defaultPath = params->defaultPath;
+    args.defaultName = params->defaultName;
+    args.defExt = params->defExt;
+    args.winFilter = params->winFilter;
+    args.filterIndex = params->filterIndex;
+    args.gtkFlags = params->gtkFlags;
+    char* paths;
+    NfdHelperResponse response;
+    const nfdresult_t result = ShowDialog(args, paths, response);
+    if (result == NFD_OKAY) {
+        *params->outPath = paths;
+        params->outPathSize = response.size;
+    }
+    return result;
+}
+
+}  // namespace
+
+const char* NFD_GetError(void) {
+    return g_errorstr;
+}
+
+void NFD_ClearError(void) {
+    NFDi_SetError(nullptr);
+}
+
+/* public */
+
+nfdresult_t NFD_Init(void) {
+    // the helper is started by the first dialog
+    Mutex_Guard lock;
+    ++g_initCount;
+    return NFD_OKAY;
+}
+
+void NFD_Quit(void) {
+    Mutex_Guard lock;
+    // if a dialog is shown, the thread that shows it stops the helper once it is closed
+    if (g_initCount && --g_initCount == 0 && g_socket != -1 && !g_dialogShown) StopHelper();
+}
+
+nfdresult_t NFD_Prewarm(void) {
+    // start the helper, and have it initialize GTK while the program does something else (the
+    // broker, which is already warm, only needs us to connect)
+    RequestArgs args = {};
+    args.op = NFD_HELPER_PREWARM;
+    NfdHelperResponse response;
+    int fd;
+    return Exchange(args, response, fd);
+}
+
+void NFD_SetDirectoryPrefetch(size_t maxEntries, int budgetMs) {
+    Mutex_Guard lock;
+    g_prefetchMaxEntries = maxEntries;
+    g_prefetchBudgetMs = budgetMs;
+}
+
+void NFD_FreePathN(nfdnchar_t* filePath) {
+    assert(filePath);
+    UnmapPaths(filePath);
+}
+
+nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath) {
+    RequestArgs args = {};
+    args.op = NFD_HELPER_OPEN;
+    args.defaultPath = defaultPath;
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    return ShowDialogN(args, outPath);
+}
+
+nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnfilteritem_t* filterList,
+                                    nfdfiltersize_t filterCount,
+                                    const nfdnchar_t* defaultPath) {
+    RequestArgs args = {};
+    args.op = NFD_HELPER_OPEN_MULTIPLE;
+    args.defaultPath = defaultPath;
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    char* paths;
+    NfdHelperResponse response;
+    const nfdresult_t result = ShowDialog(args, paths, response);
+    if (result != NFD_OKAY) return result;
+
+    // the paths are `count` strings, and then the empty string at the end of the mapping
+    const char* end = paths + response.size - 1;
+    PathSet* pathSet = response.count <= response.size
+                           ? NFDi_Malloc<PathSet>(sizeof(PathSet) + response.count * sizeof(char*))
+                           : nullptr;
+    char* ptr = paths;
+    for (uint32_t i = 0; pathSet && i != response.count && ptr < end; ++i) {
+        pathSet->Index()[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+    if (!pathSet || ptr != end) {
+        if (pathSet) NFDi_Free(pathSet);
+        UnmapPaths(paths);
+        NFDi_SetError("The " HELPER_NAME " sent a malformed response.");
+        return NFD_ERROR;
+    }
+    pathSet->paths = paths;
+    pathSet->count = response.count;
+    *outPaths = pathSet;
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath,
+                            const nfdnchar_t* defaultName) {
+    RequestArgs args = {};
+    args.op = NFD_HELPER_SAVE;
+    args.defaultPath = defaultPath;
+    args.defaultName = defaultName;
+    args.filterList = filterList;
+    args.filterCount = filterCount;
+    return ShowDialogN(args, outPath);
+}
+
+nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
+    RequestArgs args = {};
+    args.op = NFD_HELPER_PICK_FOLDER;
+    args.defaultPath = defaultPath;
+    return ShowDialogN(args, outPath);
+}
+
+nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, NFD_HELPER_OPEN_WIN);
+}
+
+nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, NFD_HELPER_OPEN_MULTIPLE_WIN);
+}
+
+nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, NFD_HELPER_SAVE_WIN);
+}
+
+nfdresult_t NFD_PickFolderWin(NfdDialogParams* params) {
+    return ShowDialogWin(params, NFD_HELPER_PICK_FOLDER_WIN);
+}
+
+nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
+    assert(pathSet);
+    *count = static_cast<const PathSet*>(pathSet)->count;
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
+                                 nfdpathsetsize_t index,
+                                 nfdnchar_t** outPath) {
+    assert(pathSet);
+    PathSet* set = const_cast<PathSet*>(static_cast<const PathSet*>(pathSet));
+    if (index >= set->count) {
+        NFDi_SetError("Index out of range.");
+        return NFD_ERROR;
+    }
+    *outPath = set->Index()[index];
+    return NFD_OKAY;
+}
+
+void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
+    assert(filePath);
+    (void)filePath;  // prevent warning in release build
+    // no-op, because NFD_PathSet_Free unmaps the paths
+}
+
+void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
+    assert(pathSet);
+    PathSet* set = const_cast<PathSet*>(static_cast<const PathSet*>(pathSet));
+    UnmapPaths(set->paths);
+    NFDi_Free(set);
+}
+
+nfdresult_t NFD_PathSet_GetEnum(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator) {
+    assert(pathSet);
+    // the next path, in the mapping
+    outEnumerator->ptr = static_cast<const PathSet*>(pathSet)->paths;
+    return NFD_OKAY;
+}
+
+void NFD_PathSet_FreeEnum(nfdpathsetenum_t*) {
+    // Do nothing, because the enumeration is a pointer into the pathset
+}
+
+nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath) {
+    char* path = static_cast<char*>(enumerator->ptr);
+    if (*path) {
+        *outPath = path;
+        enumerator->ptr = path + strlen(path) + 1;
+    } else {
+        // the empty string at the end
+        *outPath = nullptr;
+    }
+    return NFD_OKAY;
+}
+
+#ifdef NFD_BACKEND_MODULE
+namespace {
+
+#ifdef NFD_BROKER_CLIENT
+// Whether a broker is running, without starting one; if so, we stay connected to it.
+int IsBrokerRunning(void) {
+    Mutex_Guard lock;
+    return StartHelper(false);
+}
+#endif
+
+// The same functions as the GTK module, and NFD_Prewarm, which starts the helper.  The broker
+// module has them too (it has none of the portal's extensions), and is available if a broker is
+// running.
+constexpr NfdBackend helper_backend = {
+    .abiVersion = NFD_BACKEND_ABI_VERSION,
+#ifdef NFD_BROKER_CLIENT
+    .name = "broker",
+    .IsAvailable = IsBrokerRunning,
+#else
+    .name = "gtk",
+    .IsAvailable = nullptr,
+#endif
+    .GetError = NFD_GetError,
+    .ClearError = NFD_ClearError,
+    .Init = NFD_Init,
+    .InitWithConnection = nullptr,
+    .Quit = NFD_Quit,
+    .Prewarm = NFD_Prewarm,
+    .SetTimeout = nullptr,
+    .GetPollDescriptors = nullptr,
+    .Dispatch = nullptr,
+    .FreePathN = NFD_FreePathN,
+    .OpenDialogN = NFD_OpenDialogN,
+    .OpenDialogWin = NFD_OpenDialogWin,
+    .OpenDialogMultipleWin = NFD_OpenDialogMultipleWin,
+    .SaveDialogWin = NFD_SaveDialogWin,
+    .PickFolderWin = NFD_PickFolderWin,
+    .HasAsyncOpCompleted = nullptr,
+    .GetAsyncOpResult = nullptr,
+    .FreeHandle = nullptr,
+    .GetLastTimings = nullptr,
+    .GetAsyncOpTimings = nullptr,
+    .GetStats = nullptr,
+    .ResetStats = nullptr,
+    .SetTraceFile = nullptr,
+    .OpenFileManager = nullptr,
+    .OpenDialogMultipleN = NFD_OpenDialogMultipleN,
+    .SaveDialogN = NFD_SaveDialogN,
+    .PickFolderN = NFD_PickFolderN,
+    .PathSet_GetCount = NFD_PathSet_GetCount,
+    .PathSet_GetPathN = NFD_PathSet_GetPathN,
+    .PathSet_FreePathN = NFD_PathSet_FreePathN,
+    .PathSet_Free = NFD_PathSet_Free,
+    .PathSet_GetEnum = NFD_PathSet_GetEnum,
+    .PathSet_FreeEnum = NFD_PathSet_FreeEnum,
+    .PathSet_EnumNextN = NFD_PathSet_EnumNextN,
+    .SetDirectoryPrefetch = NFD_SetDirectoryPrefetch,
+};
+
+}  // namespace
+
+const NfdBackend* NFDi_GetBackend(void) {
+    return &helper_backend;
+}
+#endif
@@ -0,0 +1,190 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  The programs' end of the helper protocol (see nfd_helper.h), which nfd-gtk-helper and nfd-broker
+  share: reading a request, and sending a response, with the paths in a sealed memfd.  Each program
+  names itself (`program`, e.g. "nfd-broker") at the start of the errors that it sends.
+
+  Internal: not installed, and not part of the API.
+*/
+
+#ifndef _NFD_HELPER_SERVER_H
+#define _NFD_HELPER_SERVER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "nfd.h"
+#include "nfd_helper.h"
+
+/* a request, as read by NFDi_ReadHelperRequest(); the strings point into the message (and are null
+ * if they are empty) */
+struct NfdHelperDialog {
+    NfdHelperRequest request;
+    const char* title;
+    const char* defaultPath;
+    const char* defaultName;
+    const char* defExt;
+    nfdnfilteritem_t* filters; /* request.filterCount of them, to be freed with free() */
+    const char* winFilter;
+};
+
+// Sends a response to `fd`, with the memfd `memfd` if it is not -1, and `error` if it is not null.
+// Never blocks: the client waits for the response, so its socket has room.
+inline void NFDi_SendHelperResponse(int fd,
+                                    nfdresult_t result,
+                                    uint32_t count,
+                                    uint64_t size,
+                                    int memfd,
+                                    const char* error) {
+    NfdHelperResponse response = {};
+    response.version = NFD_HELPER_PROTOCOL_VERSION;
+    response.result = result;
+    response.count = count;
+    response.size = size;
+
+    if (!error) error = "";
+    struct iovec iov[2] = {{&response, sizeof(response)},
+                           {const_cast<char*>(error), strnlen(error, 1024)}};
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (memfd != -1) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    }
+    while (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == -1 && errno == EINTR) {
+    }
+}
+
+// Sends the error "<program> <what>" to `fd`.
+inline void NFDi_SendHelperError(int fd, const char* program, const char* what) {
+    char error[256];
+    snprintf(error, sizeof(error), "%s %s", program, what);
+    NFDi_SendHelperResponse(fd, NFD_ERROR, 0, 0, -1, error);
+}
+
+// Sends the result of a dialog that did not return paths, with NFD_GetError() if it failed.
+inline void NFDi_SendHelperResult(int fd, nfdresult_t result) {
+    NFDi_SendHelperResponse(fd, result, 0, 0, -1, result == NFD_ERROR ? NFD_GetError() : nullptr);
+}
+
+// Creates a sealed memfd with `size` bytes at NFD_HELPER_PATHS_OFFSET, filled by `fill` (which is
+// given the mapping of those bytes), and sends it to `fd`.
+template <typename Fill>
+void NFDi_SendHelperPaths(int fd, const char* program, uint32_t count, uint64_t size, Fill fill) {
+    const int memfd = memfd_create("nfd-paths", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    const size_t mapSize = NFD_HELPER_PATHS_OFFSET + size;
+    void* map = MAP_FAILED;
+    if (memfd != -1 && ftruncate(memfd, mapSize) == 0) {
+        map = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (map == MAP_FAILED) {
+        if (memfd != -1) close(memfd);
+        NFDi_SendHelperError(fd, program, "could not create the memfd for the paths.");
+        return;
+    }
+    fill(static_cast<char*>(map) + NFD_HELPER_PATHS_OFFSET);
+    munmap(map, mapSize);
+    // the client maps it for as long as it holds the paths, so nothing may change it afterwards
+    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    NFDi_SendHelperResponse(fd, NFD_OKAY, count, size, memfd, nullptr);
+    close(memfd);
+}
+
+// Sends the `size` bytes of `path` (with its terminator, and for a list, the empty string after it).
+inline void NFDi_SendHelperPath(int fd, const char* program, const char* path, size_t size) {
+    NFDi_SendHelperPaths(fd, program, 1, size, [path, size](char* out) {
+        memcpy(out, path, size);
+    });
+}
+
+// Reads the next null-terminated string of the request into `out` (null if it is empty); returns
+// false if the request ends first.
+inline bool NFDi_ReadHelperString(const char*& ptr, const char* end, const char*& out) {
+    const char* terminator = static_cast<const char*>(memchr(ptr, '\0', end - ptr));
+    if (!terminator) return false;
+    out = *ptr ? ptr : nullptr;
+    ptr = terminator + 1;
+    return true;
+}
+
+// Reads the request in `message` into `dialog`.  Returns false if it cannot be served, after sending
+// the error to `fd`.  An NFD_HELPER_PREWARM request only has `dialog.request`.
+inline bool NFDi_ReadHelperRequest(int fd,
+                                   const char* program,
+                                   const char* message,
+                                   size_t messageSize,
+                                   NfdHelperDialog& dialog) {
+    dialog = {};
+    NfdHelperRequest& request = dialog.request;
+    if (messageSize < sizeof(request)) {
+        NFDi_SendHelperError(fd, program, "received a truncated request.");
+        return false;
+    }
+    memcpy(&request, message, sizeof(request));
+    if (request.version != NFD_HELPER_PROTOCOL_VERSION) {
+        NFDi_SendHelperError(
+            fd, program, "is not the version of the nfd library that it serves.");
+        return false;
+    }
+    if (request.op == NFD_HELPER_PREWARM) return true;
+    if (request.op > NFD_HELPER_PICK_FOLDER_WIN) {
+        NFDi_SendHelperError(fd, program, "received an unknown request.");
+        return false;
+    }
+
+    const char* ptr = message + sizeof(request);
+    const char* end = message + messageSize;
+    bool valid = NFDi_ReadHelperString(ptr, end, dialog.title) &&
+                 NFDi_ReadHelperString(ptr, end, dialog.defaultPath) &&
+                 NFDi_ReadHelperString(ptr, end, dialog.defaultName) &&
+                 NFDi_ReadHelperString(ptr, end, dialog.defExt) &&
+                 request.filterCount <= static_cast<size_t>(end - ptr) / 2;
+    if (valid && request.filterCount) {
+        dialog.filters = static_cast<nfdnfilteritem_t*>(
+            malloc(request.filterCount * sizeof(*dialog.filters)));
+        if (!dialog.filters) {
+            NFDi_SendHelperError(fd, program, "ran out of memory for the filters.");
+            return false;
+        }
+        for (uint32_t i = 0; valid && i != request.filterCount; ++i) {
+            nfdnfilteritem_t& filter = dialog.filters[i];
+            valid = NFDi_ReadHelperString(ptr, end, filter.name) &&
+                    NFDi_ReadHelperString(ptr, end, filter.spec);
+            // an empty name or spec is still a filter
+            if (valid && !filter.name) filter.name = "";
+            if (valid && !filter.spec) filter.spec = "";
+        }
+    }
+    // winFilter ends with an empty string, so that parsing it cannot run past the message
+    dialog.winFilter = request.winFilterSize ? ptr : nullptr;
+    if (valid && (static_cast<size_t>(end - ptr) != request.winFilterSize ||
+                  (dialog.winFilter && (request.winFilterSize < 2 || end[-1] || end[-2])))) {
+        valid = false;
+    }
+    if (!valid) {
+        free(dialog.filters);
+        dialog.filters = nullptr;
+        NFDi_SendHelperError(fd, program, "received a malformed request.");
+        return false;
+    }
+    return true;
+}
+
+#endif  // _NFD_HELPER_SERVER_H
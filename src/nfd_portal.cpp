@@ -10,12 +10,15 @@
 #include <assert.h>
 #include <dbus/dbus.h>
 #include <errno.h>
+#include <fcntl.h>  // for pipe2()
+#include <poll.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/random.h>  // for the random token string
-#include <unistd.h>      // for access()
+#include <time.h>        // for clock_gettime()
+#include <unistd.h>      // for access() and getpid()
 #include <libgen.h>
 #include <pthread.h>
 
@@ -25,6 +28,37 @@
 #include <utility>
 
 #include "nfd.h"
+#ifdef NFD_BACKEND_MODULE
+#include "nfd_backend.h"
+#endif
+
+/*
+Define NFD_ENABLE_USDT to compile in USDT (static tracepoint) probes for tools such as bpftrace,
+perf and SystemTap, e.g. `bpftrace -e 'usdt:./libnfd.so:nfd:dialog_start { printf("%s\n",
+str(arg0)); }'`.  All probes belong to the `nfd` provider:
+
+  dialog_start(const char* kind)                  kind is "open", "open_multiple", "save" or
+                                                  "pick_folder"
+  dialog_end(int result)                          the result of a dialog has been decoded
+  method_call(const char* member)                 before a blocking D-Bus method call
+  method_reply(const char* member, int ok)        after it returns
+  response(const char* path)                      a portal Response signal was received
+  uri_decode(const char* uri, size_t len)         a file URI is being decoded
+  pathset_create(void* pathSet, size_t count)     NFD_OpenDialogMultipleN returned a path set
+  pathset_free(void* pathSet)
+  async_create(void* handle)                      an async dialog handle was created
+  async_complete(void* handle, int result)        the result of the dialog arrived
+  async_free(void* handle)
+  error(const char* message)                      an error was set
+
+When NFD_ENABLE_USDT is not defined, the probes and their arguments are compiled out.
+*/
+#ifdef NFD_ENABLE_USDT
+#include <sys/sdt.h>
+#define NFD_PROBE(...) STAP_PROBEV(nfd, __VA_ARGS__)
+#else
+#define NFD_PROBE(...) ((void)0)
+#endif
 
 /*
 Define NFD_APPEND_EXTENSION if you want the file extension to be appended when missing. Linux
@@ -34,10 +68,43 @@ know that we appended an extension, so they will not check or whitelist the corr
 NFD_APPEND_EXTENSION is not recommended for portals.
 */
 
+#ifdef NFD_ALLOC_HOOKS
+/* Test builds define NFD_ALLOC_HOOKS and implement these to observe every allocation made through
+ * NFDi_Malloc, NFDi_Realloc and NFDi_Free (see test/test_allocations.cpp). */
+void NFDi_OnMalloc(size_t bytes);
+void NFDi_OnRealloc(void* ptr, size_t bytes);
+void NFDi_OnFree(void* ptr);
+#define NFD_ALLOC_HOOK(call) call
+#else
+#define NFD_ALLOC_HOOK(call) ((void)0)
+#endif
+
 namespace {
 
+#ifndef NFD_DISABLE_STATS
+/* library-wide statistics (see NFD_GetStats); every field is updated with relaxed atomics */
+NfdStats stats;
+
+void StatAdd(uint64_t NfdStats::*counter, uint64_t amount = 1) {
+    __atomic_fetch_add(&(stats.*counter), amount, __ATOMIC_RELAXED);
+}
+
+// Adds a dialog that took `ns` nanoseconds to the latency histogram.
+void StatRecordLatency(uint64_t ns) {
+    const uint64_t us = ns / 1000;
+    unsigned bucket = us ? 63 - __builtin_clzll(us) : 0;
+    if (bucket >= NFD_STATS_LATENCY_BUCKETS) bucket = NFD_STATS_LATENCY_BUCKETS - 1;
+    __atomic_fetch_add(&stats.latencyHistogram[bucket], 1, __ATOMIC_RELAXED);
+}
+#else
+void StatAdd(uint64_t NfdStats::*, uint64_t = 1) {}
+void StatRecordLatency(uint64_t) {}
+#endif
+
 template <typename T = void>
 T* NFDi_Malloc(size_t bytes) {
+    StatAdd(&NfdStats::allocations);
+    NFD_ALLOC_HOOK(NFDi_OnMalloc(bytes));
     void* ptr = malloc(bytes);
     assert(ptr);  // Linux malloc never fails
 
@@ -46,6 +113,8 @@ T* NFDi_Malloc(size_t bytes) {
 
 template <typename T = void>
 T* NFDi_Realloc(T* ptr, size_t bytes) {
+    StatAdd(&NfdStats::allocations);
+    NFD_ALLOC_HOOK(NFDi_OnRealloc(ptr, bytes));
     void* newPtr = realloc(ptr, bytes);
     assert(newPtr);  // Linux malloc never fails
 
@@ -54,6 +123,7 @@ T* NFDi_Realloc(T* ptr, size_t bytes) {
 
 template <typename T>
 void NFDi_Free(T* ptr) {
+    NFD_ALLOC_HOOK(NFDi_OnFree(static_cast<void*>(ptr)));
     free(static_cast<void*>(ptr));
 }
 
@@ -98,21 +168,222 @@ struct DBusMessage_Guard {
     ~DBusMessage_Guard() { dbus_message_unref(data); }
 };
 
+struct Mutex_Guard {
+    pthread_mutex_t* data;
+    Mutex_Guard(pthread_mutex_t* mutex) noexcept : data(mutex) { pthread_mutex_lock(data); }
+    ~Mutex_Guard() { pthread_mutex_unlock(data); }
+};
+
 
-/* D-Bus connection handle */
+/* serializes NFD_Init() and NFD_Quit(), which are the only writers of the variables below; dialogs
+ * may read `dbus_conn` and `dbus_unique_name` from any thread in between, and libdbus locks the
+ * connection itself once dbus_threads_init_default() has been called */
+pthread_mutex_t conn_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* number of NFD_Init() calls without a matching NFD_Quit(), plus one while NFD_Prewarm() runs */
+size_t init_count = 0;
+/* D-Bus connection handle, shared by the whole process.  It stays open after the last NFD_Quit(),
+ * so that an NFD_Init() after it does not need a new connection and Hello handshake. */
 DBusConnection* dbus_conn;
-/* current D-Bus error */
-DBusError dbus_err;
-/* current error (may be a pointer to the D-Bus error message above, or a pointer to some string
- * literal) */
-const char* err_ptr = nullptr;
+/* the process that opened `dbus_conn`; a forked child must open its own */
+pid_t dbus_conn_pid;
 /* the unique name of our connection, used for the Request handle; owned by D-Bus so we don't free
  * it */
 const char* dbus_unique_name;
 
+/* The error state is per thread, so that dialogs on different threads do not overwrite each
+ * other's errors. */
+
+/* current D-Bus error of this thread, freed when the thread exits */
+struct ThreadDBusError {
+    DBusError err;
+    ThreadDBusError() noexcept { dbus_error_init(&err); }
+    ~ThreadDBusError() { dbus_error_free(&err); }
+};
+thread_local ThreadDBusError dbus_err;
+/* current error of this thread (may be a pointer to the D-Bus error message above, or a pointer to
+ * some string literal) */
+thread_local const char* err_ptr = nullptr;
+/* phase timings of the most recent dialog on this thread (see NFD_GetLastTimings) */
+thread_local NfdDialogTimings last_timings;
+
+
+// What went wrong, for the error counters in NfdStats.
+enum class ErrorKind {
+    Other,     // invalid arguments, failed system calls
+    DBus,      // a D-Bus call failed or the connection was lost
+    Response,  // the portal sent a reply or response that we could not use
+    Timeout,   // the portal or the user did not answer within the timeout (see NFD_SetTimeout)
+};
 
-void NFDi_SetError(const char* msg) {
+void NFDi_SetError(const char* msg, ErrorKind kind = ErrorKind::Other) {
     err_ptr = msg;
+    if (!msg) return;
+    NFD_PROBE(error, msg);
+    switch (kind) {
+        case ErrorKind::Other:
+            StatAdd(&NfdStats::otherErrors);
+            break;
+        case ErrorKind::DBus:
+            StatAdd(&NfdStats::dbusErrors);
+            break;
+        case ErrorKind::Response:
+            StatAdd(&NfdStats::responseErrors);
+            break;
+        case ErrorKind::Timeout:
+            StatAdd(&NfdStats::timeouts);
+            break;
+    }
+}
+
+// Takes over the D-Bus error `err` as the error of this thread.
+void NFDi_SetDBusError(DBusError& err) {
+    dbus_error_free(&dbus_err.err);
+    dbus_move_error(&err, &dbus_err.err);
+    NFDi_SetError(dbus_err.err.message, ErrorKind::DBus);
+}
+
+uint64_t TimestampNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/* the timeout of dialogs and file manager calls that do not set their own, in milliseconds, or 0
+ * for none (see NFD_SetTimeout); accessed atomically */
+int default_timeout_ms = 0;
+
+// Returns the deadline (on the TimestampNs() clock) of an operation that may take `timeoutMs`
+// milliseconds, where 0 stands for `default_timeout_ms` and a negative timeout for none.  Returns 0
+// if there is no deadline.
+uint64_t DeadlineAfter(int timeoutMs) {
+    if (timeoutMs == 0) timeoutMs = __atomic_load_n(&default_timeout_ms, __ATOMIC_RELAXED);
+    if (timeoutMs <= 0) return 0;
+    return TimestampNs() + static_cast<uint64_t>(timeoutMs) * 1000000u;
+}
+
+// Returns the timeout to give libdbus for a method call that must be answered by `deadline`.
+int DBusTimeoutUntil(uint64_t deadline) {
+    if (!deadline) return DBUS_TIMEOUT_INFINITE;
+    const uint64_t now = TimestampNs();
+    if (now >= deadline) return 1;  // 0 would not time out at all
+    const uint64_t ms = (deadline - now + 999999u) / 1000000u;
+    return ms < static_cast<uint64_t>(DBUS_TIMEOUT_INFINITE) ? static_cast<int>(ms)
+                                                              : DBUS_TIMEOUT_INFINITE;
+}
+
+// Reports the failure `err` of a method call that had to be answered by `deadline`: NFD_TIMEOUT if
+// the call timed out, NFD_ERROR otherwise.
+nfdresult_t MethodCallFailed(DBusError& err, uint64_t deadline) {
+    if (deadline && dbus_error_has_name(&err, DBUS_ERROR_NO_REPLY)) {
+        dbus_error_free(&err);
+        NFDi_SetError("D-Bus call timed out.", ErrorKind::Timeout);
+        return NFD_TIMEOUT;
+    }
+    NFDi_SetDBusError(err);
+    return NFD_ERROR;
+}
+
+// Starts recording the phases of a new dialog in `last_timings`.
+void BeginTimings() {
+    last_timings = {};
+    last_timings.start = TimestampNs();
+}
+
+// Records that the result of a synchronous dialog has been decoded and handed back to the caller,
+// and passes `res` through.
+nfdresult_t EndTimings(nfdresult_t res) {
+    last_timings.resultDecoded = TimestampNs();
+    last_timings.resultDelivered = last_timings.resultDecoded;
+    NFD_PROBE(dialog_end, static_cast<int>(res));
+    if (res == NFD_OKAY) StatRecordLatency(last_timings.resultDelivered - last_timings.start);
+    return res;
+}
+
+/*
+Trace capture (see NFD_SetTraceFile).  The trace file holds every OpenFile/SaveFile query that we
+send and every Response signal that we receive, as marshalled D-Bus messages:
+
+  file   := "NFDTRACE" version:u32 record*
+  record := kind:u8 time_ns:u64 size:u32 message:byte[size]
+
+kind is 'Q' for a query and 'R' for a Response signal, time_ns is on the CLOCK_MONOTONIC clock,
+and all integers are little-endian.  Use dbus_message_demarshal() to read the messages back.
+*/
+constexpr const char TRACE_MAGIC[8] = {'N', 'F', 'D', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr const char TRACE_ENV_VAR[] = "NFD_TRACE_FILE";
+
+enum class TraceKind : unsigned char { Query = 'Q', Response = 'R' };
+
+/* the open trace file, or null if we are not capturing */
+FILE* trace_file = nullptr;
+/* serializes writes to `trace_file`, which also happen from the dispatcher thread */
+pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* whether NFD_Init() has looked at the NFD_TRACE_FILE environment variable; guarded by
+ * `conn_mutex` */
+bool trace_env_checked = false;
+
+unsigned char* PutLittleEndian(unsigned char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i != bytes; ++i) *out++ = static_cast<unsigned char>(value >> (8 * i));
+    return out;
+}
+
+// Closes the current trace file (if any) and starts capturing to `path` (if not null).
+nfdresult_t OpenTraceFile(const char* path) {
+    FILE* file = nullptr;
+    if (path) {
+        file = fopen(path, "wb");
+        if (!file) {
+            NFDi_SetError("Unable to open the trace file.");
+            return NFD_ERROR;
+        }
+        unsigned char version[4];
+        PutLittleEndian(version, TRACE_VERSION, sizeof(version));
+        fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+        fwrite(version, 1, sizeof(version), file);
+        fflush(file);
+    }
+    pthread_mutex_lock(&trace_mutex);
+    FILE* old_file = trace_file;
+    __atomic_store_n(&trace_file, file, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_mutex);
+    if (old_file) fclose(old_file);
+    return NFD_OKAY;
+}
+
+// Appends `msg` to the trace file if we are capturing.  `msg` must have been sent or received
+// already, because marshalling locks the message.
+void TraceMessage(TraceKind kind, DBusMessage* msg) {
+    if (!__atomic_load_n(&trace_file, __ATOMIC_RELAXED)) return;
+    char* data;
+    int size;
+    if (!dbus_message_marshal(msg, &data, &size)) return;
+    unsigned char header[13];
+    unsigned char* header_ptr = header;
+    *header_ptr++ = static_cast<unsigned char>(kind);
+    header_ptr = PutLittleEndian(header_ptr, TimestampNs(), 8);
+    PutLittleEndian(header_ptr, static_cast<uint32_t>(size), 4);
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) {
+        fwrite(header, 1, sizeof(header), trace_file);
+        fwrite(data, 1, size, trace_file);
+        fflush(trace_file);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+    dbus_free(data);
+}
+
+// Appends `query`, which is about to be sent, to the trace file if we are capturing.  Tracing it
+// before it is sent keeps it ahead of its Response, which the dispatcher thread may receive before
+// the call returns.  Marshalling locks a message, so a copy is traced instead, with serial 1 in
+// place of the one that the connection has yet to give it.
+void TraceQuery(DBusMessage* query) {
+    if (!__atomic_load_n(&trace_file, __ATOMIC_RELAXED)) return;
+    DBusMessage* copy = dbus_message_copy(query);
+    if (!copy) return;
+    DBusMessage_Guard copy_guard(copy);
+    dbus_message_set_serial(copy, 1);
+    TraceMessage(TraceKind::Query, copy);
 }
 
 template <typename T>
@@ -366,7 +637,6 @@ void AppendSingleFilter(DBusMessageIter& base_iter, const char* name, const char
 //            buf_end = copy(pattern_begin, pattern_end, buf_end);
             buf_end = genCaseSensitivePattern(pattern_begin, pattern_end, buf_end);
             *buf_end = '\0';
-            fprintf(stderr, "appending filter %s\n", buf);
             dbus_message_iter_append_basic(&filter_sublist_struct_iter, DBUS_TYPE_STRING, &buf);
             dbus_message_iter_close_container(&filter_sublist_iter, &filter_sublist_struct_iter);
             if (*pattern_end == '\0') {
@@ -654,7 +924,7 @@ void AppendSaveFileQueryDictEntryCurrentName(DBusMessageIter& sub_iter, const ch
     dbus_message_iter_close_container(&sub_iter, &sub_sub_iter);
 }
 
-void AppendSaveFileQueryDictEntryCurrentFolder(DBusMessageIter& sub_iter, const char* path) {
+void AppendFileQueryDictEntryCurrentFolder(DBusMessageIter& sub_iter, const char* path) {
     if (!path) return;
     DBusMessageIter sub_sub_iter;
     DBusMessageIter variant_iter;
@@ -717,11 +987,13 @@ void AppendSaveFileQueryDictEntryCurrentFile(DBusMessageIter& sub_iter,
 }
 
 // Append OpenFile() portal params to the given query.
+// `currentFolder` may only be given to a portal with FileChooser version 4 or later.
 template <bool Multiple, bool Directory>
 void AppendOpenFileQueryParams(DBusMessage* query,
                                const char* handle_token,
                                const nfdnfilteritem_t* filterList,
-                               nfdfiltersize_t filterCount) {
+                               nfdfiltersize_t filterCount,
+                               const char* currentFolder = nullptr) {
     DBusMessageIter iter;
     dbus_message_iter_init_append(query, &iter);
 
@@ -735,6 +1007,7 @@ void AppendOpenFileQueryParams(DBusMessage* query,
     AppendOpenFileQueryDictEntryMultiple<Multiple>(sub_iter);
     AppendOpenFileQueryDictEntryDirectory<Directory>(sub_iter);
     AppendOpenFileQueryDictEntryFilters<!Directory>(sub_iter, filterList, filterCount);
+    AppendFileQueryDictEntryCurrentFolder(sub_iter, currentFolder);
     dbus_message_iter_close_container(&iter, &sub_iter);
 }
 
@@ -749,11 +1022,13 @@ void AppendFileQueryParentWindow(DBusMessageIter& iter,
         dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &STR_EMPTY);
 }
 
-// Append OpenFile() portal params to the given query.
+// Append OpenFile() portal params to the given query.  `currentFolder` may only be given to a
+// portal with FileChooser version 4 or later.
 template <bool Multiple, bool Directory>
 void AppendOpenFileQueryParams(DBusMessage* query,
                                const char* handle_token,
-                               NfdDialogParams* params)
+                               NfdDialogParams* params,
+                               const char* currentFolder = nullptr)
 {
     DBusMessageIter iter;
     dbus_message_iter_init_append(query, &iter);
@@ -771,6 +1046,7 @@ void AppendOpenFileQueryParams(DBusMessage* query,
         AppendOpenFileQueryDictEntryDirectory<true>(sub_iter);
     else
         AppendFileQueryDictEntryFilters(sub_iter, params->winFilter, params->filterIndex);
+    AppendFileQueryDictEntryCurrentFolder(sub_iter, currentFolder);
     dbus_message_iter_close_container(&iter, &sub_iter);
 }
 
@@ -783,14 +1059,14 @@ void AppendSaveFileQueryParams(DBusMessage* query,
 
     AppendFileQueryParentWindow(iter, params->parentWindow);
 
-    AppendSaveFileQueryTitle(iter);
+    AppendSaveFileQueryTitle(iter, params->title ? params->title : STR_SAVE_FILE);
 
     DBusMessageIter sub_iter;
     dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &sub_iter);
     AppendOpenFileQueryDictEntryHandleToken(sub_iter, handle_token);
     AppendFileQueryDictEntryFilters(sub_iter, params->winFilter, params->filterIndex);
     AppendSaveFileQueryDictEntryCurrentName(sub_iter, params->defaultName);
-    AppendSaveFileQueryDictEntryCurrentFolder(sub_iter, params->defaultPath);
+    AppendFileQueryDictEntryCurrentFolder(sub_iter, params->defaultPath);
     AppendSaveFileQueryDictEntryCurrentFile(sub_iter, params->defaultPath, params->defaultName);
     dbus_message_iter_close_container(&iter, &sub_iter);
 }
@@ -814,7 +1090,7 @@ void AppendSaveFileQueryParams(DBusMessage* query,
     AppendOpenFileQueryDictEntryHandleToken(sub_iter, handle_token);
     AppendSaveFileQueryDictEntryFilters(sub_iter, filterList, filterCount, defaultName);
     AppendSaveFileQueryDictEntryCurrentName(sub_iter, defaultName);
-    AppendSaveFileQueryDictEntryCurrentFolder(sub_iter, defaultPath);
+    AppendFileQueryDictEntryCurrentFolder(sub_iter, defaultPath);
     AppendSaveFileQueryDictEntryCurrentFile(sub_iter, defaultPath, defaultName);
     dbus_message_iter_close_container(&iter, &sub_iter);
 }
@@ -843,7 +1119,7 @@ nfdresult_t ReadDictImpl(const char* key,
 template <typename... Args>
 nfdresult_t ReadDict(DBusMessageIter iter, Args... args) {
     if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
-        NFDi_SetError("D-Bus response signal argument is not an array.");
+        NFDi_SetError("D-Bus response signal argument is not an array.", ErrorKind::Response);
         return NFD_ERROR;
     }
     DBusMessageIter sub_iter;
@@ -852,18 +1128,21 @@ nfdresult_t ReadDict(DBusMessageIter iter, Args... args) {
         DBusMessageIter de_iter;
         dbus_message_iter_recurse(&sub_iter, &de_iter);
         if (dbus_message_iter_get_arg_type(&de_iter) != DBUS_TYPE_STRING) {
-            NFDi_SetError("D-Bus response signal dict entry does not start with a string.");
+            NFDi_SetError("D-Bus response signal dict entry does not start with a string.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
         const char* key;
         dbus_message_iter_get_basic(&de_iter, &key);
         if (!dbus_message_iter_next(&de_iter)) {
-            NFDi_SetError("D-Bus response signal dict entry is missing one or more arguments.");
+            NFDi_SetError("D-Bus response signal dict entry is missing one or more arguments.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
         // unwrap the variant
         if (dbus_message_iter_get_arg_type(&de_iter) != DBUS_TYPE_VARIANT) {
-            NFDi_SetError("D-Bus response signal dict entry value is not a variant.");
+            NFDi_SetError("D-Bus response signal dict entry value is not a variant.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
         DBusMessageIter de_variant_iter;
@@ -883,11 +1162,12 @@ nfdresult_t ReadDict(DBusMessageIter iter, Args... args) {
 nfdresult_t ReadResponseResults(DBusMessage* msg, DBusMessageIter& resultsIter) {
     DBusMessageIter iter;
     if (!dbus_message_iter_init(msg, &iter)) {
-        NFDi_SetError("D-Bus response signal is missing one or more arguments.");
+        NFDi_SetError("D-Bus response signal is missing one or more arguments.",
+                      ErrorKind::Response);
         return NFD_ERROR;
     }
     if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_UINT32) {
-        NFDi_SetError("D-Bus response signal argument is not a uint32.");
+        NFDi_SetError("D-Bus response signal argument is not a uint32.", ErrorKind::Response);
         return NFD_ERROR;
     }
     dbus_uint32_t resp_code;
@@ -895,16 +1175,18 @@ nfdresult_t ReadResponseResults(DBusMessage* msg, DBusMessageIter& resultsIter)
     if (resp_code != 0) {
         if (resp_code == 1) {
             // User pressed cancel
+            StatAdd(&NfdStats::cancels);
             return NFD_CANCEL;
         } else {
             // Some error occurred
-            NFDi_SetError("D-Bus file dialog interaction was ended abruptly.");
+            NFDi_SetError("D-Bus file dialog interaction was ended abruptly.", ErrorKind::Response);
             return NFD_ERROR;
         }
     }
     // User successfully responded
     if (!dbus_message_iter_next(&iter)) {
-        NFDi_SetError("D-Bus response signal is missing one or more arguments.");
+        NFDi_SetError("D-Bus response signal is missing one or more arguments.",
+                      ErrorKind::Response);
         return NFD_ERROR;
     }
     resultsIter = iter;
@@ -921,7 +1203,7 @@ nfdresult_t ReadResponseUris(DBusMessage* msg, DBusMessageIter& uriIter) {
     bool has_uris = false;
     if (ReadDict(iter, "uris", [&uriIter, &has_uris](DBusMessageIter& uris_iter) {
       if (dbus_message_iter_get_arg_type(&uris_iter) != DBUS_TYPE_ARRAY) {
-          NFDi_SetError("D-Bus response signal URI iter is not an array.");
+          NFDi_SetError("D-Bus response signal URI iter is not an array.", ErrorKind::Response);
           return NFD_ERROR;
       }
       dbus_message_iter_recurse(&uris_iter, &uriIter);
@@ -931,7 +1213,7 @@ nfdresult_t ReadResponseUris(DBusMessage* msg, DBusMessageIter& uriIter) {
         return NFD_ERROR;
 
     if (!has_uris) {
-        NFDi_SetError("D-Bus response signal has no URI field.");
+        NFDi_SetError("D-Bus response signal has no URI field.", ErrorKind::Response);
         return NFD_ERROR;
     }
     return NFD_OKAY;
@@ -969,7 +1251,7 @@ nfdresult_t ReadResponseUrisSingle(DBusMessage* msg, const char*& file) {
     const nfdresult_t res = ReadResponseUris(msg, uri_iter);
     if (res != NFD_OKAY) return res;  // can be NFD_CANCEL or NFD_ERROR
     if (dbus_message_iter_get_arg_type(&uri_iter) != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+        NFDi_SetError("D-Bus response signal URI sub iter is not a string.", ErrorKind::Response);
         return NFD_ERROR;
     }
     dbus_message_iter_get_basic(&uri_iter, &file);
@@ -996,13 +1278,15 @@ nfdresult_t ReadResponseUrisSingleAndCurrentExtension(DBusMessage* msg,
             "uris",
             [&tmp_file](DBusMessageIter& uris_iter) {
                 if (dbus_message_iter_get_arg_type(&uris_iter) != DBUS_TYPE_ARRAY) {
-                    NFDi_SetError("D-Bus response signal URI iter is not an array.");
+                    NFDi_SetError("D-Bus response signal URI iter is not an array.",
+                                  ErrorKind::Response);
                     return NFD_ERROR;
                 }
                 DBusMessageIter uri_iter;
                 dbus_message_iter_recurse(&uris_iter, &uri_iter);
                 if (dbus_message_iter_get_arg_type(&uri_iter) != DBUS_TYPE_STRING) {
-                    NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+                    NFDi_SetError("D-Bus response signal URI sub iter is not a string.",
+                                  ErrorKind::Response);
                     return NFD_ERROR;
                 }
                 dbus_message_iter_get_basic(&uri_iter, &tmp_file);
@@ -1061,7 +1345,7 @@ nfdresult_t ReadResponseUrisSingleAndCurrentExtension(DBusMessage* msg,
         return NFD_ERROR;
 
     if (!tmp_file) {
-        NFDi_SetError("D-Bus response signal has no URI field.");
+        NFDi_SetError("D-Bus response signal has no URI field.", ErrorKind::Response);
         return NFD_ERROR;
     }
     file = tmp_file;
@@ -1119,76 +1403,804 @@ char* MakeUniqueObjectPath(const char** handle_token_ptr) {
     return path;
 }
 
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_1[] =
-    "type='signal',sender='org.freedesktop.portal.Desktop',path='";
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN =
-    sizeof(STR_RESPONSE_SUBSCRIPTION_PATH_1) - 1;
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_2[] =
-    "',interface='org.freedesktop.portal.Request',member='Response',destination='";
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN =
-    sizeof(STR_RESPONSE_SUBSCRIPTION_PATH_2) - 1;
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_3[] = "'";
-constexpr const char STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN =
-    sizeof(STR_RESPONSE_SUBSCRIPTION_PATH_3) - 1;
+constexpr const char STR_PORTAL_BUS_NAME[] = "org.freedesktop.portal.Desktop";
 
-class DBusSignalSubscriptionHandler {
-   private:
-    char* sub_cmd;
+constexpr size_t MATCH_RULE_MAX = 768;
+
+// Writes the match rule for the Response signals of all our requests, whose object paths start with
+// "/org/freedesktop/portal/desktop/request/SENDER" (see MakeUniqueObjectPath).
+nfdresult_t FormatResponseMatchRule(char (&rule)[MATCH_RULE_MAX], const char* unique_name) {
+    const char* sender = unique_name;
+    if (*sender == ':') ++sender;
+    char sender_segment[256];  // bus names are at most 255 characters long
+    const size_t sender_len = strlen(sender);
+    if (sender_len >= sizeof(sender_segment)) {
+        NFDi_SetError("The unique name of our D-Bus connection is too long.");
+        return NFD_ERROR;
+    }
+    *transform(sender, sender + sender_len, sender_segment, [](char ch) {
+        return ch != '.' ? ch : '_';
+    }) = '\0';
+    snprintf(rule,
+             sizeof(rule),
+             "type='signal',sender='%s',interface='org.freedesktop.portal.Request',"
+             "member='Response',destination='%s',path_namespace='%s%s'",
+             STR_PORTAL_BUS_NAME,
+             unique_name,
+             STR_RESPONSE_HANDLE_PREFIX,
+             sender_segment);
+    return NFD_OKAY;
+}
 
-   public:
-    DBusSignalSubscriptionHandler() : sub_cmd(nullptr) {}
-    ~DBusSignalSubscriptionHandler() {
-        if (sub_cmd) Unsubscribe();
+// Adds the match rule of FormatResponseMatchRule().  One rule per connection, instead of one per
+// dialog, saves an AddMatch and a RemoveMatch round trip per dialog.
+nfdresult_t AddResponseMatchRule(DBusConnection* conn, const char* unique_name) {
+    char rule[MATCH_RULE_MAX];
+    if (nfdresult_t res = FormatResponseMatchRule(rule, unique_name); res != NFD_OKAY) return res;
+    DBusError err;
+    dbus_error_init(&err);
+    dbus_bus_add_match(conn, rule, &err);
+    if (dbus_error_is_set(&err)) {
+        NFDi_SetDBusError(err);
+        return NFD_ERROR;
     }
+    return NFD_OKAY;
+}
+
+/* whether `dbus_conn` is open and has the Response match rule, so that dialogs can use it; set with
+ * release semantics under `conn_mutex`, so that readers may check it without the lock */
+bool conn_ready = false;
+/* whether NFD_Prewarm() has been called for the current connection; guarded by `conn_mutex` */
+bool prewarm_started = false;
+/* whether `dbus_conn` belongs to the application (see NFD_InitWithConnection), which dispatches
+ * it; only changes while there is no outstanding NFD_Init() */
+bool dbus_conn_shared = false;
 
-    nfdresult_t Subscribe(const char* handle_path) {
-        if (sub_cmd) Unsubscribe();
-        sub_cmd = MakeResponseSubscriptionPath(handle_path, dbus_unique_name);
+/* What the portal and the session bus support, probed once per connection (see GetCapabilities) */
+struct PortalCapabilities {
+    uint32_t fileChooserVersion;  // the `version` property of the FileChooser portal, 0 if unknown
+    bool fileManagerAvailable;    // org.freedesktop.FileManager1 is running or can be activated
+};
+/* serializes probing, which sends blocking calls and so must not hold `conn_mutex` */
+pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* the probed capabilities of the current connection, valid once `capabilities_probed` is set
+ * (with release semantics, under `probe_mutex`) */
+PortalCapabilities capabilities;
+bool capabilities_probed = false;
+
+// Forgets the connection, so that the next EnsureConnection() opens a new one.  Unless it was
+// inherited from our parent process (`release` is false), closes it, or if it belongs to the
+// application, removes our match rule from it and drops our reference.  Must be called with
+// `conn_mutex` held.
+void ForgetConnectionLocked(bool release) {
+    if (release && dbus_conn_shared) {
+        char rule[MATCH_RULE_MAX];
+        if (conn_ready && dbus_connection_get_is_connected(dbus_conn) &&
+            FormatResponseMatchRule(rule, dbus_unique_name) == NFD_OKAY)
+            dbus_bus_remove_match(dbus_conn, rule, nullptr);  // does not wait for the reply
+        dbus_connection_unref(dbus_conn);
+    } else if (release) {
+        dbus_connection_close(dbus_conn);
+        dbus_connection_unref(dbus_conn);
+    }
+    dbus_conn_shared = false;
+    dbus_conn = nullptr;
+    dbus_unique_name = nullptr;
+    __atomic_store_n(&conn_ready, false, __ATOMIC_RELEASE);
+    prewarm_started = false;
+    __atomic_store_n(&capabilities_probed, false, __ATOMIC_RELEASE);
+}
+
+// Opens the shared connection and adds the Response match rule, unless that has been done already
+// (which only costs an atomic load).  NFD_Init() does not connect, so that it is cheap to call.
+nfdresult_t EnsureConnection() {
+    if (__atomic_load_n(&conn_ready, __ATOMIC_ACQUIRE)) return NFD_OKAY;
+    Mutex_Guard conn_guard(&conn_mutex);
+    if (conn_ready) return NFD_OKAY;
+    if (!dbus_conn) {
         DBusError err;
         dbus_error_init(&err);
-        dbus_bus_add_match(dbus_conn, sub_cmd, &err);
-        if (dbus_error_is_set(&err)) {
-            dbus_error_free(&dbus_err);
-            dbus_move_error(&err, &dbus_err);
-            NFDi_SetError(dbus_err.message);
+        DBusConnection* conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+        if (!conn) {
+            NFDi_SetDBusError(err);
+            return NFD_ERROR;
+        }
+        dbus_connection_set_exit_on_disconnect(conn, false);
+        const char* unique_name = dbus_bus_get_unique_name(conn);
+        if (!unique_name) {
+            NFDi_SetError("Unable to get the unique name of our D-Bus connection.");
+            dbus_connection_close(conn);
+            dbus_connection_unref(conn);
             return NFD_ERROR;
         }
+        dbus_conn = conn;
+        dbus_conn_pid = getpid();
+        dbus_unique_name = unique_name;
+    }
+    // if this fails, we keep the connection and try again next time
+    if (nfdresult_t res = AddResponseMatchRule(dbus_conn, dbus_unique_name); res != NFD_OKAY)
+        return res;
+    __atomic_store_n(&conn_ready, true, __ATOMIC_RELEASE);
+    return NFD_OKAY;
+}
+
+// Returns the timeout to give libdbus for a capability probe on behalf of an operation that must
+// finish by `deadline`: without a deadline, libdbus' default, so that probing never hangs.
+int ProbeTimeoutUntil(uint64_t deadline) {
+    return deadline ? DBusTimeoutUntil(deadline) : DBUS_TIMEOUT_USE_DEFAULT;
+}
+
+// Whether the probe call that failed with `err` ran out of the time left until `deadline` (rather
+// than found that the portal does not have what it asked for).
+bool ProbeTimedOut(const DBusError& err, uint64_t deadline) {
+    return deadline && dbus_error_has_name(&err, DBUS_ERROR_NO_REPLY);
+}
+
+// Reads the `version` property of the FileChooser portal into `version`, or 0 if the portal does
+// not have it.  Returns NFD_TIMEOUT if `deadline` passes first.
+nfdresult_t ReadFileChooserVersion(uint64_t deadline, uint32_t& version) {
+    version = 0;
+    DBusMessage* query = dbus_message_new_method_call(STR_PORTAL_BUS_NAME,
+                                                      "/org/freedesktop/portal/desktop",
+                                                      "org.freedesktop.DBus.Properties",
+                                                      "Get");
+    DBusMessage_Guard query_guard(query);
+    const char* interface = "org.freedesktop.portal.FileChooser";
+    const char* property = "version";
+    dbus_message_append_args(
+        query, DBUS_TYPE_STRING, &interface, DBUS_TYPE_STRING, &property, DBUS_TYPE_INVALID);
+    DBusError err;
+    dbus_error_init(&err);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        dbus_conn, query, ProbeTimeoutUntil(deadline), &err);
+    if (!reply) {
+        if (ProbeTimedOut(err, deadline)) return MethodCallFailed(err, deadline);
+        dbus_error_free(&err);
+        return NFD_OKAY;
+    }
+    DBusMessage_Guard reply_guard(reply);
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(reply, &iter) ||
+        dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT)
+        return NFD_OKAY;
+    DBusMessageIter variant_iter;
+    dbus_message_iter_recurse(&iter, &variant_iter);
+    if (dbus_message_iter_get_arg_type(&variant_iter) != DBUS_TYPE_UINT32) return NFD_OKAY;
+    dbus_uint32_t value;
+    dbus_message_iter_get_basic(&variant_iter, &value);
+    version = value;
+    return NFD_OKAY;
+}
+
+// Finds out whether `name` has an owner on the bus or is D-Bus activatable (like most file
+// managers, which are started on demand).  Returns NFD_TIMEOUT if `deadline` passes first.
+nfdresult_t IsNameAvailable(const char* name, uint64_t deadline, bool& available) {
+    available = true;
+    DBusError err;
+    dbus_error_init(&err);
+    if (dbus_bus_name_has_owner(dbus_conn, name, &err)) return NFD_OKAY;
+    dbus_error_free(&err);
+    available = false;
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "ListActivatableNames");
+    DBusMessage_Guard query_guard(query);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        dbus_conn, query, ProbeTimeoutUntil(deadline), &err);
+    if (!reply) {
+        if (ProbeTimedOut(err, deadline)) return MethodCallFailed(err, deadline);
+        dbus_error_free(&err);
+        return NFD_OKAY;
+    }
+    DBusMessage_Guard reply_guard(reply);
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(reply, &iter) ||
+        dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY)
         return NFD_OKAY;
+    DBusMessageIter name_iter;
+    for (dbus_message_iter_recurse(&iter, &name_iter);
+         dbus_message_iter_get_arg_type(&name_iter) == DBUS_TYPE_STRING;
+         dbus_message_iter_next(&name_iter)) {
+        const char* activatable;
+        dbus_message_iter_get_basic(&name_iter, &activatable);
+        if (strcmp(activatable, name) == 0) {
+            available = true;
+            break;
+        }
+    }
+    return NFD_OKAY;
+}
+
+// Returns the capabilities of the portal and the session bus, probing them on first use of each
+// connection; afterwards this only costs an atomic load.  The probe gives up once `deadline` (see
+// DeadlineAfter) has passed, in which case this returns null with NFD_TIMEOUT's error set, and the
+// next caller probes again.  EnsureConnection() must have succeeded.
+const PortalCapabilities* GetCapabilities(uint64_t deadline) {
+    if (__atomic_load_n(&capabilities_probed, __ATOMIC_ACQUIRE)) return &capabilities;
+    Mutex_Guard probe_guard(&probe_mutex);
+    if (capabilities_probed) return &capabilities;
+    // another thread may have held the lock (probing with a later deadline) until ours passed
+    if (deadline && TimestampNs() >= deadline) {
+        NFDi_SetError("D-Bus call timed out.", ErrorKind::Timeout);
+        return nullptr;
     }
+    PortalCapabilities probed;
+    if (ReadFileChooserVersion(deadline, probed.fileChooserVersion) != NFD_OKAY ||
+        IsNameAvailable("org.freedesktop.FileManager1", deadline, probed.fileManagerAvailable) !=
+            NFD_OKAY)
+        return nullptr;
+    capabilities = probed;
+    __atomic_store_n(&capabilities_probed, true, __ATOMIC_RELEASE);
+    return &capabilities;
+}
+
+// Checks that the portal can show an OpenFile dialog with these options, and returns the folder to
+// start in (`defaultPath` if the portal supports it, otherwise null).  Only probes the portal if
+// the answer depends on its version, and then only until `deadline`.
+template <bool Directory>
+nfdresult_t CheckOpenFileCapabilities(const char* defaultPath,
+                                      uint64_t deadline,
+                                      const char*& currentFolder) {
+    currentFolder = nullptr;
+    if (!Directory && !defaultPath) return NFD_OKAY;
+    const PortalCapabilities* probed = GetCapabilities(deadline);
+    if (!probed) return NFD_TIMEOUT;
+    const uint32_t version = probed->fileChooserVersion;
+    // 0 means that the portal did not tell us, in which case we let it decide
+    if (Directory && version && version < 3) {
+        NFDi_SetError("The portal is too old to pick folders (FileChooser version 3 is required).");
+        return NFD_ERROR;
+    }
+    if (version >= 4) currentFolder = defaultPath;
+    return NFD_OKAY;
+}
 
-    void Unsubscribe() {
+void* Prewarm(void*) {
+    if (EnsureConnection() == NFD_OKAY) {
+        // Start the portal if it is not running yet (it is usually D-Bus activated) and probe what
+        // it supports, so that the first dialog does not wait for either
         DBusError err;
         dbus_error_init(&err);
-        dbus_bus_remove_match(dbus_conn, sub_cmd, &err);
-        NFDi_Free(sub_cmd);
-        sub_cmd = nullptr;
-        dbus_error_free(
-            &err);  // silence unsubscribe errors, because this is intuitively part of 'cleanup'
-    }
-
-   private:
-    static char* MakeResponseSubscriptionPath(const char* handle_path, const char* unique_name) {
-        const size_t handle_path_len = strlen(handle_path);
-        const size_t unique_name_len = strlen(unique_name);
-        const size_t sz = STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN + handle_path_len +
-                          STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN + unique_name_len +
-                          STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN;
-        char* res = NFDi_Malloc<char>(sz + 1);
-        char* res_ptr = res;
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_1,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_1 + STR_RESPONSE_SUBSCRIPTION_PATH_1_LEN,
-                       res_ptr);
-        res_ptr = copy(handle_path, handle_path + handle_path_len, res_ptr);
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_2,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_2 + STR_RESPONSE_SUBSCRIPTION_PATH_2_LEN,
-                       res_ptr);
-        res_ptr = copy(unique_name, unique_name + unique_name_len, res_ptr);
-        res_ptr = copy(STR_RESPONSE_SUBSCRIPTION_PATH_3,
-                       STR_RESPONSE_SUBSCRIPTION_PATH_3 + STR_RESPONSE_SUBSCRIPTION_PATH_3_LEN,
-                       res_ptr);
-        *res_ptr = '\0';
-        return res;
+        if (!dbus_bus_name_has_owner(dbus_conn, STR_PORTAL_BUS_NAME, &err) &&
+            !dbus_error_is_set(&err))
+            dbus_bus_start_service_by_name(dbus_conn, STR_PORTAL_BUS_NAME, 0, nullptr, &err);
+        dbus_error_free(&err);
+        GetCapabilities(0);
+    }
+    // the errors of this thread are discarded; a dialog that fails to connect reports its own
+    NFD_Quit();  // the reference taken by NFD_Prewarm()
+    return nullptr;
+}
+
+/*
+Response routing.  Every dialog registers a ResponseRoute for the object path of its request before
+calling the portal.  A dispatcher thread, started with the first dialog, reads the connection and
+hands each Response signal to the route with the same path, so that any number of dialogs (on any
+number of threads) can wait at the same time and each gets exactly its own response.
+
+The dispatcher uses dbus_connection_dispatch() rather than dbus_connection_pop_message(), so that
+method replies are still delivered to dbus_connection_send_with_reply_and_block() on the calling
+threads, and it never blocks inside libdbus, so that those threads can always write their queries.
+
+If the host's event loop drives the connection instead (see NFD_GetPollDescriptors), no dispatcher
+thread is started: the host calls NFD_Dispatch() whenever the connection or the wake-up pipe is
+readable, and a blocking dialog reads the connection itself until its own response arrives.  The
+same goes for a connection that belongs to the application (see NFD_InitWithConnection), except
+that the application dispatches it as it always does, and so runs our filter.
+*/
+struct ResponseRoute {
+    ResponseRoute* next;
+    /* the object path of the request, or null if the route is not registered */
+    char* path;
+    /* If set, called on the dispatcher thread with the Response signal (which it must not unref),
+     * or with null if the connection is lost.  Otherwise, the signal is kept in `response` for
+     * WaitForResponse(). */
+    void (*onResponse)(ResponseRoute* route, DBusMessage* msg);
+    /* If set (with `onResponse`), called after `onResponse` on the thread that dispatches, but
+     * without any lock held, so that it may add and remove routes (see RunCompletions). */
+    void (*onComplete)(ResponseRoute* route);
+    void* context;
+    /* the next route in `completions` */
+    ResponseRoute* nextCompletion;
+    /* `onComplete` is running (on another thread than the one that set it, see RemoveRoute) */
+    bool completionRunning;
+    /* when WaitForResponse() gives up and closes the dialog (on the TimestampNs() clock), or 0 */
+    uint64_t deadline;
+    DBusMessage* response;
+    /* when the Response signal was read */
+    uint64_t received;
+    bool done;
+};
+
+/* Responses for paths without a route are kept for a little while, because the portal may reply
+ * with another path than the one we asked for, and its Response can be read before we have seen
+ * that reply and moved the route (see UpdateRoutePath). */
+constexpr size_t UNCLAIMED_RESPONSES_MAX = 8;
+
+/* A condition variable whose timed waits use the TimestampNs() clock. */
+struct MonotonicCond {
+    pthread_cond_t cond;
+    MonotonicCond() noexcept {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+};
+
+/* guards everything below */
+pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* signalled whenever a route without `onResponse` is done */
+MonotonicCond route_cond;
+ResponseRoute* routes = nullptr;
+DBusMessage* unclaimed_responses[UNCLAIMED_RESPONSES_MAX];
+size_t unclaimed_response_count = 0;
+/* routes whose `onComplete` is due, in the order in which they completed */
+ResponseRoute* completions = nullptr;
+ResponseRoute** completions_tail = &completions;
+/* whether the routing is set up (the filter and the wake-up pipe) */
+bool dispatcher_running = false;
+/* whether the host's event loop drives the connection, in which case there is no dispatcher
+ * thread (see NFD_GetPollDescriptors) */
+bool host_dispatch = false;
+/* written to wake the dispatcher up: when messages were read by another thread, or to stop it */
+int dispatcher_wake_fds[2] = {-1, -1};
+
+/* A dispatcher thread.  It keeps its own copy of the wake-up pipe, because it may still be running a
+ * completion after it has been stopped, while a new dispatcher starts (see StopDispatcherLocked). */
+struct DispatcherThread {
+    pthread_t thread;
+    int wakeFds[2];
+    /* set (atomically) to make the thread exit */
+    bool stopping;
+    /* the thread was stopped from one of its own completions, so nobody joins it: it closes
+     * `wakeFds` and frees this itself when it exits (guarded by route_mutex) */
+    bool detached;
+};
+/* the running dispatcher thread, or null */
+DispatcherThread* dispatcher = nullptr;
+
+void WakeDispatcher() {
+    const char byte = 0;
+    if (write(dispatcher_wake_fds[1], &byte, 1) < 0) {
+        // the pipe is full, so the dispatcher will wake up anyway
+    }
+}
+
+// Called by libdbus on whichever thread read a message into the incoming queue.
+void OnDispatchStatus(DBusConnection*, DBusDispatchStatus status, void*) {
+    if (status == DBUS_DISPATCH_DATA_REMAINS) WakeDispatcher();
+}
+
+// Completes `route` with `msg` (which may be null).  Must be called with route_mutex held, after
+// `route` has been unlinked.
+void DeliverResponseLocked(ResponseRoute* route, DBusMessage* msg, uint64_t received) {
+    NFDi_Free(route->path);
+    route->path = nullptr;
+    route->received = received;
+    route->done = true;
+    if (route->onResponse) {
+        route->onResponse(route, msg);
+        if (route->onComplete) {
+            route->nextCompletion = nullptr;
+            *completions_tail = route;
+            completions_tail = &route->nextCompletion;
+        }
+    } else {
+        route->response = msg ? dbus_message_ref(msg) : nullptr;
+        pthread_cond_broadcast(&route_cond.cond);
+    }
+}
+
+// Returns the route for `path` (and unlinks it), or null.  Must be called with route_mutex held.
+ResponseRoute* TakeRouteLocked(const char* path) {
+    for (ResponseRoute** link = &routes; *link; link = &(*link)->next) {
+        ResponseRoute* route = *link;
+        if (strcmp(route->path, path) == 0) {
+            *link = route->next;
+            return route;
+        }
     }
+    return nullptr;
+}
+
+// Completes every route with null.  Must be called with route_mutex held.
+void FailRoutesLocked() {
+    while (ResponseRoute* route = routes) {
+        routes = route->next;
+        DeliverResponseLocked(route, nullptr, TimestampNs());
+    }
+}
+
+/* the route whose `onComplete` is running on this thread, or null once RemoveRoute() has been called
+ * for it from within `onComplete` */
+thread_local ResponseRoute* this_thread_completion = nullptr;
+
+// Calls `onComplete` for every route that completed since the last call.  Must be called on a
+// thread that dispatches, without route_mutex held.
+void RunCompletions() {
+    pthread_mutex_lock(&route_mutex);
+    while (ResponseRoute* route = completions) {
+        completions = route->nextCompletion;
+        if (!completions) completions_tail = &completions;
+        route->completionRunning = true;
+        ResponseRoute* const outer_completion = this_thread_completion;
+        this_thread_completion = route;
+        pthread_mutex_unlock(&route_mutex);
+        route->onComplete(route);
+        pthread_mutex_lock(&route_mutex);
+        // otherwise the route has been removed (and may be gone) already
+        if (this_thread_completion) {
+            route->completionRunning = false;
+            pthread_cond_broadcast(&route_cond.cond);
+        }
+        this_thread_completion = outer_completion;
+    }
+    pthread_mutex_unlock(&route_mutex);
+}
+
+DBusHandlerResult RouteResponse(DBusConnection*, DBusMessage* msg, void*) {
+    if (!dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response"))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    const uint64_t received = TimestampNs();
+    const char* path = dbus_message_get_path(msg);
+    NFD_PROBE(response, path);
+    TraceMessage(TraceKind::Response, msg);
+    pthread_mutex_lock(&route_mutex);
+    if (ResponseRoute* route = TakeRouteLocked(path)) {
+        DeliverResponseLocked(route, msg, received);
+    } else {
+        if (unclaimed_response_count == UNCLAIMED_RESPONSES_MAX) {
+            dbus_message_unref(unclaimed_responses[0]);
+            memmove(unclaimed_responses,
+                    unclaimed_responses + 1,
+                    sizeof(DBusMessage*) * (UNCLAIMED_RESPONSES_MAX - 1));
+            --unclaimed_response_count;
+        }
+        unclaimed_responses[unclaimed_response_count++] = dbus_message_ref(msg);
+    }
+    pthread_mutex_unlock(&route_mutex);
+    // the application dispatches a connection that it shares with us, so complete right away
+    if (dbus_conn_shared) RunCompletions();
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+// Reads what the connection has for us without blocking, routes the messages that arrived, and runs
+// the completions that are due.  Returns false if the connection was lost (in which case every
+// route has been completed with null).
+bool DispatchOnce() {
+    char buf[64];
+    while (read(dispatcher_wake_fds[0], buf, sizeof(buf)) > 0) {
+    }
+    const bool connected = dbus_connection_read_write(dbus_conn, 0);
+    while (dbus_connection_dispatch(dbus_conn) == DBUS_DISPATCH_DATA_REMAINS) {
+    }
+    if (!connected) {
+        pthread_mutex_lock(&route_mutex);
+        FailRoutesLocked();
+        pthread_mutex_unlock(&route_mutex);
+    }
+    RunCompletions();
+    return connected;
+}
+
+// Waits up to `timeoutMs` milliseconds (or forever if negative) for the connection or the wake-up
+// pipe to become readable, then calls DispatchOnce().  Only used if the host drives the connection.
+bool PollAndDispatch(int timeoutMs) {
+    // messages may have been read already, e.g. by dbus_connection_send_with_reply_and_block()
+    if (dbus_connection_get_dispatch_status(dbus_conn) == DBUS_DISPATCH_DATA_REMAINS) timeoutMs = 0;
+    int conn_fd = -1;
+    dbus_connection_get_unix_fd(dbus_conn, &conn_fd);
+    struct pollfd fds[2] = {{conn_fd, POLLIN, 0}, {dispatcher_wake_fds[0], POLLIN, 0}};
+    if (poll(fds, 2, timeoutMs) < 0 && errno != EINTR) return false;
+    return DispatchOnce();
+}
+
+// Frees `self` once its thread is about to exit, if nobody is going to join it.
+void ExitDispatcher(DispatcherThread* self) {
+    pthread_mutex_lock(&route_mutex);
+    const bool detached = self->detached;
+    pthread_mutex_unlock(&route_mutex);
+    if (detached) {
+        close(self->wakeFds[0]);
+        close(self->wakeFds[1]);
+        NFDi_Free(self);
+    }
+}
+
+void* DispatchResponses(void* arg) {
+    DispatcherThread* const self = static_cast<DispatcherThread*>(arg);
+    int conn_fd = -1;
+    dbus_connection_get_unix_fd(dbus_conn, &conn_fd);
+    while (true) {
+        // messages may have been read by other threads (see OnDispatchStatus)
+        while (dbus_connection_dispatch(dbus_conn) == DBUS_DISPATCH_DATA_REMAINS) {
+        }
+        RunCompletions();
+        // a completion may have called the last NFD_Quit(), after which another dispatcher may be
+        // running already
+        if (__atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE)) {
+            ExitDispatcher(self);
+            return nullptr;
+        }
+        struct pollfd fds[2] = {{conn_fd, POLLIN, 0}, {self->wakeFds[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(self->wakeFds[0], buf, sizeof(buf)) > 0) {
+            }
+            if (__atomic_load_n(&self->stopping, __ATOMIC_ACQUIRE)) {
+                ExitDispatcher(self);
+                return nullptr;
+            }
+        }
+        // does not wait if another thread is blocked in dbus_connection_send_with_reply_and_block()
+        // (which reads the connection itself)
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            !dbus_connection_read_write(dbus_conn, 0))
+            break;
+    }
+    // the connection was lost
+    pthread_mutex_lock(&route_mutex);
+    FailRoutesLocked();
+    pthread_mutex_unlock(&route_mutex);
+    RunCompletions();
+    ExitDispatcher(self);
+    return nullptr;
+}
+
+// Sets up the routing, and starts the dispatcher thread unless the host drives the connection.  Must
+// be called with route_mutex held.
+nfdresult_t StartDispatcherLocked() {
+    if (dispatcher_running) return NFD_OKAY;
+    if (pipe2(dispatcher_wake_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+        NFDi_SetError("pipe2 failed");
+        return NFD_ERROR;
+    }
+    if (!dbus_connection_add_filter(dbus_conn, RouteResponse, nullptr, nullptr)) {
+        NFDi_SetError("Unable to add a D-Bus message filter.", ErrorKind::DBus);
+        close(dispatcher_wake_fds[0]);
+        close(dispatcher_wake_fds[1]);
+        return NFD_ERROR;
+    }
+    // the application dispatches a connection that it shares with us, so it keeps its own hooks
+    if (dbus_conn_shared)
+        host_dispatch = true;
+    else
+        dbus_connection_set_dispatch_status_function(dbus_conn, OnDispatchStatus, nullptr, nullptr);
+    if (!host_dispatch) {
+        DispatcherThread* thread = NFDi_Malloc<DispatcherThread>(sizeof(DispatcherThread));
+        thread->wakeFds[0] = dispatcher_wake_fds[0];
+        thread->wakeFds[1] = dispatcher_wake_fds[1];
+        thread->stopping = false;
+        thread->detached = false;
+        if (pthread_create(&thread->thread, nullptr, DispatchResponses, thread)) {
+            NFDi_SetError("pthread_create failed");
+            NFDi_Free(thread);
+            dbus_connection_set_dispatch_status_function(dbus_conn, nullptr, nullptr, nullptr);
+            dbus_connection_remove_filter(dbus_conn, RouteResponse, nullptr);
+            close(dispatcher_wake_fds[0]);
+            close(dispatcher_wake_fds[1]);
+            return NFD_ERROR;
+        }
+        dispatcher = thread;
+    }
+    dispatcher_running = true;
+    // libdbus only reports changes of the status, so messages that were read before now (e.g. while
+    // the connection was set up) would otherwise not wake the host up until more arrive
+    if (host_dispatch && !dbus_conn_shared &&
+        dbus_connection_get_dispatch_status(dbus_conn) == DBUS_DISPATCH_DATA_REMAINS)
+        WakeDispatcher();
+    return NFD_OKAY;
+}
+
+// Stops routing Responses and completes the routes that are left with null.  The dispatcher thread
+// (if any) is told to stop and returned; the caller must pass it to JoinDispatcher() and then call
+// RunCompletions(), both after releasing `conn_mutex`, because the thread may be running a
+// completion that calls NFD_Init().  The routing can be set up again right away.  The host has to
+// call NFD_GetPollDescriptors() again to drive the connection after this.  Must be called with
+// `conn_mutex` held.
+DispatcherThread* StopDispatcherLocked() {
+    pthread_mutex_lock(&route_mutex);
+    const bool running = dispatcher_running;
+    DispatcherThread* const thread = dispatcher;
+    dispatcher = nullptr;
+    host_dispatch = false;
+    pthread_mutex_unlock(&route_mutex);
+    if (!running) return nullptr;
+    if (thread) {
+        __atomic_store_n(&thread->stopping, true, __ATOMIC_RELEASE);
+        WakeDispatcher();
+    }
+    if (!dbus_conn_shared)
+        dbus_connection_set_dispatch_status_function(dbus_conn, nullptr, nullptr, nullptr);
+    dbus_connection_remove_filter(dbus_conn, RouteResponse, nullptr);
+    // the thread's pipe is closed by JoinDispatcher()
+    if (!thread) {
+        close(dispatcher_wake_fds[0]);
+        close(dispatcher_wake_fds[1]);
+    }
+    dispatcher_wake_fds[0] = dispatcher_wake_fds[1] = -1;
+    pthread_mutex_lock(&route_mutex);
+    dispatcher_running = false;
+    FailRoutesLocked();
+    for (size_t i = 0; i != unclaimed_response_count; ++i)
+        dbus_message_unref(unclaimed_responses[i]);
+    unclaimed_response_count = 0;
+    pthread_mutex_unlock(&route_mutex);
+    return thread;
+}
+
+// Waits for `thread` (from StopDispatcherLocked, may be null) to exit and frees it.  If this is that
+// thread, i.e. the last NFD_Quit() was called from one of its completions, it is detached instead,
+// and exits by itself once the completion returns.
+void JoinDispatcher(DispatcherThread* thread) {
+    if (!thread) return;
+    if (pthread_equal(thread->thread, pthread_self())) {
+        pthread_mutex_lock(&route_mutex);
+        thread->detached = true;
+        pthread_mutex_unlock(&route_mutex);
+        pthread_detach(thread->thread);
+        return;
+    }
+    pthread_join(thread->thread, nullptr);
+    close(thread->wakeFds[0]);
+    close(thread->wakeFds[1]);
+    NFDi_Free(thread);
+}
+
+// Registers `route` for Response signals on `path`, starting the dispatcher if needed.  The
+// `onResponse` and `context` members must be set beforehand.
+nfdresult_t AddRoute(ResponseRoute& route, const char* path) {
+    const size_t path_size = strlen(path) + 1;
+    char* const path_copy = NFDi_Malloc<char>(path_size);
+    memcpy(path_copy, path, path_size);
+    pthread_mutex_lock(&route_mutex);
+    const nfdresult_t res = StartDispatcherLocked();
+    if (res == NFD_OKAY) {
+        route.path = path_copy;
+        route.response = nullptr;
+        route.completionRunning = false;
+        route.done = false;
+        route.next = routes;
+        routes = &route;
+    }
+    pthread_mutex_unlock(&route_mutex);
+    if (res != NFD_OKAY) NFDi_Free(path_copy);
+    return res;
+}
+
+// Moves `route` to `path`, because the portal replied with another request path than we expected.
+void UpdateRoutePath(ResponseRoute& route, const char* path) {
+    const size_t path_size = strlen(path) + 1;
+    char* const path_copy = NFDi_Malloc<char>(path_size);
+    memcpy(path_copy, path, path_size);
+    pthread_mutex_lock(&route_mutex);
+    if (!route.done) {
+        NFDi_Free(route.path);
+        route.path = path_copy;
+        // the Response may have been read already
+        for (size_t i = 0; i != unclaimed_response_count; ++i) {
+            DBusMessage* msg = unclaimed_responses[i];
+            if (strcmp(dbus_message_get_path(msg), path) == 0) {
+                memmove(unclaimed_responses + i,
+                        unclaimed_responses + i + 1,
+                        sizeof(DBusMessage*) * (unclaimed_response_count - i - 1));
+                --unclaimed_response_count;
+                TakeRouteLocked(path);
+                DeliverResponseLocked(&route, msg, TimestampNs());
+                dbus_message_unref(msg);
+                break;
+            }
+        }
+    } else {
+        NFDi_Free(path_copy);
+    }
+    pthread_mutex_unlock(&route_mutex);
+}
+
+// Unregisters `route` if it is still waiting, and returns its path (which the caller must free), or
+// null.  Must be called with route_mutex held.
+char* CancelRouteLocked(ResponseRoute& route) {
+    if (route.done || !route.path) return nullptr;
+    for (ResponseRoute** link = &routes; *link; link = &(*link)->next) {
+        if (*link == &route) {
+            *link = route.next;
+            break;
+        }
+    }
+    char* path = route.path;
+    route.path = nullptr;
+    route.done = true;
+    return path;
+}
+
+// Unregisters `route` if it is still waiting, and releases what it holds.  Once this returns,
+// `onResponse` and `onComplete` are not running (except if this is called from within
+// `onComplete`) and will not be called.
+void RemoveRoute(ResponseRoute& route) {
+    pthread_mutex_lock(&route_mutex);
+    NFDi_Free(CancelRouteLocked(route));
+    if (&route == this_thread_completion) {
+        this_thread_completion = nullptr;
+    } else {
+        while (route.completionRunning) pthread_cond_wait(&route_cond.cond, &route_mutex);
+        for (ResponseRoute** link = &completions; *link; link = &(*link)->nextCompletion) {
+            if (*link == &route) {
+                *link = route.nextCompletion;
+                if (!*link) completions_tail = link;
+                break;
+            }
+        }
+    }
+    if (route.response) {
+        dbus_message_unref(route.response);
+        route.response = nullptr;
+    }
+    pthread_mutex_unlock(&route_mutex);
+}
+
+// Asks the portal to close the dialog of the request at `path`, without waiting for it.  The portal
+// does not send a Response for a closed request.
+void CloseRequest(const char* path) {
+    DBusMessage* query = dbus_message_new_method_call(
+        STR_PORTAL_BUS_NAME, path, "org.freedesktop.portal.Request", "Close");
+    DBusMessage_Guard query_guard(query);
+    dbus_message_set_no_reply(query, TRUE);
+    NFD_PROBE(method_call, dbus_message_get_member(query));
+    dbus_connection_send(dbus_conn, query, nullptr);
+    dbus_connection_flush(dbus_conn);
+}
+
+// Waits until the Response signal for `route` (which must not have `onResponse`) arrives, and
+// returns it in `outMsg` (the caller must unref it).  If `route.deadline` passes first, closes the
+// dialog and returns NFD_TIMEOUT.
+nfdresult_t WaitForResponse(ResponseRoute& route, DBusMessage*& outMsg) {
+    pthread_mutex_lock(&route_mutex);
+    char* timed_out_path = nullptr;
+    while (!route.done) {
+        if (route.deadline && TimestampNs() >= route.deadline) {
+            timed_out_path = CancelRouteLocked(route);
+            break;
+        }
+        if (host_dispatch) {
+            // nobody else reads the connection, so this thread does until the response arrives
+            pthread_mutex_unlock(&route_mutex);
+            PollAndDispatch(route.deadline ? DBusTimeoutUntil(route.deadline) : -1);
+            pthread_mutex_lock(&route_mutex);
+        } else if (!route.deadline) {
+            pthread_cond_wait(&route_cond.cond, &route_mutex);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(route.deadline / 1000000000u);
+            ts.tv_nsec = static_cast<long>(route.deadline % 1000000000u);
+            pthread_cond_timedwait(&route_cond.cond, &route_mutex, &ts);
+        }
+    }
+    DBusMessage* msg = route.response;
+    route.response = nullptr;
+    pthread_mutex_unlock(&route_mutex);
+    if (timed_out_path) {
+        CloseRequest(timed_out_path);
+        NFDi_Free(timed_out_path);
+        NFDi_SetError("D-Bus file dialog was closed because the user did not respond in time.",
+                      ErrorKind::Timeout);
+        return NFD_TIMEOUT;
+    }
+    if (!msg) {
+        NFDi_SetError("D-Bus freedesktop portal did not give us a reply.", ErrorKind::DBus);
+        return NFD_ERROR;
+    }
+    last_timings.responseReceived = route.received;
+    outMsg = msg;
+    return NFD_OKAY;
+}
+
+// Unregisters a route when it goes out of scope.
+struct ResponseRoute_Guard {
+    ResponseRoute& route;
+    explicit ResponseRoute_Guard(ResponseRoute& route) noexcept : route(route) {}
+    ~ResponseRoute_Guard() { RemoveRoute(route); }
 };
 
 // Returns true if ch is in [0-9A-Za-z], false otherwise.
@@ -1235,6 +2247,8 @@ bool TryUriDecodeLen(const char* fileUri, size_t& out, const char*& fileUriEnd)
 // not malformed (typically with a prior call to `TryUriDecodeLen`).  This function does not write
 // any trailing null character.
 char* UriDecodeUnchecked(const char* fileUri, const char* fileUriEnd, char* outPath) {
+    NFD_PROBE(uri_decode, fileUri, static_cast<size_t>(fileUriEnd - fileUri));
+    StatAdd(&NfdStats::uriBytesDecoded, fileUriEnd - fileUri);
     while (fileUri != fileUriEnd) {
         if (*fileUri != '%') {
             *outPath++ = *fileUri++;
@@ -1259,20 +2273,22 @@ nfdresult_t AllocAndCopyFilePath(const char* fileUri, char*& outPath, size_t* ou
     const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
     for (; prefix_begin != prefix_end; ++prefix_begin, ++fileUri) {
         if (*prefix_begin != *fileUri) {
-            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.");
+            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
     }
     size_t decoded_len;
     const char* file_uri_end;
     if (!TryUriDecodeLen(fileUri, decoded_len, file_uri_end)) {
-        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.");
+        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.", ErrorKind::Response);
         return NFD_ERROR;
     }
     char* const path_without_prefix = NFDi_Malloc<char>(decoded_len + 1);
     char* const out_end = UriDecodeUnchecked(fileUri, file_uri_end, path_without_prefix);
     *out_end = '\0';
     outPath = path_without_prefix;
+    StatAdd(&NfdStats::pathsReturned);
     if (outSize)
         *outSize = decoded_len + 1;
     return NFD_OKAY;
@@ -1318,14 +2334,15 @@ nfdresult_t copyFileInfo(const char* fileUri, char*& outPathList, char*& curOutP
     const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
     for (; prefix_begin != prefix_end; ++prefix_begin, ++fileUri) {
         if (*prefix_begin != *fileUri) {
-            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.");
+            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
     }
     size_t decoded_len;
     const char* file_uri_end;
     if (!TryUriDecodeLen(fileUri, decoded_len, file_uri_end)) {
-        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.");
+        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.", ErrorKind::Response);
         return NFD_ERROR;
     }
     if constexpr (std::same_as<Policy, policy::FullPath>) {
@@ -1345,10 +2362,11 @@ nfdresult_t copyFileInfo(const char* fileUri, char*& outPathList, char*& curOutP
         char* buf = static_cast<char*>(alloca(decoded_len + 1));
         char* const bufEnd = UriDecodeUnchecked(fileUri, file_uri_end, buf);
         *bufEnd = '\0';
+        // may point into `buf` or to a static string such as "."
         char* const segment = segFunc(buf);
         size_t segmentLen = strlen(segment);
         expandOnDemand(outPathList, curOutPath, outPathSize, segmentLen + 1);
-        curOutPath = copy(segment, bufEnd + 1, curOutPath);
+        curOutPath = copy(segment, segment + segmentLen + 1, curOutPath);
     }
     else {
         static_assert(details::Dummy<Policy>::value, "policy not implemented");
@@ -1375,7 +2393,7 @@ nfdresult_t NFD_PathSet_GetPathWin(const nfdpathset_t* pathSet,
         }
     }
     if (dbus_message_iter_get_arg_type(&uri_iter) != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+        NFDi_SetError("D-Bus response signal URI sub iter is not a string.", ErrorKind::Response);
         return NFD_ERROR;
     }
     const char* uri;
@@ -1383,6 +2401,53 @@ nfdresult_t NFD_PathSet_GetPathWin(const nfdpathset_t* pathSet,
     return copyFileInfo<Policy>(uri, outPathList, curOutPath, outPathSize);
 }
 
+// Reads all URIs of the response into a single buffer laid out like the result of a Windows
+// multi-select dialog: if one file was selected, its full path; otherwise the directory followed
+// by the name of each file.  Every entry is null-terminated and the list ends with an extra null.
+// The caller owns `outPathList` if this function returns NFD_OKAY.
+nfdresult_t CopyPathListWin(DBusMessage* msg, char*& outPathList, size_t& outPathListSize) {
+    DBusMessageIter uri_iter;
+    nfdresult_t res = ReadResponseUris(msg, uri_iter);
+    if (res != NFD_OKAY) return res;
+
+    nfdpathsetsize_t numPaths;
+    NFD_PathSet_GetCount(msg, &numPaths);
+
+    int pathListSize = 256;
+    char* pathList = NFDi_Malloc<char>(pathListSize);
+    char* curOutPath = pathList;
+
+    if (numPaths == 1)
+        res = NFD_PathSet_GetPathWin<policy::FullPath>(msg, 0, pathList, curOutPath, pathListSize);
+    else
+        res = NFD_PathSet_GetPathWin<policy::Dirname>(msg, 0, pathList, curOutPath, pathListSize);
+
+    if (res != NFD_OKAY) {
+        NFDi_Free(pathList);
+        return res;
+    }
+
+    // with several paths, the directory is followed by the name of every file, including the first
+    for (nfdpathsetsize_t i = numPaths == 1 ? 1 : 0; i < numPaths; ++i) {
+        if (NFD_PathSet_GetPathWin<policy::Basename>(
+                msg, i, pathList, curOutPath, pathListSize) != NFD_OKAY) {
+            NFDi_Free(pathList);
+            return NFD_ERROR;
+        }
+    }
+
+    if (pathListSize == curOutPath - pathList) {
+        ptrdiff_t offset = curOutPath - pathList;
+        pathList = NFDi_Realloc<char>(pathList, ++pathListSize);
+        curOutPath = pathList + offset;
+    }
+    *curOutPath = '\0';  // double null-terminate
+    outPathList = pathList;
+    outPathListSize = curOutPath - pathList + 1;
+    StatAdd(&NfdStats::pathsReturned, numPaths);
+    return NFD_OKAY;
+}
+
 //template <typename Derived, bool Multiple>
 //class NfdFilePathProcessor;
 //
@@ -1428,14 +2493,20 @@ nfdresult_t NFD_PathSet_GetPathWin(const nfdpathset_t* pathSet,
 //
 //};
 
+// The handle of an async dialog.  Its result is decoded on the dispatcher thread when the Response
+// signal arrives (see ResponseRoute).
 class NfdDialogMonitor {
     char* outPath{};
     size_t outPathSize{};
     nfdresult_t resultCode{};
+    const char* errorMessage{};  // handed to the thread that collects an NFD_ERROR result
     bool completed{};
+    NfdDialogTimings timings{};
+    ResponseRoute route{};
+    void (*callback)(void* opHandle, void* userData){};
+    void* userData{};
 
     mutable pthread_mutex_t mutex{};
-    pthread_t thread{};
 
     class ScopedLock {
         pthread_mutex_t* m_;
@@ -1444,30 +2515,22 @@ class NfdDialogMonitor {
         ~ScopedLock() { pthread_mutex_unlock(m_); }
     };
 
-    class MutexDestroyGuard {
-        pthread_mutex_t* m_;
-    public:
-        explicit MutexDestroyGuard(pthread_mutex_t* m) noexcept : m_(m) { }
-        ~MutexDestroyGuard()
-        {
-            pthread_mutex_destroy(m_);
-        }
-    };
-
     nfdresult_t allocAndCopyFilePath(const char* fileUri)
     {
         const char* prefix_begin = FILE_URI_PREFIX;
         const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
         for (; prefix_begin != prefix_end; ++prefix_begin, ++fileUri) {
             if (*prefix_begin != *fileUri) {
-                NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.");
+                NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.",
+                              ErrorKind::Response);
                 return NFD_ERROR;
             }
         }
         size_t decoded_len;
         const char* file_uri_end;
         if (!TryUriDecodeLen(fileUri, decoded_len, file_uri_end)) {
-            NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.");
+            NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
         char* const path_without_prefix = NFDi_Malloc<char>(decoded_len + 1);
@@ -1478,6 +2541,7 @@ class NfdDialogMonitor {
             outPath = path_without_prefix;
             outPathSize = decoded_len + 1;
         }
+        StatAdd(&NfdStats::pathsReturned);
         return NFD_OKAY;
     }
 
@@ -1498,91 +2562,49 @@ class NfdDialogMonitor {
 
     nfdresult_t copyMultipleFilePath(DBusMessage* msg)
     {
-        DBusMessageIter uri_iter;
-        nfdresult_t res = ReadResponseUris(msg, uri_iter);
-        if (res != NFD_OKAY)
-            return res;
-
-        nfdpathsetsize_t numPaths;
-        NFD_PathSet_GetCount(msg, &numPaths);
-
-        int pathListSize = 256;
-        char* tmpOutPath = NFDi_Malloc<char>(pathListSize);
-        char* curOutPath = tmpOutPath;
-
-        if (numPaths == 1)
-            res = NFD_PathSet_GetPathWin<policy::FullPath>(
-                msg, 0, tmpOutPath, curOutPath, pathListSize);
-        else
-            res = NFD_PathSet_GetPathWin<policy::Dirname>(
-                msg, 0, tmpOutPath, curOutPath, pathListSize);
-
-        if (res != NFD_OKAY) {
-            NFDi_Free(tmpOutPath);
+        char* tmpOutPath;
+        size_t tmpOutPathSize;
+        if (nfdresult_t res = CopyPathListWin(msg, tmpOutPath, tmpOutPathSize); res != NFD_OKAY)
             return res;
-        }
-
-        for (nfdpathsetsize_t i = 1; i < numPaths; ++i) {
-            if (NFD_PathSet_GetPathWin<policy::Basename>(
-                msg, i, tmpOutPath, curOutPath, pathListSize) != NFD_OKAY) {
-                NFDi_Free(tmpOutPath);
-                return NFD_ERROR;
-            }
-        }
-
-        if (pathListSize == curOutPath - tmpOutPath) {
-            ptrdiff_t offset = curOutPath - tmpOutPath;
-            tmpOutPath = NFDi_Realloc<char>(tmpOutPath, ++pathListSize);
-            curOutPath = tmpOutPath + offset;
-        }
-        *curOutPath = '\0';  // double null-terminate
         {
             ScopedLock lock(&mutex);
             outPath = tmpOutPath;
-            outPathSize = curOutPath - tmpOutPath + 1;
+            outPathSize = tmpOutPathSize;
         }
 
         return NFD_OKAY;
     }
 
     template <bool Multiple>
-    static void* monitorUntilReturn(void* args)
+    static void onResponse(ResponseRoute* route, DBusMessage* msg)
     {
-        NfdDialogMonitor* self = static_cast<NfdDialogMonitor*>(args);
-
-        // Wait and read the response
-        // const char* file = nullptr;
-        do {
-            while (true) {
-                DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-                if (!msg) break;
-
-                DBusMessage_Guard guard(msg);
-
-                if (dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response")) {
-                    nfdresult_t res;
-
-                    if constexpr (Multiple)
-                        res = self->copyMultipleFilePath(msg);
-                    else
-                        res = self->copySingleFilepath(msg);
-
-                    ScopedLock lock(&self->mutex);
-                    self->resultCode = res;
-                    self->completed = true;
-                    return nullptr;
-                }
-            }
-        } while (dbus_connection_read_write(dbus_conn, -1));
-
-        NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-        {
-            ScopedLock lock(&self->mutex);
-            self->resultCode = NFD_ERROR;
-            self->completed = true;
+        NfdDialogMonitor* self = static_cast<NfdDialogMonitor*>(route->context);
+        nfdresult_t res;
+        if (!msg) {
+            NFDi_SetError("D-Bus freedesktop portal did not give us a reply.", ErrorKind::DBus);
+            res = NFD_ERROR;
+        } else if constexpr (Multiple) {
+            res = self->copyMultipleFilePath(msg);
+        } else {
+            res = self->copySingleFilepath(msg);
         }
 
-        return nullptr;
+        ScopedLock lock(&self->mutex);
+        self->resultCode = res;
+        // errors set while decoding are string literals, so they outlive this thread's error state
+        self->errorMessage = res == NFD_ERROR ? err_ptr : nullptr;
+        self->completed = true;
+        self->timings.responseReceived = route->received;
+        self->timings.resultDecoded = TimestampNs();
+        if (res == NFD_OKAY)
+            StatRecordLatency(self->timings.resultDecoded - self->timings.start);
+        NFD_PROBE(async_complete, self, static_cast<int>(res));
+    }
+
+    static void onComplete(ResponseRoute* route)
+    {
+        NfdDialogMonitor* self = static_cast<NfdDialogMonitor*>(route->context);
+        self->callback(self, self->userData);
     }
 
     NfdDialogMonitor() noexcept = default;
@@ -1608,17 +2630,39 @@ public:
             NFDi_Free(ret);
             return nullptr;
         }
-        MutexDestroyGuard mutexDestroyGuard{&ret->mutex};
-        if (int err = pthread_create(&ret->thread, nullptr, monitorUntilReturn<Multiple>, ret)) {
-            NFDi_SetError("pthread_create failed");
-            NFDi_Free(ret);
-            return nullptr;
-        }
+        ret->route.onResponse = onResponse<Multiple>;
+        ret->route.context = ret;
+        NFD_PROBE(async_create, ret);
         return ret;
     }
 
+    ResponseRoute& getRoute() noexcept { return route; }
+
+    // Has `cb` called with the handle and `data` once the dialog has completed, on the thread that
+    // dispatches (see RunCompletions).  Must be called before the dialog is shown.
+    void setCallback(void (*cb)(void* opHandle, void* userData), void* data) noexcept
+    {
+        callback = cb;
+        userData = data;
+        route.onComplete = cb ? onComplete : nullptr;
+    }
+
+    // Records the phases of the dialog up to the portal's reply, from `last_timings`.  The response
+    // may already have been received.
+    void setLaunchTimings(const NfdDialogTimings& launched) noexcept
+    {
+        ScopedLock lock(&mutex);
+        timings.start = launched.start;
+        timings.connectionReady = launched.connectionReady;
+        timings.matchRuleAdded = launched.matchRuleAdded;
+        timings.queryBuilt = launched.queryBuilt;
+        timings.methodReplied = launched.methodReplied;
+    }
+
     static void destroy(NfdDialogMonitor* monitor) noexcept
     {
+        // after this, the dispatcher thread no longer touches the monitor
+        RemoveRoute(monitor->route);
         monitor->~NfdDialogMonitor();
         NFDi_Free(monitor);
     }
@@ -1638,6 +2682,9 @@ public:
             NFDi_SetError("response not ready");
             return NFD_ERROR;
         }
+        timings.resultDelivered = TimestampNs();
+        if (resultCode == NFD_ERROR)
+            err_ptr = errorMessage;  // already counted by the dispatcher thread
         if (resultCode != NFD_OKAY)
             return resultCode;
         *result->outPath = outPath;
@@ -1645,10 +2692,34 @@ public:
         result->outPathSize = outPathSize;
         return NFD_OKAY;
     }
-};
 
+    void getTimings(NfdDialogTimings* out) const noexcept
+    {
+        ScopedLock lock(&mutex);
+        *out = timings;
+    }
+};
 
-#ifdef NFD_APPEND_EXTENSION
+// Shows an async dialog with `show(route)` (one of the NFD_DBus_Show* functions) and returns its
+// handle in `params->outAsyncOpHandle`.
+template <bool Multiple, typename Show>
+nfdresult_t ShowAsyncDialog(NfdDialogParams* params, Show show)
+{
+    NfdDialogMonitor* monitor = NfdDialogMonitor::create<Multiple>();
+    if (!monitor)
+        return NFD_ERROR;
+    monitor->setCallback(params->onAsyncOpComplete, params->userData);
+    if (nfdresult_t res = show(monitor->getRoute()); res != NFD_OKAY) {
+        NfdDialogMonitor::destroy(monitor);
+        return res;
+    }
+    monitor->setLaunchTimings(last_timings);
+    *params->outAsyncOpHandle = monitor;
+    return NFD_OKAY;
+}
+
+
+#ifdef NFD_APPEND_EXTENSION
 bool TryGetValidExtension(const char* extn,
                           const char*& trimmed_extn,
                           const char*& trimmed_extn_end) {
@@ -1673,7 +2744,8 @@ nfdresult_t AllocAndCopyFilePathWithExtn(const char* fileUri, const char* extn,
     const char* const prefix_end = FILE_URI_PREFIX + FILE_URI_PREFIX_LEN;
     for (; prefix_begin != prefix_end; ++prefix_begin, ++fileUri) {
         if (*prefix_begin != *fileUri) {
-            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.");
+            NFDi_SetError("D-Bus freedesktop portal returned a URI that is not a file URI.",
+                          ErrorKind::Response);
             return NFD_ERROR;
         }
     }
@@ -1681,7 +2753,7 @@ nfdresult_t AllocAndCopyFilePathWithExtn(const char* fileUri, const char* extn,
     size_t decoded_len;
     const char* file_uri_end;
     if (!TryUriDecodeLen(fileUri, decoded_len, file_uri_end)) {
-        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.");
+        NFDi_SetError("D-Bus freedesktop portal returned a malformed URI.", ErrorKind::Response);
         return NFD_ERROR;
     }
 
@@ -1710,18 +2782,36 @@ nfdresult_t AllocAndCopyFilePathWithExtn(const char* fileUri, const char* extn,
         *out_end = '\0';
         outPath = path_without_prefix;
     }
+    StatAdd(&NfdStats::pathsReturned);
     return NFD_OKAY;
 }
 #endif
 
-// DBus wrapper function that helps invoke the portal for all OpenFile() variants.
-// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
-// Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
-// DBusMessage_Guard).
-template <bool Multiple, bool Directory>
-nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
-                              const nfdnfilteritem_t* filterList,
-                              nfdfiltersize_t filterCount) {
+// The start of every dialog: sets the deadline of `route` to `timeoutMs` from now, starts the
+// timings, counts the dialog in `counter` (and fires the dialog_start probe with `kind`), and makes
+// sure that there is a connection.
+nfdresult_t BeginDialog(ResponseRoute& route,
+                        int timeoutMs,
+                        uint64_t NfdStats::*counter,
+                        const char* kind) {
+    route.deadline = DeadlineAfter(timeoutMs);
+    BeginTimings();
+    StatAdd(counter);
+    NFD_PROBE(dialog_start, kind);
+    (void)kind;  // unused without NFD_ENABLE_USDT
+    // The connection is opened (and the match rule added) by the first dialog or NFD_Prewarm()
+    if (nfdresult_t res = EnsureConnection(); res != NFD_OKAY) return res;
+    last_timings.connectionReady = TimestampNs();
+    last_timings.matchRuleAdded = last_timings.connectionReady;
+    return NFD_OKAY;
+}
+
+// Calls `method` (OpenFile or SaveFile) of the FileChooser portal, with the arguments that
+// `appendParams` appends to the query (it is given the query and the handle token), and has the
+// Response signal of the request routed to `route`.  Returns once the portal has replied to the
+// call; the caller then waits for the Response with WaitForResponse(), or leaves the dialog async.
+template <typename AppendParams>
+nfdresult_t CallFileChooser(ResponseRoute& route, const char* method, AppendParams appendParams) {
     const char* handle_token_ptr;
     char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
     Free_Guard<char> handle_obj_path_guard(handle_obj_path);
@@ -1730,10 +2820,8 @@ nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
     // if it's stil set
     dbus_error_init(&err);
 
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
-    if (res != NFD_OKAY) return res;
+    // Have the Response signal for handle_obj_path routed to `route`
+    if (nfdresult_t res = AddRoute(route, handle_obj_path); res != NFD_OKAY) return res;
 
     // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
     // Wayland?
@@ -1741,118 +2829,111 @@ nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
     DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
                                                       "/org/freedesktop/portal/desktop",
                                                       "org.freedesktop.portal.FileChooser",
-                                                      "OpenFile");
+                                                      method);
     DBusMessage_Guard query_guard(query);
-    AppendOpenFileQueryParams<Multiple, Directory>(
-        query, handle_token_ptr, filterList, filterCount);
-
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
+    appendParams(query, handle_token_ptr);
+    last_timings.queryBuilt = TimestampNs();
+
+    NFD_PROBE(method_call, dbus_message_get_member(query));
+    TraceQuery(query);
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        dbus_conn, query, DBusTimeoutUntil(route.deadline), &err);
+    NFD_PROBE(method_reply, dbus_message_get_member(query), reply != nullptr);
     if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
+        const nfdresult_t res = MethodCallFailed(err, route.deadline);
+        // the portal may still get to our call and show the dialog
+        if (res == NFD_TIMEOUT) CloseRequest(handle_obj_path);
+        return res;
     }
     DBusMessage_Guard reply_guard(reply);
+    last_timings.methodReplied = TimestampNs();
 
     // Check the reply and update our signal subscription if necessary
-    {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
-        }
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(reply, &iter)) {
+        NFDi_SetError("D-Bus reply is missing an argument.", ErrorKind::Response);
+        return NFD_ERROR;
+    }
+    if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
+        NFDi_SetError("D-Bus reply is not an object path.", ErrorKind::Response);
+        return NFD_ERROR;
+    }
 
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
-        }
+    const char* path;
+    dbus_message_iter_get_basic(&iter, &path);
+    if (strcmp(path, handle_obj_path) != 0) {
+        // an old portal that ignored our handle_token; the match rule covers the path anyway
+        UpdateRoutePath(route, path);
     }
+    return NFD_OKAY;
+}
 
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
+template <bool Multiple, bool Directory>
+constexpr uint64_t NfdStats::*OpenFileCounter() {
+    return Directory  ? &NfdStats::pickFolderDialogs
+           : Multiple ? &NfdStats::openMultipleDialogs
+                      : &NfdStats::openDialogs;
+}
 
-            if (dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
-            }
+template <bool Multiple, bool Directory>
+constexpr const char* OpenFileKind() {
+    return Directory ? "pick_folder" : Multiple ? "open_multiple" : "open";
+}
 
-            dbus_message_unref(msg);
-        }
-    } while (dbus_connection_read_write(dbus_conn, -1));
+// DBus wrapper function that helps invoke the portal for all OpenFile() variants.
+// This function returns NFD_OKAY iff outMsg gets set (to the returned message).
+// Caller is responsible for freeing the outMsg using dbus_message_unref() (or use
+// DBusMessage_Guard).
+template <bool Multiple, bool Directory>
+nfdresult_t NFD_DBus_OpenFile(DBusMessage*& outMsg,
+                              const nfdnfilteritem_t* filterList,
+                              nfdfiltersize_t filterCount,
+                              const nfdnchar_t* defaultPath) {
+    ResponseRoute route{};
+    ResponseRoute_Guard route_guard(route);
+    if (nfdresult_t res = BeginDialog(route,
+                                      0,
+                                      OpenFileCounter<Multiple, Directory>(),
+                                      OpenFileKind<Multiple, Directory>());
+        res != NFD_OKAY)
+        return res;
+    const char* current_folder;
+    if (nfdresult_t res =
+            CheckOpenFileCapabilities<Directory>(defaultPath, route.deadline, current_folder);
+        res != NFD_OKAY)
+        return res;
+    if (nfdresult_t res = CallFileChooser(
+            route,
+            "OpenFile",
+            [&](DBusMessage* query, const char* handle_token) {
+                AppendOpenFileQueryParams<Multiple, Directory>(
+                    query, handle_token, filterList, filterCount, current_folder);
+            });
+        res != NFD_OKAY)
+        return res;
 
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+    // Wait for the response
+    return WaitForResponse(route, outMsg);
 }
 template <bool Multiple, bool Directory>
-nfdresult_t NFD_DBus_ShowOpenFileDialog(NfdDialogParams* params)
+nfdresult_t NFD_DBus_ShowOpenFileDialog(NfdDialogParams* params, ResponseRoute& route)
 {
-    const char* handle_token_ptr;
-    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
-    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
-
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-    // if it's stil set
-    dbus_error_init(&err);
-
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
-    if (res != NFD_OKAY) return res;
-
-    // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
-    // Wayland?
-
-    DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
-                                                      "/org/freedesktop/portal/desktop",
-                                                      "org.freedesktop.portal.FileChooser",
-                                                      "OpenFile");
-    DBusMessage_Guard query_guard(query);
-    AppendOpenFileQueryParams<Multiple, Directory>(
-        query, handle_token_ptr, params);
-
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
-    DBusMessage_Guard reply_guard(reply);
-
-    // Check the reply and update our signal subscription if necessary
-    {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
-        }
-
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
-        }
-    }
-    return NFD_OKAY;
+    if (nfdresult_t res = BeginDialog(route,
+                                      params->timeoutMs,
+                                      OpenFileCounter<Multiple, Directory>(),
+                                      OpenFileKind<Multiple, Directory>());
+        res != NFD_OKAY)
+        return res;
+    const char* current_folder;
+    if (nfdresult_t res = CheckOpenFileCapabilities<Directory>(
+            params->defaultPath, route.deadline, current_folder);
+        res != NFD_OKAY)
+        return res;
+    return CallFileChooser(
+        route, "OpenFile", [&](DBusMessage* query, const char* handle_token) {
+            AppendOpenFileQueryParams<Multiple, Directory>(
+                query, handle_token, params, current_folder);
+        });
 }
 
 char* ConvertToUriPath(const char* path)
@@ -1885,9 +2966,10 @@ void AppendFileManagerParams(DBusMessage* query, const char* filePath)
     NFDi_Free(uriPath);
 }
 
-nfdresult_t NFD_DBus_FileManager(const char* path, NfdFileManagerMode mode)
+nfdresult_t NFD_DBus_FileManager(const char* path, NfdFileManagerMode mode, int timeoutMs)
 {
-    static const char* method;
+    const uint64_t deadline = DeadlineAfter(timeoutMs);
+    const char* method;
     if (mode == NFD_FM_OPEN_FOLDER)
         method = "ShowFolders";
     else if (mode == NFD_FM_SELECT_FILE)
@@ -1896,6 +2978,15 @@ nfdresult_t NFD_DBus_FileManager(const char* path, NfdFileManagerMode mode)
         NFDi_SetError("invalid NfdFileManagerMode");
         return NFD_ERROR;
     }
+    if (nfdresult_t res = EnsureConnection(); res != NFD_OKAY) return res;
+    // Fail fast instead of waiting for the bus to tell us that nobody implements FileManager1
+    const PortalCapabilities* probed = GetCapabilities(deadline);
+    if (!probed) return NFD_TIMEOUT;
+    if (!probed->fileManagerAvailable) {
+        NFDi_SetError("No file manager provides org.freedesktop.FileManager1 on the session bus.",
+                      ErrorKind::DBus);
+        return NFD_ERROR;
+    }
 
     DBusError err;  // need a separate error object because we don't want to mess with the old one
     // if it's still set
@@ -1910,14 +3001,11 @@ nfdresult_t NFD_DBus_FileManager(const char* path, NfdFileManagerMode mode)
     DBusMessage_Guard query_guard(query);
     AppendFileManagerParams(query, path);
 
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
+    NFD_PROBE(method_call, dbus_message_get_member(query));
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(
+        dbus_conn, query, DBusTimeoutUntil(deadline), &err);
+    NFD_PROBE(method_reply, dbus_message_get_member(query), reply != nullptr);
+    if (!reply) return MethodCallFailed(err, deadline);
     dbus_message_unref(reply);
     return NFD_OKAY;
 }
@@ -1925,27 +3013,13 @@ nfdresult_t NFD_DBus_FileManager(const char* path, NfdFileManagerMode mode)
 template <bool Multiple, bool Directory>
 nfdresult_t NFD_DBus_OpenFileWin(DBusMessage*& outMsg, NfdDialogParams* params)
 {
-    if (auto res = NFD_DBus_ShowOpenFileDialog<Multiple, Directory>(params); res != NFD_OKAY)
+    ResponseRoute route{};
+    ResponseRoute_Guard route_guard(route);
+    if (auto res = NFD_DBus_ShowOpenFileDialog<Multiple, Directory>(params, route);
+        res != NFD_OKAY)
         return res;
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
-
-            if (dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
-            }
-
-            dbus_message_unref(msg);
-        }
-    } while (dbus_connection_read_write(dbus_conn, -1));
-
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+    // Wait for the response
+    return WaitForResponse(route, outMsg);
 }
 
 // DBus wrapper function that helps invoke the portal for the SaveFile() API.
@@ -1957,162 +3031,44 @@ nfdresult_t NFD_DBus_SaveFile(DBusMessage*& outMsg,
                               nfdfiltersize_t filterCount,
                               const nfdnchar_t* defaultPath,
                               const nfdnchar_t* defaultName) {
-    const char* handle_token_ptr;
-    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
-    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
-
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-    // if it's stil set
-    dbus_error_init(&err);
-
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
-    if (res != NFD_OKAY) return res;
-
-    // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
-    // Wayland?
-
-    DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
-                                                      "/org/freedesktop/portal/desktop",
-                                                      "org.freedesktop.portal.FileChooser",
-                                                      "SaveFile");
-    DBusMessage_Guard query_guard(query);
-    AppendSaveFileQueryParams(
-        query, handle_token_ptr, filterList, filterCount, defaultPath, defaultName);
-
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
-    DBusMessage_Guard reply_guard(reply);
-
-    // Check the reply and update our signal subscription if necessary
-    {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
-        }
-
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
-        }
-    }
-
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
-
-            if (dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
-            }
-
-            dbus_message_unref(msg);
-        }
-    } while (dbus_connection_read_write(dbus_conn, -1));
+    ResponseRoute route{};
+    ResponseRoute_Guard route_guard(route);
+    if (nfdresult_t res = BeginDialog(route, 0, &NfdStats::saveDialogs, "save"); res != NFD_OKAY)
+        return res;
+    if (nfdresult_t res = CallFileChooser(
+            route,
+            "SaveFile",
+            [&](DBusMessage* query, const char* handle_token) {
+                AppendSaveFileQueryParams(
+                    query, handle_token, filterList, filterCount, defaultPath, defaultName);
+            });
+        res != NFD_OKAY)
+        return res;
 
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+    // Wait for the response
+    return WaitForResponse(route, outMsg);
 }
 
-nfdresult_t NFD_DBus_ShowSaveFileDialog(NfdDialogParams* params)
+nfdresult_t NFD_DBus_ShowSaveFileDialog(NfdDialogParams* params, ResponseRoute& route)
 {
-    const char* handle_token_ptr;
-    char* handle_obj_path = MakeUniqueObjectPath(&handle_token_ptr);
-    Free_Guard<char> handle_obj_path_guard(handle_obj_path);
-
-    DBusError err;  // need a separate error object because we don't want to mess with the old one
-    // if it's stil set
-    dbus_error_init(&err);
-
-    // Subscribe to the signal using the handle_obj_path
-    DBusSignalSubscriptionHandler signal_sub;
-    nfdresult_t res = signal_sub.Subscribe(handle_obj_path);
-    if (res != NFD_OKAY) return res;
-
-    // TODO: use XOpenDisplay()/XGetInputFocus() to find xid of window... but what should one do on
-    // Wayland?
-
-    DBusMessage* query = dbus_message_new_method_call("org.freedesktop.portal.Desktop",
-                                                      "/org/freedesktop/portal/desktop",
-                                                      "org.freedesktop.portal.FileChooser",
-                                                      "SaveFile");
-    DBusMessage_Guard query_guard(query);
-    AppendSaveFileQueryParams(query, handle_token_ptr, params);
-
-    DBusMessage* reply =
-        dbus_connection_send_with_reply_and_block(dbus_conn, query, DBUS_TIMEOUT_INFINITE, &err);
-    if (!reply) {
-        dbus_error_free(&dbus_err);
-        dbus_move_error(&err, &dbus_err);
-        NFDi_SetError(dbus_err.message);
-        return NFD_ERROR;
-    }
-    DBusMessage_Guard reply_guard(reply);
-
-    // Check the reply and update our signal subscription if necessary
-    {
-        DBusMessageIter iter;
-        if (!dbus_message_iter_init(reply, &iter)) {
-            NFDi_SetError("D-Bus reply is missing an argument.");
-            return NFD_ERROR;
-        }
-        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH) {
-            NFDi_SetError("D-Bus reply is not an object path.");
-            return NFD_ERROR;
-        }
-
-        const char* path;
-        dbus_message_iter_get_basic(&iter, &path);
-        if (strcmp(path, handle_obj_path) != 0) {
-            // needs to change our signal subscription
-            signal_sub.Subscribe(path);
-        }
-    }
-    return NFD_OKAY;
+    if (nfdresult_t res =
+            BeginDialog(route, params->timeoutMs, &NfdStats::saveDialogs, "save");
+        res != NFD_OKAY)
+        return res;
+    return CallFileChooser(route, "SaveFile", [&](DBusMessage* query, const char* handle_token) {
+        AppendSaveFileQueryParams(query, handle_token, params);
+    });
 }
 
 nfdresult_t NFD_DBus_SaveFileWin(DBusMessage*& outMsg, NfdDialogParams* params)
 {
-    if (auto res = NFD_DBus_ShowSaveFileDialog(params); res != NFD_OKAY)
+    ResponseRoute route{};
+    ResponseRoute_Guard route_guard(route);
+    if (auto res = NFD_DBus_ShowSaveFileDialog(params, route); res != NFD_OKAY)
         return res;
 
-    // Wait and read the response
-    // const char* file = nullptr;
-    do {
-        while (true) {
-            DBusMessage* msg = dbus_connection_pop_message(dbus_conn);
-            if (!msg) break;
-
-            if (dbus_message_is_signal(msg, "org.freedesktop.portal.Request", "Response")) {
-                // this is the response we're looking for
-                outMsg = msg;
-                return NFD_OKAY;
-            }
-
-            dbus_message_unref(msg);
-        }
-    } while (dbus_connection_read_write(dbus_conn, -1));
-
-    NFDi_SetError("D-Bus freedesktop portal did not give us a reply.");
-    return NFD_ERROR;
+    // Wait for the response
+    return WaitForResponse(route, outMsg);
 }
 
 const char* formatRealpathError()
@@ -2138,6 +3094,51 @@ const char* formatRealpathError()
     }
 }
 
+// Takes a reference for NFD_Init() (if `shared_conn` is null) or NFD_InitWithConnection().
+nfdresult_t Init(DBusConnection* shared_conn) {
+    // Make libdbus lock its connections and global state, since dialogs may be shown from any
+    // thread (and async dialogs are completed by the dispatcher thread)
+    if (!dbus_threads_init_default()) {
+        NFDi_SetError("Unable to initialize D-Bus thread support.");
+        return NFD_ERROR;
+    }
+    Mutex_Guard conn_guard(&conn_mutex);
+    // Start capturing if requested by the environment, unless NFD_SetTraceFile() took over
+    if (!trace_env_checked) {
+        trace_env_checked = true;
+        const char* trace_path = getenv(TRACE_ENV_VAR);
+        if (trace_path && *trace_path && OpenTraceFile(trace_path) != NFD_OKAY) return NFD_ERROR;
+    }
+    if (dbus_conn && dbus_conn_pid != getpid()) {
+        // inherited across fork(); the parent still uses the socket, so just forget it
+        ForgetConnectionLocked(false);
+    }
+    if (dbus_conn && init_count == 0 && !dbus_connection_get_is_connected(dbus_conn)) {
+        // the bus went away while nobody was using the connection, so reconnect on first use
+        ForgetConnectionLocked(true);
+    }
+    if (shared_conn && shared_conn != dbus_conn) {
+        if (init_count != 0) {
+            NFDi_SetError("NFD is already initialized with another D-Bus connection.");
+            return NFD_ERROR;
+        }
+        const char* unique_name = dbus_bus_get_unique_name(shared_conn);
+        if (!unique_name) {
+            NFDi_SetError("The D-Bus connection is not registered with the bus.");
+            return NFD_ERROR;
+        }
+        // our own connection is idle, since nobody has called NFD_Init()
+        if (dbus_conn) ForgetConnectionLocked(true);
+        dbus_conn = dbus_connection_ref(shared_conn);
+        dbus_conn_pid = getpid();
+        dbus_unique_name = unique_name;
+        dbus_conn_shared = true;
+    }
+    // otherwise the connection is opened by the first dialog (see EnsureConnection)
+    ++init_count;
+    return NFD_OKAY;
+}
+
 }  // namespace
 
 /* public */
@@ -2148,33 +3149,144 @@ const char* NFD_GetError(void) {
 
 void NFD_ClearError(void) {
     NFDi_SetError(nullptr);
-    dbus_error_free(&dbus_err);
+    dbus_error_free(&dbus_err.err);
 }
 
-nfdresult_t NFD_Init(void) {
-    // Initialize dbus_error
-    dbus_error_init(&dbus_err);
-    // Get DBus connection
-    dbus_conn = dbus_bus_get_private(DBUS_BUS_SESSION, &dbus_err);
-    if (!dbus_conn) {
-        NFDi_SetError(dbus_err.message);
+nfdresult_t NFD_GetStats(NfdStats* out) {
+#ifndef NFD_DISABLE_STATS
+    static_assert(sizeof(NfdStats) % sizeof(uint64_t) == 0, "NfdStats must only hold uint64_t");
+    const uint64_t* src = reinterpret_cast<const uint64_t*>(&stats);
+    uint64_t* dest = reinterpret_cast<uint64_t*>(out);
+    for (size_t i = 0; i != sizeof(NfdStats) / sizeof(uint64_t); ++i)
+        dest[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    return NFD_OKAY;
+#else
+    *out = {};
+    NFDi_SetError("NFD was built with NFD_DISABLE_STATS.");
+    return NFD_ERROR;
+#endif
+}
+
+void NFD_ResetStats(void) {
+#ifndef NFD_DISABLE_STATS
+    uint64_t* counters = reinterpret_cast<uint64_t*>(&stats);
+    for (size_t i = 0; i != sizeof(NfdStats) / sizeof(uint64_t); ++i)
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+#endif
+}
+
+void NFD_SetTimeout(int timeoutMs) {
+    __atomic_store_n(&default_timeout_ms, timeoutMs > 0 ? timeoutMs : 0, __ATOMIC_RELAXED);
+}
+
+nfdresult_t NFD_GetPollDescriptors(int outFds[NFD_POLL_DESCRIPTORS]) {
+    if (nfdresult_t res = EnsureConnection(); res != NFD_OKAY) return res;
+    pthread_mutex_lock(&route_mutex);
+    nfdresult_t res;
+    if (dispatcher_running && !host_dispatch) {
+        NFDi_SetError("NFD_GetPollDescriptors must be called before the first dialog.");
+        res = NFD_ERROR;
+    } else {
+        host_dispatch = true;
+        res = StartDispatcherLocked();
+        if (res != NFD_OKAY) host_dispatch = false;
+    }
+    if (res == NFD_OKAY) {
+        dbus_connection_get_unix_fd(dbus_conn, &outFds[0]);
+        outFds[1] = dispatcher_wake_fds[0];
+    }
+    pthread_mutex_unlock(&route_mutex);
+    return res;
+}
+
+nfdresult_t NFD_Dispatch(void) {
+    pthread_mutex_lock(&route_mutex);
+    const bool driven_by_host = dispatcher_running && host_dispatch;
+    pthread_mutex_unlock(&route_mutex);
+    if (!driven_by_host) {
+        NFDi_SetError("NFD_GetPollDescriptors has not been called.");
+        return NFD_ERROR;
+    }
+    if (!DispatchOnce()) {
+        NFDi_SetError("The D-Bus connection was lost.", ErrorKind::DBus);
+        return NFD_ERROR;
+    }
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_SetTraceFile(const char* path) {
+    {
+        Mutex_Guard conn_guard(&conn_mutex);
+        trace_env_checked = true;
+    }
+    return OpenTraceFile(path);
+}
+
+nfdresult_t NFD_GetLastTimings(NfdDialogTimings* timings) {
+    if (!last_timings.start) {
+        NFDi_SetError("No dialog has been shown yet.");
         return NFD_ERROR;
     }
-    dbus_connection_set_exit_on_disconnect(dbus_conn, false);
-    dbus_unique_name = dbus_bus_get_unique_name(dbus_conn);
-    if (!dbus_unique_name) {
-        NFDi_SetError("Unable to get the unique name of our D-Bus connection.");
+    *timings = last_timings;
+    return NFD_OKAY;
+}
+
+nfdresult_t NFD_Init(void) {
+    return Init(nullptr);
+}
+
+nfdresult_t NFD_InitWithConnection(void* connection) {
+    if (!connection) {
+        NFDi_SetError("The D-Bus connection is null.");
         return NFD_ERROR;
     }
+    return Init(static_cast<DBusConnection*>(connection));
+}
 
+nfdresult_t NFD_Prewarm(void) {
+    {
+        Mutex_Guard conn_guard(&conn_mutex);
+        if (init_count == 0) {
+            NFDi_SetError("NFD_Init() has not been called.");
+            return NFD_ERROR;
+        }
+        if (prewarm_started) return NFD_OKAY;
+        prewarm_started = true;
+        // keep the connection ours until the thread is done with it
+        ++init_count;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    const int err = pthread_create(&thread, &attr, Prewarm, nullptr);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        NFDi_SetError("pthread_create failed");
+        {
+            Mutex_Guard conn_guard(&conn_mutex);
+            prewarm_started = false;
+        }
+        NFD_Quit();
+        return NFD_ERROR;
+    }
     return NFD_OKAY;
 }
 void NFD_Quit(void) {
-    dbus_connection_close(dbus_conn);
-    dbus_connection_unref(dbus_conn);
-    // Note: We do not free dbus_error since NFD_Init might set it.
-    // To avoid leaking memory, the caller should explicitly call NFD_ClearError after reading the
-    // error.
+    DispatcherThread* stopped_dispatcher;
+    {
+        Mutex_Guard conn_guard(&conn_mutex);
+        if (init_count == 0 || --init_count != 0) return;
+        // async dialogs that are still open complete with an error; our own connection is kept for
+        // the next NFD_Init(), but the application's is handed back
+        stopped_dispatcher = StopDispatcherLocked();
+        if (dbus_conn_shared) ForgetConnectionLocked(true);
+    }
+    // without `conn_mutex`, so that the callbacks (and the dispatcher, which may be running one) can
+    // call NFD_Init()
+    JoinDispatcher(stopped_dispatcher);
+    RunCompletions();
+    // Note: the error of this thread is freed when the thread exits, or by NFD_ClearError().
 }
 
 void NFD_FreePathN(nfdnchar_t* filePath) {
@@ -2185,11 +3297,11 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
                             const nfdnfilteritem_t* filterList,
                             nfdfiltersize_t filterCount,
                             const nfdnchar_t* defaultPath) {
-    (void)defaultPath;  // Default path not supported for portal backend
 
     DBusMessage* msg;
     {
-        const nfdresult_t res = NFD_DBus_OpenFile<false, false>(msg, filterList, filterCount);
+        const nfdresult_t res =
+            NFD_DBus_OpenFile<false, false>(msg, filterList, filterCount, defaultPath);
         if (res != NFD_OKAY) {
             return res;
         }
@@ -2204,23 +3316,16 @@ nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    return EndTimings(AllocAndCopyFilePath(uri, *outPath));
 }
 
 nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params)
 {
-    (void)params->defaultPath;  // Default path not supported for portal backend
     if (params->outAsyncOpHandle)
     {
-        nfdresult_t res = NFD_DBus_ShowOpenFileDialog<false, false>(params);
-        if (res != NFD_OKAY)
-            return res;
-        NfdDialogMonitor* monitor = NfdDialogMonitor::create<false>();
-        if (!monitor)
-            return NFD_ERROR;
-        *params->outAsyncOpHandle = monitor;
-
-        return NFD_OKAY;
+        return ShowAsyncDialog<false>(params, [params](ResponseRoute& route) {
+            return NFD_DBus_ShowOpenFileDialog<false, false>(params, route);
+        });
     }
     else
     {
@@ -2241,30 +3346,23 @@ nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params)
             }
         }
 
-        return AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize);
+        return EndTimings(AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize));
     }
 }
 
 nfdresult_t NFD_PickFolderWin(NfdDialogParams* params)
 {
-    (void)params->defaultPath;  // Default path not supported for portal backend
     if (params->outAsyncOpHandle)
     {
-        nfdresult_t res = NFD_DBus_ShowOpenFileDialog<false, true>(params);
-        if (res != NFD_OKAY)
-            return res;
-        NfdDialogMonitor* monitor = NfdDialogMonitor::create<false>();
-        if (!monitor)
-            return NFD_ERROR;
-        *params->outAsyncOpHandle = monitor;
-
-        return NFD_OKAY;
+        return ShowAsyncDialog<false>(params, [params](ResponseRoute& route) {
+            return NFD_DBus_ShowOpenFileDialog<false, true>(params, route);
+        });
     }
     else
     {
         DBusMessage* msg;
         {
-            const nfdresult_t res = NFD_DBus_OpenFileWin<false, false>(msg, params);
+            const nfdresult_t res = NFD_DBus_OpenFileWin<false, true>(msg, params);
             if (res != NFD_OKAY) {
                 return res;
             }
@@ -2279,7 +3377,7 @@ nfdresult_t NFD_PickFolderWin(NfdDialogParams* params)
             }
         }
 
-        return AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize);
+        return EndTimings(AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize));
     }
 }
 
@@ -2291,32 +3389,25 @@ nfdresult_t NFD_OpenFileManager(NfdFileManagerParams* params)
             NFDi_SetError(formatRealpathError());
             return NFD_ERROR;
         }
-        auto ret = NFD_DBus_FileManager(path, params->mode);
+        auto ret = NFD_DBus_FileManager(path, params->mode, params->timeoutMs);
 
         free(path);
 
         return ret;
     }
     else
-        return NFD_DBus_FileManager(params->filePath, params->mode);
+        return NFD_DBus_FileManager(params->filePath, params->mode, params->timeoutMs);
 
 }
 
 nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params)
 {
-    (void)params->defaultPath;  // Default path not supported for portal backend
 
     if (params->outAsyncOpHandle)
     {
-        nfdresult_t res = NFD_DBus_ShowOpenFileDialog<true, false>(params);
-        if (res != NFD_OKAY)
-            return res;
-        NfdDialogMonitor* monitor = NfdDialogMonitor::create<true>();
-        if (!monitor)
-            return NFD_ERROR;
-        *params->outAsyncOpHandle = monitor;
-
-        return NFD_OKAY;
+        return ShowAsyncDialog<true>(params, [params](ResponseRoute& route) {
+            return NFD_DBus_ShowOpenFileDialog<true, false>(params, route);
+        });
     }
     else
     {
@@ -2327,53 +3418,9 @@ nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params)
                 return res;
             }
         }
+        DBusMessage_Guard msg_guard(msg);
 
-        DBusMessageIter uri_iter;
-        nfdresult_t res = ReadResponseUris(msg, uri_iter);
-        if (res != NFD_OKAY) {
-            dbus_message_unref(msg);
-            return res;
-        }
-
-        nfdpathsetsize_t numPaths;
-        NFD_PathSet_GetCount(msg, &numPaths);
-
-        int pathListSize = 256;
-        *params->outPath = NFDi_Malloc<char>(pathListSize);
-        char* curOutPath = *params->outPath;
-
-        if (numPaths == 1)
-            res = NFD_PathSet_GetPathWin<policy::FullPath>(
-                msg, 0, *params->outPath, curOutPath, pathListSize);
-        else
-            res = NFD_PathSet_GetPathWin<policy::Dirname>(
-                msg, 0, *params->outPath, curOutPath, pathListSize);
-
-        if (res != NFD_OKAY) {
-            NFDi_Free(*params->outPath);
-            *params->outPath = nullptr;
-            return NFD_ERROR;
-        }
-
-        for (nfdpathsetsize_t i = 1; i < numPaths; ++i) {
-            if (NFD_PathSet_GetPathWin<policy::Basename>(
-                    msg, i, *params->outPath, curOutPath, pathListSize) != NFD_OKAY) {
-                NFDi_Free(*params->outPath);
-                *params->outPath = nullptr;
-                return NFD_ERROR;
-            }
-        }
-
-        if (pathListSize == curOutPath - *params->outPath) {
-            ptrdiff_t offset = curOutPath - *params->outPath;
-            *params->outPath =
-                NFDi_Realloc<char>(*params->outPath, ++pathListSize);
-            curOutPath = *params->outPath + offset;
-        }
-        *curOutPath = '\0';  // double null-terminate
-        params->outPathSize = curOutPath - *params->outPath + 1;
-
-        return NFD_OKAY;
+        return EndTimings(CopyPathListWin(msg, *params->outPath, params->outPathSize));
     }
 }
 
@@ -2381,24 +3428,25 @@ nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
                                     const nfdnfilteritem_t* filterList,
                                     nfdfiltersize_t filterCount,
                                     const nfdnchar_t* defaultPath) {
-    (void)defaultPath;  // Default path not supported for portal backend
 
     DBusMessage* msg;
     {
-        const nfdresult_t res = NFD_DBus_OpenFile<true, false>(msg, filterList, filterCount);
+        const nfdresult_t res =
+            NFD_DBus_OpenFile<true, false>(msg, filterList, filterCount, defaultPath);
         if (res != NFD_OKAY) {
             return res;
         }
     }
 
     DBusMessageIter uri_iter;
-    const nfdresult_t res = ReadResponseUris(msg, uri_iter);
+    const nfdresult_t res = EndTimings(ReadResponseUris(msg, uri_iter));
     if (res != NFD_OKAY) {
         dbus_message_unref(msg);
         return res;
     }
 
     *outPaths = msg;
+    NFD_PROBE(pathset_create, msg, ReadResponseUrisUncheckedGetArraySize(msg));
     return NFD_OKAY;
 }
 
@@ -2406,15 +3454,9 @@ nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params)
 {
     if (params->outAsyncOpHandle)
     {
-        nfdresult_t res = NFD_DBus_ShowSaveFileDialog(params);
-        if (res != NFD_OKAY)
-            return res;
-        NfdDialogMonitor* monitor = NfdDialogMonitor::create<false>();
-        if (!monitor)
-            return NFD_ERROR;
-        *params->outAsyncOpHandle = monitor;
-
-        return NFD_OKAY;
+        return ShowAsyncDialog<false>(params, [params](ResponseRoute& route) {
+            return NFD_DBus_ShowSaveFileDialog(params, route);
+        });
     }
     else
     {
@@ -2437,7 +3479,7 @@ nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params)
             }
         }
 
-        return AllocAndCopyFilePathWithExtn(uri, extn, *outPath);
+        return EndTimings(AllocAndCopyFilePathWithExtn(uri, extn, *outPath));
 #else
         const char* uri;
         {
@@ -2447,7 +3489,7 @@ nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params)
             }
         }
 
-        return AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize);
+        return EndTimings(AllocAndCopyFilePath(uri, *params->outPath, &params->outPathSize));
 #endif
     }
 }
@@ -2472,9 +3514,23 @@ nfdresult_t NFD_GetAsyncOpResult(void* opHandle, NfdDialogResponse* result)
     return static_cast<NfdDialogMonitor*>(opHandle)->getDialogResult(result);
 }
 
+nfdresult_t NFD_GetAsyncOpTimings(void* opHandle, NfdDialogTimings* timings)
+{
+    if (!opHandle) {
+        NFDi_SetError("opHandle null");
+        return NFD_ERROR;
+    }
+    // assume the caller passed in the correct opHandle
+    static_cast<NfdDialogMonitor*>(opHandle)->getTimings(timings);
+    return NFD_OKAY;
+}
+
 void NFD_FreeHandle(void* opHandle)
 {
-    NFDi_Free(opHandle);
+    if (!opHandle) return;
+    NFD_PROBE(async_free, opHandle);
+    // the dialog may still be open, in which case its response is dropped
+    NfdDialogMonitor::destroy(static_cast<NfdDialogMonitor*>(opHandle));
 }
 
 nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
@@ -2502,7 +3558,7 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
         }
     }
 
-    return AllocAndCopyFilePathWithExtn(uri, extn, *outPath);
+    return EndTimings(AllocAndCopyFilePathWithExtn(uri, extn, *outPath));
 #else
     const char* uri;
     {
@@ -2512,16 +3568,15 @@ nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    return EndTimings(AllocAndCopyFilePath(uri, *outPath));
 #endif
 }
 
 nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
-    (void)defaultPath;  // Default path not supported for portal backend
 
     DBusMessage* msg;
     {
-        const nfdresult_t res = NFD_DBus_OpenFile<false, true>(msg, nullptr, 0);
+        const nfdresult_t res = NFD_DBus_OpenFile<false, true>(msg, nullptr, 0, defaultPath);
         if (res != NFD_OKAY) {
             return res;
         }
@@ -2536,7 +3591,7 @@ nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath)
         }
     }
 
-    return AllocAndCopyFilePath(uri, *outPath);
+    return EndTimings(AllocAndCopyFilePath(uri, *outPath));
 }
 
 nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
@@ -2561,7 +3616,7 @@ nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
         }
     }
     if (dbus_message_iter_get_arg_type(&uri_iter) != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+        NFDi_SetError("D-Bus response signal URI sub iter is not a string.", ErrorKind::Response);
         return NFD_ERROR;
     }
     const char* uri;
@@ -2577,6 +3632,7 @@ void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
 void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
     assert(pathSet);
     DBusMessage* msg = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(pathSet));
+    NFD_PROBE(pathset_free, msg);
     dbus_message_unref(msg);
 }
 
@@ -2599,7 +3655,7 @@ nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** out
         return NFD_OKAY;
     }
     if (arg_type != DBUS_TYPE_STRING) {
-        NFDi_SetError("D-Bus response signal URI sub iter is not a string.");
+        NFDi_SetError("D-Bus response signal URI sub iter is not a string.", ErrorKind::Response);
         return NFD_ERROR;
     }
     const char* uri;
@@ -2609,3 +3665,62 @@ nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** out
     dbus_message_iter_next(&uri_iter);
     return NFD_OKAY;
 }
+
+#ifdef NFD_BACKEND_MODULE
+namespace {
+
+// Whether a portal is running on the session bus, or can be started (it is usually D-Bus
+// activated).  Decides whether nfd_runtime.cpp uses this backend or falls back to GTK.
+int IsPortalAvailable(void) {
+    bool available;
+    return EnsureConnection() == NFD_OKAY &&
+           IsNameAvailable(STR_PORTAL_BUS_NAME, 0, available) == NFD_OKAY && available;
+}
+
+constexpr NfdBackend portal_backend = {
+    .abiVersion = NFD_BACKEND_ABI_VERSION,
+    .name = "portal",
+    .IsAvailable = IsPortalAvailable,
+    .GetError = NFD_GetError,
+    .ClearError = NFD_ClearError,
+    .Init = NFD_Init,
+    .InitWithConnection = NFD_InitWithConnection,
+    .Quit = NFD_Quit,
+    .Prewarm = NFD_Prewarm,
+    .SetTimeout = NFD_SetTimeout,
+    .GetPollDescriptors = NFD_GetPollDescriptors,
+    .Dispatch = NFD_Dispatch,
+    .FreePathN = NFD_FreePathN,
+    .OpenDialogN = NFD_OpenDialogN,
+    .OpenDialogWin = NFD_OpenDialogWin,
+    .OpenDialogMultipleWin = NFD_OpenDialogMultipleWin,
+    .SaveDialogWin = NFD_SaveDialogWin,
+    .PickFolderWin = NFD_PickFolderWin,
+    .HasAsyncOpCompleted = NFD_HasAsyncOpCompleted,
+    .GetAsyncOpResult = NFD_GetAsyncOpResult,
+    .FreeHandle = NFD_FreeHandle,
+    .GetLastTimings = NFD_GetLastTimings,
+    .GetAsyncOpTimings = NFD_GetAsyncOpTimings,
+    .GetStats = NFD_GetStats,
+    .ResetStats = NFD_ResetStats,
+    .SetTraceFile = NFD_SetTraceFile,
+    .OpenFileManager = NFD_OpenFileManager,
+    .OpenDialogMultipleN = NFD_OpenDialogMultipleN,
+    .SaveDialogN = NFD_SaveDialogN,
+    .PickFolderN = NFD_PickFolderN,
+    .PathSet_GetCount = NFD_PathSet_GetCount,
+    .PathSet_GetPathN = NFD_PathSet_GetPathN,
+    .PathSet_FreePathN = NFD_PathSet_FreePathN,
+    .PathSet_Free = NFD_PathSet_Free,
+    .PathSet_GetEnum = NFD_PathSet_GetEnum,
+    .PathSet_FreeEnum = NFD_PathSet_FreeEnum,
+    .PathSet_EnumNextN = NFD_PathSet_EnumNextN,
+    .SetDirectoryPrefetch = nullptr,
+};
+
+}  // namespace
+
+const NfdBackend* NFDi_GetBackend(void) {
+    return &portal_backend;
+}
+#endif
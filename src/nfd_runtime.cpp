@@ -0,0 +1,480 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  Run-time backend selection on Linux (-DNFD_RUNTIME_BACKEND=ON); see nfd_backend.h.
+*/
+
+/*
+The backend is chosen by the first call that needs one, rather than by NFD_Init(), so that a
+program that never shows a dialog never loads GTK (and the dozens of libraries that it pulls in) or
+libdbus:
+
+  - NFD_BACKEND=gtk or NFD_BACKEND=portal (or NFD_BACKEND=broker, if nfd is built with
+    NFD_BROKER) in the environment forces that backend.
+  - NFD_InitWithConnection() picks the portal, since the application has a bus connection.
+  - With NFD_BROKER, the broker module is used if nfd-broker is running, so that a short-lived
+    process skips connecting to the bus and probing the portal (it is not started from here; forcing
+    the broker, or a dialog of a program linked with the broker client itself, starts it).
+  - Otherwise the portal module is loaded and asked whether a portal is running on the session bus
+    (or can be started there); if not, or if there is no session bus, the GTK module is used.
+
+The choice is made once and kept for the rest of the process, across NFD_Quit() and NFD_Init().
+Settings made before it (NFD_SetTimeout(), NFD_SetDirectoryPrefetch(), NFD_SetTraceFile()) do not
+make it; they are kept and passed on to the backend once it is chosen.
+The modules are looked for in $NFD_MODULE_DIR, next to the nfd library (or the program that it is
+linked into), in the directories compiled into NFD_MODULE_DIRS, and on the library search path.
+*/
+
+#include <dlfcn.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfd.h"
+#include "nfd_backend.h"
+
+namespace {
+
+/* error of this thread that did not come from the backend (which keeps its own) */
+thread_local const char* err_ptr = nullptr;
+/* room for an error that is formatted at run time, such as the reason dlopen() failed */
+thread_local char err_buf[768];
+/* the most of a path or another error that is quoted in err_buf, which leaves room for the message
+ * around it (longer ones are cut short) */
+constexpr int err_quote_max = sizeof(err_buf) - 128;
+
+void NFDi_SetError(const char* msg) {
+    err_ptr = msg;
+}
+
+/* guards everything below */
+pthread_mutex_t backend_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* the module that was chosen, even if its NFD_Init() has failed so far */
+const NfdBackend* chosen = nullptr;
+/* the backend that calls are forwarded to, once `chosen` is initialized; never changes after it is
+ * set (with release semantics), so that readers may load it without the lock */
+const NfdBackend* backend = nullptr;
+/* NFD_Init() calls without a matching NFD_Quit(), made before `backend` was set; they are passed on
+ * to the backend when it is */
+size_t pending_inits = 0;
+/* settings made before `backend` was set, which are likewise passed on to it, so that setting them
+ * does not load a backend (or probe the bus) */
+struct PendingSettings {
+    bool timeoutSet;
+    int timeoutMs;
+    bool prefetchSet;
+    size_t prefetchMaxEntries;
+    int prefetchBudgetMs;
+    bool traceSet;
+    char* tracePath; /* owned; null to stop capturing */
+} pending_settings = {};
+
+// Loads the module of backend `name` from `dir`, or from the library search path if `dir` is null.
+// Otherwise, leaves the reason in `err_buf` and returns null.
+const NfdBackend* LoadModuleFrom(const char* dir, const char* name) {
+    char path[PATH_MAX];
+    if (dir)
+        snprintf(path, sizeof(path), "%s/libnfd_%s.so", dir, name);
+    else
+        snprintf(path, sizeof(path), "libnfd_%s.so", name);
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        snprintf(err_buf, sizeof(err_buf), "%.*s", err_quote_max, dlerror());
+        return nullptr;
+    }
+    auto getBackend =
+        reinterpret_cast<const NfdBackend* (*)(void)>(dlsym(handle, NFD_BACKEND_ENTRY_POINT));
+    const NfdBackend* module = getBackend ? getBackend() : nullptr;
+    if (!module || module->abiVersion != NFD_BACKEND_ABI_VERSION) {
+        snprintf(err_buf,
+                 sizeof(err_buf),
+                 "%.*s is not a backend module of this NFD version",
+                 err_quote_max,
+                 path);
+        dlclose(handle);
+        return nullptr;
+    }
+    // The module is never unloaded: the portal keeps its connection (and maybe a thread) after the
+    // last NFD_Quit(), and GTK cannot be de-initialized.
+    return module;
+}
+
+// Loads the module of backend `name` from the first place that has it (see the top of this file).
+// Otherwise, sets the error and returns null.
+const NfdBackend* LoadModule(const char* name) {
+    const NfdBackend* module = nullptr;
+    if (const char* dir = getenv("NFD_MODULE_DIR"); dir && *dir)
+        module = LoadModuleFrom(dir, name);
+    Dl_info info;
+    if (!module && dladdr(reinterpret_cast<void*>(&NFD_Init), &info) && info.dli_fname) {
+        char self[PATH_MAX];
+        snprintf(self, sizeof(self), "%s", info.dli_fname);
+        module = LoadModuleFrom(dirname(self), name);
+    }
+#ifdef NFD_MODULE_DIRS
+    // a ':'-separated list: the build tree, then the install location
+    for (const char* dirs = NFD_MODULE_DIRS; !module && *dirs;) {
+        const char* end = strchr(dirs, ':');
+        if (!end) end = dirs + strlen(dirs);
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%.*s", static_cast<int>(end - dirs), dirs);
+        if (*dir) module = LoadModuleFrom(dir, name);
+        dirs = *end ? end + 1 : end;
+    }
+#endif
+    if (!module) module = LoadModuleFrom(nullptr, name);
+    if (!module) {
+        char reason[sizeof(err_buf)];
+        memcpy(reason, err_buf, sizeof(reason));
+        snprintf(err_buf,
+                 sizeof(err_buf),
+                 "Unable to load the %s backend: %.*s",
+                 name,
+                 err_quote_max,
+                 reason);
+        NFDi_SetError(err_buf);
+    }
+    return module;
+}
+
+// Chooses the backend (see the top of this file), probing for a portal unless `connection` is set.
+// Must be called with backend_mutex held.
+const NfdBackend* ChooseBackendLocked(bool connection) {
+    if (const char* forced = getenv("NFD_BACKEND"); forced && *forced) {
+        // (without NFD_BROKER, there is no broker module to load, which is the error)
+        if (strcmp(forced, "gtk") != 0 && strcmp(forced, "portal") != 0 &&
+            strcmp(forced, "broker") != 0) {
+            NFDi_SetError("NFD_BACKEND must be \"gtk\", \"portal\" or \"broker\".");
+            return nullptr;
+        }
+        return LoadModule(forced);
+    }
+    if (connection) return LoadModule("portal");
+#ifdef NFD_BROKER_MODULE
+    if (const NfdBackend* broker = LoadModule("broker")) {
+        // only a connect() to its socket
+        if (broker->Init() == NFD_OKAY) {
+            const bool available = broker->IsAvailable();
+            broker->Quit();
+            if (available) return broker;
+        }
+    }
+#endif
+    if (const NfdBackend* portal = LoadModule("portal")) {
+        // the probe's connection is kept by the backend, and reused by the first dialog
+        if (portal->Init() == NFD_OKAY) {
+            const bool available = portal->IsAvailable();
+            portal->Quit();
+            if (available) return portal;
+        }
+    }
+    if (const NfdBackend* gtk = LoadModule("gtk")) return gtk;
+    char reason[sizeof(err_buf)];
+    memcpy(reason, err_buf, sizeof(reason));
+    snprintf(err_buf,
+             sizeof(err_buf),
+             "No xdg-desktop-portal is available, and there is no GTK fallback. %.*s",
+             err_quote_max,
+             reason);
+    NFDi_SetError(err_buf);
+    return nullptr;
+}
+
+// Returns the backend, choosing and initializing it first if needed, or null (with the error set).
+// Must be called with backend_mutex held.
+const NfdBackend* ActivateLocked(bool connection) {
+    if (backend) return backend;
+    if (!chosen) chosen = ChooseBackendLocked(connection);
+    if (!chosen) return nullptr;
+    // pass on the NFD_Init() calls that were made before the backend was chosen
+    for (size_t i = 0; i != pending_inits; ++i) {
+        if (chosen->Init() != NFD_OKAY) {
+            NFDi_SetError(chosen->GetError());
+            while (i--) chosen->Quit();
+            return nullptr;
+        }
+    }
+    pending_inits = 0;
+    // a backend without a setting's function ignores it, as it would have once chosen
+    PendingSettings& settings = pending_settings;
+    if (settings.timeoutSet && chosen->SetTimeout) chosen->SetTimeout(settings.timeoutMs);
+    if (settings.prefetchSet && chosen->SetDirectoryPrefetch) {
+        chosen->SetDirectoryPrefetch(settings.prefetchMaxEntries, settings.prefetchBudgetMs);
+    }
+    const bool traceFailed = settings.traceSet && chosen->SetTraceFile &&
+                             chosen->SetTraceFile(settings.tracePath) != NFD_OKAY;
+    if (traceFailed) NFDi_SetError(chosen->GetError());
+    free(settings.tracePath);
+    settings = {};
+    __atomic_store_n(&backend, chosen, __ATOMIC_RELEASE);
+    // the call that chose the backend reports that the trace file could not be opened
+    return traceFailed ? nullptr : chosen;
+}
+
+const NfdBackend* GetBackend() {
+    if (const NfdBackend* active = __atomic_load_n(&backend, __ATOMIC_ACQUIRE)) return active;
+    pthread_mutex_lock(&backend_mutex);
+    const NfdBackend* active = ActivateLocked(false);
+    pthread_mutex_unlock(&backend_mutex);
+    return active;
+}
+
+// Returns the backend's entry point `entry`, or null (with the error set) if there is no backend or
+// it does not have that function.
+template <typename Fn>
+Fn* Entry(Fn* NfdBackend::*entry) {
+    err_ptr = nullptr;
+    const NfdBackend* active = GetBackend();
+    if (!active) return nullptr;
+    Fn* fn = active->*entry;
+    if (!fn) NFDi_SetError("This function is not supported by the selected backend.");
+    return fn;
+}
+
+// Returns the backend if it has been chosen.  Otherwise, returns null with backend_mutex still held,
+// so that the caller can record a setting in pending_settings (and then unlock it).
+const NfdBackend* ChosenOrLock() {
+    err_ptr = nullptr;
+    if (const NfdBackend* active = __atomic_load_n(&backend, __ATOMIC_ACQUIRE)) return active;
+    pthread_mutex_lock(&backend_mutex);
+    if (backend) pthread_mutex_unlock(&backend_mutex);
+    return backend;
+}
+
+}  // namespace
+
+/* public */
+
+const char* NFD_GetError(void) {
+    if (err_ptr) return err_ptr;
+    const NfdBackend* active = __atomic_load_n(&backend, __ATOMIC_ACQUIRE);
+    return active ? active->GetError() : nullptr;
+}
+
+void NFD_ClearError(void) {
+    NFDi_SetError(nullptr);
+    if (const NfdBackend* active = __atomic_load_n(&backend, __ATOMIC_ACQUIRE)) active->ClearError();
+}
+
+nfdresult_t NFD_Init(void) {
+    NFDi_SetError(nullptr);
+    pthread_mutex_lock(&backend_mutex);
+    const NfdBackend* active = backend;
+    // the backend is chosen (and its libraries are loaded) by the first call that needs it
+    if (!active) ++pending_inits;
+    pthread_mutex_unlock(&backend_mutex);
+    return active ? active->Init() : NFD_OKAY;
+}
+
+nfdresult_t NFD_InitWithConnection(void* connection) {
+    NFDi_SetError(nullptr);
+    pthread_mutex_lock(&backend_mutex);
+    const NfdBackend* active = ActivateLocked(true);
+    pthread_mutex_unlock(&backend_mutex);
+    if (!active) return NFD_ERROR;
+    if (!active->InitWithConnection) {
+        NFDi_SetError("This function is not supported by the GTK backend.");
+        return NFD_ERROR;
+    }
+    return active->InitWithConnection(connection);
+}
+
+void NFD_Quit(void) {
+    pthread_mutex_lock(&backend_mutex);
+    const NfdBackend* active = backend;
+    if (!active && pending_inits) --pending_inits;
+    pthread_mutex_unlock(&backend_mutex);
+    if (active) active->Quit();
+}
+
+nfdresult_t NFD_Prewarm(void) {
+    auto fn = Entry(&NfdBackend::Prewarm);
+    return fn ? fn() : NFD_ERROR;
+}
+
+void NFD_SetTimeout(int timeoutMs) {
+    if (!ChosenOrLock()) {
+        pending_settings.timeoutSet = true;
+        pending_settings.timeoutMs = timeoutMs;
+        pthread_mutex_unlock(&backend_mutex);
+    } else if (auto fn = Entry(&NfdBackend::SetTimeout)) {
+        fn(timeoutMs);
+    }
+}
+
+void NFD_SetDirectoryPrefetch(size_t maxEntries, int budgetMs) {
+    if (!ChosenOrLock()) {
+        pending_settings.prefetchSet = true;
+        pending_settings.prefetchMaxEntries = maxEntries;
+        pending_settings.prefetchBudgetMs = budgetMs;
+        pthread_mutex_unlock(&backend_mutex);
+    } else if (auto fn = Entry(&NfdBackend::SetDirectoryPrefetch)) {
+        fn(maxEntries, budgetMs);
+    }
+}
+
+nfdresult_t NFD_GetPollDescriptors(int outFds[NFD_POLL_DESCRIPTORS]) {
+    auto fn = Entry(&NfdBackend::GetPollDescriptors);
+    return fn ? fn(outFds) : NFD_ERROR;
+}
+
+nfdresult_t NFD_Dispatch(void) {
+    auto fn = Entry(&NfdBackend::Dispatch);
+    return fn ? fn() : NFD_ERROR;
+}
+
+void NFD_FreePathN(nfdnchar_t* filePath) {
+    if (auto fn = Entry(&NfdBackend::FreePathN)) fn(filePath);
+}
+
+nfdresult_t NFD_OpenDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath) {
+    auto fn = Entry(&NfdBackend::OpenDialogN);
+    return fn ? fn(outPath, filterList, filterCount, defaultPath) : NFD_ERROR;
+}
+
+nfdresult_t NFD_OpenDialogWin(NfdDialogParams* params) {
+    auto fn = Entry(&NfdBackend::OpenDialogWin);
+    return fn ? fn(params) : NFD_ERROR;
+}
+
+nfdresult_t NFD_OpenDialogMultipleWin(NfdDialogParams* params) {
+    auto fn = Entry(&NfdBackend::OpenDialogMultipleWin);
+    return fn ? fn(params) : NFD_ERROR;
+}
+
+nfdresult_t NFD_SaveDialogWin(NfdDialogParams* params) {
+    auto fn = Entry(&NfdBackend::SaveDialogWin);
+    return fn ? fn(params) : NFD_ERROR;
+}
+
+nfdresult_t NFD_PickFolderWin(NfdDialogParams* params) {
+    auto fn = Entry(&NfdBackend::PickFolderWin);
+    return fn ? fn(params) : NFD_ERROR;
+}
+
+int NFD_HasAsyncOpCompleted(void* opHandle) {
+    auto fn = Entry(&NfdBackend::HasAsyncOpCompleted);
+    return fn ? fn(opHandle) : 0;
+}
+
+nfdresult_t NFD_GetAsyncOpResult(void* opHandle, NfdDialogResponse* result) {
+    auto fn = Entry(&NfdBackend::GetAsyncOpResult);
+    return fn ? fn(opHandle, result) : NFD_ERROR;
+}
+
+void NFD_FreeHandle(void* opHandle) {
+    if (auto fn = Entry(&NfdBackend::FreeHandle)) fn(opHandle);
+}
+
+nfdresult_t NFD_GetLastTimings(NfdDialogTimings* timings) {
+    auto fn = Entry(&NfdBackend::GetLastTimings);
+    return fn ? fn(timings) : NFD_ERROR;
+}
+
+nfdresult_t NFD_GetAsyncOpTimings(void* opHandle, NfdDialogTimings* timings) {
+    auto fn = Entry(&NfdBackend::GetAsyncOpTimings);
+    return fn ? fn(opHandle, timings) : NFD_ERROR;
+}
+
+nfdresult_t NFD_GetStats(NfdStats* stats) {
+    auto fn = Entry(&NfdBackend::GetStats);
+    if (fn) return fn(stats);
+    *stats = {};
+    return NFD_ERROR;
+}
+
+void NFD_ResetStats(void) {
+    // before a backend is chosen, there is nothing to reset
+    if (!ChosenOrLock()) {
+        pthread_mutex_unlock(&backend_mutex);
+    } else if (auto fn = Entry(&NfdBackend::ResetStats)) {
+        fn();
+    }
+}
+
+nfdresult_t NFD_SetTraceFile(const char* path) {
+    if (!ChosenOrLock()) {
+        // the file is opened when the backend is chosen, which then reports if it cannot be
+        char* copy = path ? strdup(path) : nullptr;
+        const bool copied = copy || !path;
+        if (copied) {
+            free(pending_settings.tracePath);
+            pending_settings.traceSet = true;
+            pending_settings.tracePath = copy;
+        }
+        pthread_mutex_unlock(&backend_mutex);
+        if (!copied) NFDi_SetError("Out of memory.");
+        return copied ? NFD_OKAY : NFD_ERROR;
+    }
+    auto fn = Entry(&NfdBackend::SetTraceFile);
+    return fn ? fn(path) : NFD_ERROR;
+}
+
+nfdresult_t NFD_OpenFileManager(NfdFileManagerParams* params) {
+    auto fn = Entry(&NfdBackend::OpenFileManager);
+    return fn ? fn(params) : NFD_ERROR;
+}
+
+nfdresult_t NFD_OpenDialogMultipleN(const nfdpathset_t** outPaths,
+                                    const nfdnfilteritem_t* filterList,
+                                    nfdfiltersize_t filterCount,
+                                    const nfdnchar_t* defaultPath) {
+    auto fn = Entry(&NfdBackend::OpenDialogMultipleN);
+    return fn ? fn(outPaths, filterList, filterCount, defaultPath) : NFD_ERROR;
+}
+
+nfdresult_t NFD_SaveDialogN(nfdnchar_t** outPath,
+                            const nfdnfilteritem_t* filterList,
+                            nfdfiltersize_t filterCount,
+                            const nfdnchar_t* defaultPath,
+                            const nfdnchar_t* defaultName) {
+    auto fn = Entry(&NfdBackend::SaveDialogN);
+    return fn ? fn(outPath, filterList, filterCount, defaultPath, defaultName) : NFD_ERROR;
+}
+
+nfdresult_t NFD_PickFolderN(nfdnchar_t** outPath, const nfdnchar_t* defaultPath) {
+    auto fn = Entry(&NfdBackend::PickFolderN);
+    return fn ? fn(outPath, defaultPath) : NFD_ERROR;
+}
+
+nfdresult_t NFD_PathSet_GetCount(const nfdpathset_t* pathSet, nfdpathsetsize_t* count) {
+    auto fn = Entry(&NfdBackend::PathSet_GetCount);
+    return fn ? fn(pathSet, count) : NFD_ERROR;
+}
+
+nfdresult_t NFD_PathSet_GetPathN(const nfdpathset_t* pathSet,
+                                 nfdpathsetsize_t index,
+                                 nfdnchar_t** outPath) {
+    auto fn = Entry(&NfdBackend::PathSet_GetPathN);
+    return fn ? fn(pathSet, index, outPath) : NFD_ERROR;
+}
+
+void NFD_PathSet_FreePathN(const nfdnchar_t* filePath) {
+    if (auto fn = Entry(&NfdBackend::PathSet_FreePathN)) fn(filePath);
+}
+
+void NFD_PathSet_Free(const nfdpathset_t* pathSet) {
+    if (auto fn = Entry(&NfdBackend::PathSet_Free)) fn(pathSet);
+}
+
+nfdresult_t NFD_PathSet_GetEnum(const nfdpathset_t* pathSet, nfdpathsetenum_t* outEnumerator) {
+    auto fn = Entry(&NfdBackend::PathSet_GetEnum);
+    return fn ? fn(pathSet, outEnumerator) : NFD_ERROR;
+}
+
+void NFD_PathSet_FreeEnum(nfdpathsetenum_t* enumerator) {
+    if (auto fn = Entry(&NfdBackend::PathSet_FreeEnum)) fn(enumerator);
+}
+
+nfdresult_t NFD_PathSet_EnumNextN(nfdpathsetenum_t* enumerator, nfdnchar_t** outPath) {
+    auto fn = Entry(&NfdBackend::PathSet_EnumNextN);
+    return fn ? fn(enumerator, outPath) : NFD_ERROR;
+}
@@ -32,8 +32,8 @@ struct IUnknown;  // Workaround for "combaseapi.h(229): error C2187: syntax erro
 
 namespace {
 
-/* current error */
-const char* g_errorstr = nullptr;
+/* current error of this thread */
+thread_local const char* g_errorstr = nullptr;
 
 void NFDi_SetError(const char* msg) {
     g_errorstr = msg;
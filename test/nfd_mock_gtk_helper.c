@@ -0,0 +1,190 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  A headless stand-in for nfd-gtk-helper, used to test the helper client (nfd_helper_client.cpp)
+  without GTK or a display.  The client starts it in place of the helper when NFD_GTK_HELPER is set
+  to its path; it speaks the protocol of src/nfd_helper.h, and answers every dialog at once.
+
+  The answers are scripted through environment variables (which the client passes on, so a CTest
+  case can set them together with NFD_GTK_HELPER):
+
+  NFD_MOCK_PATHS     newline-separated list of the paths that a dialog returns (default:
+                     "/tmp/nfd-mock/selected file.txt"); the dialogs that return a single path
+                     return the first one
+  NFD_MOCK_RESPONSE  0 = the user accepted, 1 = cancelled, 2 = the dialog failed (default: 0)
+  NFD_MOCK_CRASH     if set, the mock exits when it receives a dialog, without answering
+  NFD_MOCK_VERBOSE   if set, every request is logged to stderr
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "nfd.h"
+#include "nfd_helper.h"
+
+#define MAX_PATHS 64
+
+static const char* const op_names[] = {"prewarm",
+                                       "open",
+                                       "open multiple",
+                                       "save",
+                                       "pick folder",
+                                       "open (win)",
+                                       "open multiple (win)",
+                                       "save (win)",
+                                       "pick folder (win)"};
+
+static void send_response(
+    uint32_t result, uint32_t count, uint64_t size, int fd, const char* error) {
+    NfdHelperResponse response;
+    memset(&response, 0, sizeof(response));
+    response.version = NFD_HELPER_PROTOCOL_VERSION;
+    response.result = result;
+    response.count = count;
+    response.size = size;
+
+    struct iovec iov[2] = {{&response, sizeof(response)},
+                           {(void*)(error ? error : ""), error ? strlen(error) : 0}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (fd != -1) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    sendmsg(NFD_HELPER_FD, &msg, MSG_NOSIGNAL);
+}
+
+/* sends `size` bytes of `data` in a sealed memfd, as the helper does */
+static void send_paths(uint32_t count, const char* data, size_t size) {
+    int fd = memfd_create("nfd-mock-paths", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    char offset[NFD_HELPER_PATHS_OFFSET] = {0};
+    if (fd == -1 || write(fd, offset, sizeof(offset)) != (ssize_t)sizeof(offset) ||
+        write(fd, data, size) != (ssize_t)size) {
+        perror("nfd_mock_gtk_helper: memfd");
+        exit(1);
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    send_response(NFD_OKAY, count, size, fd, NULL);
+    close(fd);
+}
+
+static void log_request(const NfdHelperRequest* request, const char* strings, const char* end) {
+    const char* names[] = {"title", "default_path", "default_name", "def_ext"};
+    fprintf(stderr,
+            "nfd_mock_gtk_helper: %s",
+            request->op < sizeof(op_names) / sizeof(op_names[0]) ? op_names[request->op] : "?");
+    for (size_t i = 0; i != 4 && strings < end; ++i) {
+        if (*strings) fprintf(stderr, " %s=\"%s\"", names[i], strings);
+        strings += strlen(strings) + 1;
+    }
+    for (uint32_t i = 0; i != request->filterCount && strings < end; ++i) {
+        fprintf(stderr, " filter=\"%s\"", strings);
+        strings += strlen(strings) + 1;
+        fprintf(stderr, ":\"%s\"", strings);
+        strings += strlen(strings) + 1;
+    }
+    if (request->winFilterSize) fprintf(stderr, " win_filter_index=%u", request->filterIndex);
+    if (request->gtkFlags) fprintf(stderr, " gtk_flags=%u", request->gtkFlags);
+    fprintf(stderr, "\n");
+}
+
+static void answer(const NfdHelperRequest* request) {
+    const char* response = getenv("NFD_MOCK_RESPONSE");
+    if (response && atoi(response) == 1) {
+        send_response(NFD_CANCEL, 0, 0, -1, NULL);
+        return;
+    }
+    if (response && atoi(response) == 2) {
+        send_response(NFD_ERROR, 0, 0, -1, "Scripted helper failure");
+        return;
+    }
+
+    const char* script = getenv("NFD_MOCK_PATHS");
+    if (!script) script = "/tmp/nfd-mock/selected file.txt";
+    /* the paths, each null-terminated, then an empty string */
+    char paths[4096];
+    size_t size = 0;
+    uint32_t count = 0;
+    for (const char* ptr = script; *ptr && count != MAX_PATHS;) {
+        const char* end = strchr(ptr, '\n');
+        if (!end) end = ptr + strlen(ptr);
+        if (size + (size_t)(end - ptr) + 2 > sizeof(paths)) break;
+        memcpy(paths + size, ptr, end - ptr);
+        size += end - ptr;
+        paths[size++] = '\0';
+        ++count;
+        ptr = *end ? end + 1 : end;
+    }
+    paths[size++] = '\0';
+
+    switch (request->op) {
+        case NFD_HELPER_OPEN_MULTIPLE:
+            send_paths(count, paths, size);
+            break;
+        case NFD_HELPER_OPEN_MULTIPLE_WIN:
+            if (count > 1) {
+                /* the directory of the first path, then the name of every path */
+                char list[sizeof(paths) + 256];
+                size_t listSize = strrchr(paths, '/') - paths;
+                memcpy(list, paths, listSize);
+                list[listSize++] = '\0';
+                for (const char* path = paths; *path; path += strlen(path) + 1) {
+                    const char* name = strrchr(path, '/') + 1;
+                    memcpy(list + listSize, name, strlen(name) + 1);
+                    listSize += strlen(name) + 1;
+                }
+                list[listSize++] = '\0';
+                send_paths(count, list, listSize);
+                break;
+            }
+            /* a single path, as in the other dialogs */
+            send_paths(1, paths, strlen(paths) + 2);
+            break;
+        default:
+            /* the first path */
+            send_paths(1, paths, strlen(paths) + 1);
+            break;
+    }
+}
+
+int main(void) {
+    char* message = malloc(NFD_HELPER_MAX_MESSAGE);
+    for (;;) {
+        ssize_t size = recv(NFD_HELPER_FD, message, NFD_HELPER_MAX_MESSAGE, 0);
+        if (size == -1 && errno == EINTR) continue;
+        if (size <= 0) break;
+        NfdHelperRequest request;
+        if ((size_t)size < sizeof(request)) continue;
+        memcpy(&request, message, sizeof(request));
+        if (getenv("NFD_MOCK_VERBOSE")) {
+            log_request(&request, message + sizeof(request), message + size);
+        }
+        if (request.op == NFD_HELPER_PREWARM) continue;
+        if (getenv("NFD_MOCK_CRASH")) return 1;
+        answer(&request);
+    }
+    free(message);
+    return 0;
+}
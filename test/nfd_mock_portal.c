@@ -0,0 +1,619 @@
+/*
+  Native File Dialog Extended
+  Repository: https://github.com/btzy/nativefiledialog-extended
+  License: Zlib
+
+  A headless stand-in for xdg-desktop-portal, used to run the portal backend tests and benchmarks
+  without a desktop session.
+
+  Usage: nfd_mock_portal [--address BUS_ADDRESS] [--] COMMAND [ARGS...]
+
+  Unless --address is given, a private `dbus-daemon --session` is started first.  The mock then
+  claims org.freedesktop.portal.Desktop and org.freedesktop.FileManager1 on that bus, runs COMMAND
+  with DBUS_SESSION_BUS_ADDRESS pointing at it, answers requests until COMMAND exits, and exits
+  with the exit status of COMMAND.  If no COMMAND is given, the mock serves until it is killed.
+
+  The behaviour of the mock is scripted through environment variables (which are also inherited by
+  COMMAND, so a CTest case can set both at once):
+
+  NFD_MOCK_URIS         newline-separated list of URIs returned by OpenFile/SaveFile
+                        (default: "file:///tmp/nfd-mock/selected%20file.txt")
+  NFD_MOCK_LATENCY_MS   delay between the method reply and the Response signal (default: 0)
+  NFD_MOCK_RESPONSE     response code of the Response signal; 0 = success, 1 = cancelled by the
+                        user, 2 = ended in some other way (default: 0)
+  NFD_MOCK_ERROR        if set, OpenFile/SaveFile fail with this D-Bus error name instead
+  NFD_MOCK_NO_REPLY     if set, OpenFile/SaveFile, FileManager1 and Properties.Get calls are never
+                        answered, like by a hung portal
+  NFD_MOCK_PORTAL_VERSION
+                        the `version` property of the FileChooser interface (default: 4)
+  NFD_MOCK_NO_FILE_MANAGER
+                        if set, org.freedesktop.FileManager1 is not claimed
+  NFD_MOCK_TITLE_SCRIPT if set, each OpenFile/SaveFile call is scripted by its own dialog title,
+                        which must be of the form "CODE:LATENCY_MS:NAME"; the Response then has
+                        response code CODE, is sent after LATENCY_MS milliseconds and (on success)
+                        returns the single URI "file:///tmp/nfd-mock/NAME".  Other titles fall back
+                        to the variables above.  This lets concurrent callers tell their results
+                        apart.
+  NFD_MOCK_VERBOSE      if set, every handled request is logged to stderr
+  NFD_MOCK_DBUS_DAEMON  dbus-daemon executable to start (default: "dbus-daemon")
+*/
+
+#define _GNU_SOURCE
+
+#include <dbus/dbus.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORTAL_BUS_NAME "org.freedesktop.portal.Desktop"
+#define PORTAL_OBJECT_PATH "/org/freedesktop/portal/desktop"
+#define PORTAL_REQUEST_PREFIX "/org/freedesktop/portal/desktop/request/"
+#define FILE_CHOOSER_INTERFACE "org.freedesktop.portal.FileChooser"
+#define REQUEST_INTERFACE "org.freedesktop.portal.Request"
+#define FILE_MANAGER_NAME "org.freedesktop.FileManager1"
+#define FILE_MANAGER_PATH "/org/freedesktop/FileManager1"
+
+#define DEFAULT_URIS "file:///tmp/nfd-mock/selected%20file.txt"
+
+/* A Response signal that has been scheduled but not emitted yet. */
+typedef struct PendingResponse {
+    struct PendingResponse* next;
+    char* handle;       /* request object path */
+    char* destination;  /* unique name of the caller */
+    long long due_ms;   /* CLOCK_MONOTONIC time at which the signal is emitted */
+    dbus_uint32_t code; /* response code */
+    char* uris;         /* newline-separated URIs to return, or NULL for g_uris */
+} PendingResponse;
+
+static const char* g_uris;
+static long g_latency_ms;
+static dbus_uint32_t g_response_code;
+static const char* g_error_name;
+static dbus_uint32_t g_portal_version;
+static int g_title_script;
+static int g_verbose;
+static int g_no_file_manager;
+static int g_no_reply;
+
+static PendingResponse* g_pending;
+static int g_sigchld_pipe[2] = {-1, -1};
+
+static long long NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void Log(const char* fmt, const char* arg) {
+    if (!g_verbose) return;
+    fputs("nfd_mock_portal: ", stderr);
+    fprintf(stderr, fmt, arg);
+    fputc('\n', stderr);
+}
+
+static long EnvLong(const char* name, long fallback) {
+    const char* value = getenv(name);
+    return value && *value ? strtol(value, NULL, 10) : fallback;
+}
+
+static void OnSigchld(int sig) {
+    (void)sig;
+    const int saved_errno = errno;
+    if (write(g_sigchld_pipe[1], "c", 1) < 0) {
+        /* nothing useful can be done here */
+    }
+    errno = saved_errno;
+}
+
+/* Builds "/org/freedesktop/portal/desktop/request/SENDER/TOKEN" the same way the real portal
+ * does: the leading ':' of the sender is dropped and every '.' becomes '_'. */
+static char* MakeRequestPath(const char* sender, const char* token) {
+    if (*sender == ':') ++sender;
+    char* path = malloc(strlen(PORTAL_REQUEST_PREFIX) + strlen(sender) + 1 + strlen(token) + 1);
+    char* out = stpcpy(path, PORTAL_REQUEST_PREFIX);
+    for (; *sender; ++sender) *out++ = *sender == '.' ? '_' : *sender;
+    *out++ = '/';
+    strcpy(out, token);
+    return path;
+}
+
+/* Finds the `name` entry in the a{sv} options of an OpenFile/SaveFile call, and points
+ * `variant_iter` into its value; returns 0 if there is no such entry. */
+static int FindOption(DBusMessage* msg, const char* name, DBusMessageIter* variant_iter) {
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(msg, &iter)) return 0;
+    /* skip the parent window and the title */
+    if (!dbus_message_iter_next(&iter) || !dbus_message_iter_next(&iter)) return 0;
+    if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) return 0;
+    DBusMessageIter dict_iter;
+    dbus_message_iter_recurse(&iter, &dict_iter);
+    while (dbus_message_iter_get_arg_type(&dict_iter) == DBUS_TYPE_DICT_ENTRY) {
+        DBusMessageIter entry_iter;
+        dbus_message_iter_recurse(&dict_iter, &entry_iter);
+        const char* key;
+        dbus_message_iter_get_basic(&entry_iter, &key);
+        if (strcmp(key, name) == 0 && dbus_message_iter_next(&entry_iter)) {
+            dbus_message_iter_recurse(&entry_iter, variant_iter);
+            return 1;
+        }
+        dbus_message_iter_next(&dict_iter);
+    }
+    return 0;
+}
+
+/* Finds the "handle_token" option of an OpenFile/SaveFile call. */
+static const char* ReadHandleToken(DBusMessage* msg) {
+    DBusMessageIter variant_iter;
+    if (!FindOption(msg, "handle_token", &variant_iter) ||
+        dbus_message_iter_get_arg_type(&variant_iter) != DBUS_TYPE_STRING)
+        return NULL;
+    const char* token;
+    dbus_message_iter_get_basic(&variant_iter, &token);
+    return token;
+}
+
+/* Logs the "current_folder" option (a null-terminated byte array) of an OpenFile/SaveFile call. */
+static void LogCurrentFolder(DBusMessage* msg) {
+    DBusMessageIter variant_iter;
+    if (!g_verbose || !FindOption(msg, "current_folder", &variant_iter) ||
+        dbus_message_iter_get_arg_type(&variant_iter) != DBUS_TYPE_ARRAY)
+        return;
+    DBusMessageIter array_iter;
+    dbus_message_iter_recurse(&variant_iter, &array_iter);
+    const char* folder;
+    int length;
+    dbus_message_iter_get_fixed_array(&array_iter, &folder, &length);
+    if (length > 0 && folder[length - 1] == '\0') Log("current_folder %s", folder);
+}
+
+/* Logs the names of the "filters" and the "current_filter" options of an OpenFile/SaveFile call. */
+static void LogFilters(DBusMessage* msg) {
+    DBusMessageIter variant_iter;
+    DBusMessageIter struct_iter;
+    const char* name;
+    if (!g_verbose) return;
+    if (FindOption(msg, "filters", &variant_iter) &&
+        dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_ARRAY) {
+        DBusMessageIter array_iter;
+        dbus_message_iter_recurse(&variant_iter, &array_iter);
+        while (dbus_message_iter_get_arg_type(&array_iter) == DBUS_TYPE_STRUCT) {
+            dbus_message_iter_recurse(&array_iter, &struct_iter);
+            dbus_message_iter_get_basic(&struct_iter, &name);
+            Log("filter %s", name);
+            dbus_message_iter_next(&array_iter);
+        }
+    }
+    if (FindOption(msg, "current_filter", &variant_iter) &&
+        dbus_message_iter_get_arg_type(&variant_iter) == DBUS_TYPE_STRUCT) {
+        dbus_message_iter_recurse(&variant_iter, &struct_iter);
+        dbus_message_iter_get_basic(&struct_iter, &name);
+        Log("current_filter %s", name);
+    }
+}
+
+/* Returns the title (the second argument) of an OpenFile/SaveFile call. */
+static const char* ReadTitle(DBusMessage* msg) {
+    DBusMessageIter iter;
+    if (!dbus_message_iter_init(msg, &iter) || !dbus_message_iter_next(&iter)) return NULL;
+    if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING) return NULL;
+    const char* title;
+    dbus_message_iter_get_basic(&iter, &title);
+    return title;
+}
+
+/* Applies a "CODE:LATENCY_MS:NAME" title script to `pending`; returns 0 if `title` is not one. */
+static int ApplyTitleScript(PendingResponse* pending, const char* title) {
+    char* end;
+    const unsigned long code = strtoul(title, &end, 10);
+    if (end == title || *end != ':') return 0;
+    const char* latency_str = end + 1;
+    const long latency_ms = strtol(latency_str, &end, 10);
+    if (end == latency_str || *end != ':' || latency_ms < 0) return 0;
+    const char* name = end + 1;
+    pending->code = (dbus_uint32_t)code;
+    pending->due_ms = NowMs() + latency_ms;
+    pending->uris = malloc(strlen("file:///tmp/nfd-mock/") + strlen(name) + 1);
+    strcpy(stpcpy(pending->uris, "file:///tmp/nfd-mock/"), name);
+    return 1;
+}
+
+static void AppendUris(DBusMessageIter* results_iter, const char* uris) {
+    DBusMessageIter entry_iter;
+    DBusMessageIter variant_iter;
+    DBusMessageIter array_iter;
+    const char* key = "uris";
+    dbus_message_iter_open_container(results_iter, DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter);
+    dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry_iter, DBUS_TYPE_VARIANT, "as", &variant_iter);
+    dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "s", &array_iter);
+    const char* begin = uris;
+    while (*begin) {
+        const char* end = strchr(begin, '\n');
+        if (!end) end = begin + strlen(begin);
+        if (end != begin) {
+            char* uri = strndup(begin, end - begin);
+            dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING, &uri);
+            free(uri);
+        }
+        begin = *end ? end + 1 : end;
+    }
+    dbus_message_iter_close_container(&variant_iter, &array_iter);
+    dbus_message_iter_close_container(&entry_iter, &variant_iter);
+    dbus_message_iter_close_container(results_iter, &entry_iter);
+}
+
+static void EmitResponse(DBusConnection* conn, const PendingResponse* pending) {
+    DBusMessage* signal =
+        dbus_message_new_signal(pending->handle, REQUEST_INTERFACE, "Response");
+    dbus_message_set_destination(signal, pending->destination);
+    DBusMessageIter iter;
+    DBusMessageIter results_iter;
+    dbus_message_iter_init_append(signal, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &pending->code);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &results_iter);
+    if (pending->code == 0) AppendUris(&results_iter, pending->uris ? pending->uris : g_uris);
+    dbus_message_iter_close_container(&iter, &results_iter);
+    dbus_connection_send(conn, signal, NULL);
+    dbus_message_unref(signal);
+    Log("emitted Response on %s", pending->handle);
+}
+
+static void FreePending(PendingResponse* pending) {
+    free(pending->handle);
+    free(pending->destination);
+    free(pending->uris);
+    free(pending);
+}
+
+static void EmitDueResponses(DBusConnection* conn) {
+    const long long now = NowMs();
+    PendingResponse** link = &g_pending;
+    while (*link) {
+        PendingResponse* pending = *link;
+        if (pending->due_ms <= now) {
+            EmitResponse(conn, pending);
+            *link = pending->next;
+            FreePending(pending);
+        } else {
+            link = &pending->next;
+        }
+    }
+    dbus_connection_flush(conn);
+}
+
+/* Returns the poll() timeout until the next scheduled Response, or -1 if there is none. */
+static int NextResponseTimeout(void) {
+    if (!g_pending) return -1;
+    long long due = g_pending->due_ms;
+    for (const PendingResponse* p = g_pending->next; p; p = p->next) {
+        if (p->due_ms < due) due = p->due_ms;
+    }
+    const long long timeout = due - NowMs();
+    return timeout > 0 ? (int)timeout : 0;
+}
+
+static void HandleFileChooser(DBusConnection* conn, DBusMessage* msg) {
+    Log("%s called", dbus_message_get_member(msg));
+    LogCurrentFolder(msg);
+    LogFilters(msg);
+    if (g_no_reply) return;
+    if (g_error_name) {
+        DBusMessage* error = dbus_message_new_error(msg, g_error_name, "Scripted mock failure");
+        dbus_connection_send(conn, error, NULL);
+        dbus_message_unref(error);
+        return;
+    }
+    const char* token = ReadHandleToken(msg);
+    if (!token) token = "nfd_mock_token";
+    const char* sender = dbus_message_get_sender(msg);
+    char* handle = MakeRequestPath(sender, token);
+
+    DBusMessage* reply = dbus_message_new_method_return(msg);
+    dbus_message_append_args(reply, DBUS_TYPE_OBJECT_PATH, &handle, DBUS_TYPE_INVALID);
+    dbus_connection_send(conn, reply, NULL);
+    dbus_message_unref(reply);
+
+    PendingResponse* pending = malloc(sizeof(PendingResponse));
+    pending->handle = handle;
+    pending->destination = strdup(sender);
+    pending->due_ms = NowMs() + g_latency_ms;
+    pending->code = g_response_code;
+    pending->uris = NULL;
+    if (g_title_script) {
+        const char* title = ReadTitle(msg);
+        if (title) ApplyTitleScript(pending, title);
+    }
+    pending->next = g_pending;
+    g_pending = pending;
+}
+
+/* Closes the request that `msg` (a Request.Close call) is addressed to: its Response is not sent. */
+static void HandleRequestClose(DBusConnection* conn, DBusMessage* msg) {
+    const char* handle = dbus_message_get_path(msg);
+    Log("Close called on %s", handle);
+    for (PendingResponse** link = &g_pending; *link; link = &(*link)->next) {
+        PendingResponse* pending = *link;
+        if (strcmp(pending->handle, handle) == 0) {
+            *link = pending->next;
+            FreePending(pending);
+            break;
+        }
+    }
+    if (!dbus_message_get_no_reply(msg)) {
+        DBusMessage* reply = dbus_message_new_method_return(msg);
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+    }
+}
+
+static void HandleFileManager(DBusConnection* conn, DBusMessage* msg) {
+    DBusMessageIter iter;
+    if (dbus_message_iter_init(msg, &iter) &&
+        dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
+        DBusMessageIter uri_iter;
+        dbus_message_iter_recurse(&iter, &uri_iter);
+        while (dbus_message_iter_get_arg_type(&uri_iter) == DBUS_TYPE_STRING) {
+            const char* uri;
+            dbus_message_iter_get_basic(&uri_iter, &uri);
+            Log("FileManager1 asked to show %s", uri);
+            dbus_message_iter_next(&uri_iter);
+        }
+    }
+    if (g_no_reply) return;
+    DBusMessage* reply = dbus_message_new_method_return(msg);
+    dbus_connection_send(conn, reply, NULL);
+    dbus_message_unref(reply);
+}
+
+/* Answers org.freedesktop.DBus.Properties.Get for the `version` property of the FileChooser. */
+static void HandlePropertiesGet(DBusConnection* conn, DBusMessage* msg) {
+    const char* interface;
+    const char* property;
+    DBusMessage* reply;
+    if (dbus_message_get_args(msg,
+                              NULL,
+                              DBUS_TYPE_STRING,
+                              &interface,
+                              DBUS_TYPE_STRING,
+                              &property,
+                              DBUS_TYPE_INVALID) &&
+        strcmp(interface, FILE_CHOOSER_INTERFACE) == 0 && strcmp(property, "version") == 0) {
+        Log("%s version requested", interface);
+        if (g_no_reply) return;
+        reply = dbus_message_new_method_return(msg);
+        DBusMessageIter iter;
+        DBusMessageIter variant_iter;
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_VARIANT, "u", &variant_iter);
+        dbus_message_iter_append_basic(&variant_iter, DBUS_TYPE_UINT32, &g_portal_version);
+        dbus_message_iter_close_container(&iter, &variant_iter);
+    } else {
+        reply = dbus_message_new_error(
+            msg, "org.freedesktop.DBus.Error.InvalidArgs", "No such property");
+    }
+    dbus_connection_send(conn, reply, NULL);
+    dbus_message_unref(reply);
+}
+
+static DBusHandlerResult HandleMessage(DBusConnection* conn, DBusMessage* msg, void* data) {
+    (void)data;
+    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (dbus_message_is_method_call(msg, FILE_CHOOSER_INTERFACE, "OpenFile") ||
+        dbus_message_is_method_call(msg, FILE_CHOOSER_INTERFACE, "SaveFile")) {
+        HandleFileChooser(conn, msg);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_is_method_call(msg, REQUEST_INTERFACE, "Close")) {
+        HandleRequestClose(conn, msg);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_is_method_call(msg, DBUS_INTERFACE_PROPERTIES, "Get") &&
+        dbus_message_has_path(msg, PORTAL_OBJECT_PATH)) {
+        HandlePropertiesGet(conn, msg);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    if (dbus_message_has_interface(msg, FILE_MANAGER_NAME)) {
+        HandleFileManager(conn, msg);
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/* Starts a private bus daemon and returns its address, or NULL on failure. */
+static char* StartBusDaemon(pid_t* out_pid) {
+    int address_pipe[2];
+    if (pipe(address_pipe) != 0) return NULL;
+    const char* daemon = getenv("NFD_MOCK_DBUS_DAEMON");
+    if (!daemon || !*daemon) daemon = "dbus-daemon";
+
+    const pid_t pid = fork();
+    if (pid < 0) return NULL;
+    if (pid == 0) {
+        close(address_pipe[0]);
+        char print_address[32];
+        snprintf(print_address, sizeof(print_address), "--print-address=%d", address_pipe[1]);
+        execlp(daemon, daemon, "--session", "--nofork", "--nopidfile", print_address, (char*)NULL);
+        perror("nfd_mock_portal: unable to start dbus-daemon");
+        _exit(127);
+    }
+    close(address_pipe[1]);
+
+    char* address = malloc(1024);
+    size_t len = 0;
+    while (len < 1023) {
+        const ssize_t res = read(address_pipe[0], address + len, 1023 - len);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) break;
+        len += res;
+        if (address[len - 1] == '\n') break;
+    }
+    close(address_pipe[0]);
+    while (len && (address[len - 1] == '\n' || address[len - 1] == '\r')) --len;
+    address[len] = '\0';
+    if (!len) {
+        free(address);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return NULL;
+    }
+    *out_pid = pid;
+    return address;
+}
+
+static int ClaimName(DBusConnection* conn, const char* name) {
+    DBusError err;
+    dbus_error_init(&err);
+    const int res = dbus_bus_request_name(conn, name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+    if (res != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr,
+                "nfd_mock_portal: unable to own %s: %s\n",
+                name,
+                dbus_error_is_set(&err) ? err.message : "name already taken");
+        dbus_error_free(&err);
+        return 0;
+    }
+    return 1;
+}
+
+/* Returns the exit status of the child in the same form as a shell would. */
+static int ExitStatusOf(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const char* address_arg = NULL;
+    int argi = 1;
+    while (argi < argc) {
+        if (strcmp(argv[argi], "--address") == 0 && argi + 1 < argc) {
+            address_arg = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--") == 0) {
+            ++argi;
+            break;
+        } else {
+            break;
+        }
+    }
+    char** command = argv + argi;
+
+    g_uris = getenv("NFD_MOCK_URIS");
+    if (!g_uris) g_uris = DEFAULT_URIS;
+    g_latency_ms = EnvLong("NFD_MOCK_LATENCY_MS", 0);
+    g_response_code = (dbus_uint32_t)EnvLong("NFD_MOCK_RESPONSE", 0);
+    g_portal_version = (dbus_uint32_t)EnvLong("NFD_MOCK_PORTAL_VERSION", 4);
+    g_error_name = getenv("NFD_MOCK_ERROR");
+    if (g_error_name && !*g_error_name) g_error_name = NULL;
+    g_title_script = getenv("NFD_MOCK_TITLE_SCRIPT") != NULL;
+    g_verbose = getenv("NFD_MOCK_VERBOSE") != NULL;
+    g_no_file_manager = getenv("NFD_MOCK_NO_FILE_MANAGER") != NULL;
+    g_no_reply = getenv("NFD_MOCK_NO_REPLY") != NULL;
+
+    pid_t daemon_pid = 0;
+    char* address;
+    if (address_arg) {
+        address = strdup(address_arg);
+    } else {
+        address = StartBusDaemon(&daemon_pid);
+        if (!address) {
+            fputs("nfd_mock_portal: unable to start a private D-Bus session bus\n", stderr);
+            return 1;
+        }
+    }
+
+    DBusError err;
+    dbus_error_init(&err);
+    DBusConnection* conn = dbus_connection_open_private(address, &err);
+    if (conn && !dbus_bus_register(conn, &err)) {
+        dbus_connection_close(conn);
+        dbus_connection_unref(conn);
+        conn = NULL;
+    }
+    int exit_code = 1;
+    if (!conn) {
+        fprintf(stderr, "nfd_mock_portal: unable to connect to %s: %s\n", address, err.message);
+        dbus_error_free(&err);
+        goto cleanup_daemon;
+    }
+    dbus_connection_set_exit_on_disconnect(conn, FALSE);
+    if (!ClaimName(conn, PORTAL_BUS_NAME) ||
+        (!g_no_file_manager && !ClaimName(conn, FILE_MANAGER_NAME))) {
+        goto cleanup_conn;
+    }
+    dbus_connection_add_filter(conn, HandleMessage, NULL, NULL);
+
+    if (pipe(g_sigchld_pipe) != 0) goto cleanup_conn;
+    signal(SIGCHLD, OnSigchld);
+
+    pid_t child_pid = 0;
+    if (*command) {
+        child_pid = fork();
+        if (child_pid < 0) goto cleanup_conn;
+        if (child_pid == 0) {
+            setenv("DBUS_SESSION_BUS_ADDRESS", address, 1);
+            execvp(command[0], command);
+            fprintf(stderr, "nfd_mock_portal: unable to run %s: %s\n", command[0], strerror(errno));
+            _exit(127);
+        }
+    } else {
+        printf("%s\n", address);
+        fflush(stdout);
+    }
+
+    int conn_fd = -1;
+    dbus_connection_get_unix_fd(conn, &conn_fd);
+    while (1) {
+        while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS) {
+        }
+        EmitDueResponses(conn);
+
+        if (child_pid) {
+            int status;
+            const pid_t res = waitpid(child_pid, &status, WNOHANG);
+            if (res == child_pid) {
+                exit_code = ExitStatusOf(status);
+                break;
+            }
+        }
+
+        struct pollfd fds[2] = {{conn_fd, POLLIN, 0}, {g_sigchld_pipe[0], POLLIN, 0}};
+        const int res = poll(fds, 2, NextResponseTimeout());
+        if (res < 0 && errno != EINTR) break;
+        if (fds[1].revents & POLLIN) {
+            char buf[16];
+            if (read(g_sigchld_pipe[0], buf, sizeof(buf)) < 0) {
+                /* the pipe is only used to wake us up */
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!dbus_connection_read_write(conn, 0)) break;
+        }
+    }
+
+    while (g_pending) {
+        PendingResponse* next = g_pending->next;
+        FreePending(g_pending);
+        g_pending = next;
+    }
+
+cleanup_conn:
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+cleanup_daemon:
+    if (daemon_pid) {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+    }
+    free(address);
+    return exit_code;
+}
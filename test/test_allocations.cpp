@@ -0,0 +1,222 @@
+/*
+  Allocation-count tests for the portal backend.
+
+  The backend is compiled into this program with NFD_ALLOC_HOOKS, so that every NFDi_Malloc,
+  NFDi_Realloc and NFDi_Free can be counted.  Each check asserts the exact number of allocations
+  made by one operation on the calling thread, so that allocation-reduction work does not regress.
+  If you change the number of allocations on purpose, update the expected counts here.
+
+  The async dialog check needs a portal, so this program is run by nfd_mock_portal; without a
+  portal on the session bus, that check is skipped.
+*/
+
+#define NFD_ALLOC_HOOKS
+#include "../src/nfd_portal.cpp"
+
+struct AllocCounts {
+    long mallocs;
+    long reallocs;
+    long frees;
+};
+
+// per thread, so that the dispatcher thread does not disturb the counts of the calling thread
+thread_local AllocCounts g_counts;
+
+void NFDi_OnMalloc(size_t) {
+    ++g_counts.mallocs;
+}
+
+void NFDi_OnRealloc(void*, size_t) {
+    ++g_counts.reallocs;
+}
+
+void NFDi_OnFree(void* ptr) {
+    if (ptr) ++g_counts.frees;
+}
+
+namespace {
+
+int g_failures = 0;
+
+// Counts the allocations made on this thread while it is alive.
+class AllocScope {
+    const char* name;
+    AllocCounts start;
+
+   public:
+    explicit AllocScope(const char* name) : name(name), start(g_counts) {}
+
+    void expect(long mallocs, long reallocs, long frees) {
+        const long gotMallocs = g_counts.mallocs - start.mallocs;
+        const long gotReallocs = g_counts.reallocs - start.reallocs;
+        const long gotFrees = g_counts.frees - start.frees;
+        if (gotMallocs == mallocs && gotReallocs == reallocs && gotFrees == frees) {
+            printf("ok - %s\n", name);
+            return;
+        }
+        printf("FAIL - %s: expected %ld mallocs, %ld reallocs, %ld frees; got %ld, %ld, %ld\n",
+               name,
+               mallocs,
+               reallocs,
+               frees,
+               gotMallocs,
+               gotReallocs,
+               gotFrees);
+        ++g_failures;
+    }
+};
+
+// Builds a Response signal carrying `count` URIs, like the one the portal sends.
+DBusMessage* MakeResponse(size_t count) {
+    DBusMessage* msg = dbus_message_new_signal("/org/freedesktop/portal/desktop/request/1_1/test",
+                                               "org.freedesktop.portal.Request",
+                                               "Response");
+    DBusMessageIter iter, dict_iter, entry_iter, variant_iter, array_iter;
+    dbus_message_iter_init_append(msg, &iter);
+    const dbus_uint32_t code = 0;
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &code);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict_iter);
+    dbus_message_iter_open_container(&dict_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &entry_iter);
+    const char* key = "uris";
+    dbus_message_iter_append_basic(&entry_iter, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry_iter, DBUS_TYPE_VARIANT, "as", &variant_iter);
+    dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "s", &array_iter);
+    char uri[128];
+    for (size_t i = 0; i != count; ++i) {
+        snprintf(uri, sizeof(uri), "file:///home/user/My%%20Project/file-%04zu.txt", i);
+        const char* uri_ptr = uri;
+        dbus_message_iter_append_basic(&array_iter, DBUS_TYPE_STRING, &uri_ptr);
+    }
+    dbus_message_iter_close_container(&variant_iter, &array_iter);
+    dbus_message_iter_close_container(&entry_iter, &variant_iter);
+    dbus_message_iter_close_container(&dict_iter, &entry_iter);
+    dbus_message_iter_close_container(&iter, &dict_iter);
+    return msg;
+}
+
+DBusMessage* MakeOpenFileQuery() {
+    return dbus_message_new_method_call("org.freedesktop.portal.Desktop",
+                                        "/org/freedesktop/portal/desktop",
+                                        "org.freedesktop.portal.FileChooser",
+                                        "OpenFile");
+}
+
+void TestFilterMessage() {
+    const nfdnfilteritem_t filters[] = {{"Source code", "c,cpp,cc"}, {"Headers", "h,hpp"}};
+    {
+        DBusMessage* query = MakeOpenFileQuery();
+        AllocScope scope("build a query with 2 filters");
+        AppendOpenFileQueryParams<false, false>(query, "token", filters, 2);
+        scope.expect(0, 0, 0);
+        dbus_message_unref(query);
+    }
+    {
+        DBusMessage* query = MakeOpenFileQuery();
+        NfdDialogParams params{};
+        params.winFilter = "All\0*.*\0Text\0*.TXT\0C/C++ files\0*.c;*.cpp;*.cc\0\0";
+        params.filterIndex = 1;
+        AllocScope scope("build a query with 3 Windows-style filters");
+        AppendOpenFileQueryParams<false, false>(query, "token", &params);
+        scope.expect(0, 0, 0);
+        dbus_message_unref(query);
+    }
+}
+
+void TestSinglePathResponse() {
+    DBusMessage* msg = MakeResponse(1);
+    AllocScope scope("decode a single-path response");
+    const char* uri;
+    char* path = nullptr;
+    if (ReadResponseUrisSingle(msg, uri) != NFD_OKAY || AllocAndCopyFilePath(uri, path) != NFD_OKAY)
+        printf("FAIL - decode a single-path response: %s\n", NFD_GetError());
+    NFDi_Free(path);
+    scope.expect(1, 0, 1);
+    dbus_message_unref(msg);
+}
+
+void TestPathSet() {
+    const size_t count = 100;
+    DBusMessage* msg = MakeResponse(count);
+    {
+        AllocScope scope("enumerate a path set of 100 paths");
+        nfdpathsetenum_t enumerator;
+        NFD_PathSet_GetEnum(msg, &enumerator);
+        nfdnchar_t* path;
+        while (NFD_PathSet_EnumNextN(&enumerator, &path) == NFD_OKAY && path)
+            NFD_PathSet_FreePathN(path);
+        NFD_PathSet_FreeEnum(&enumerator);
+        scope.expect(count, 0, count);
+    }
+    {
+        AllocScope scope("index a path set of 100 paths");
+        for (nfdpathsetsize_t i = 0; i != count; ++i) {
+            nfdnchar_t* path;
+            NFD_PathSet_GetPathN(msg, i, &path);
+            NFD_PathSet_FreePathN(path);
+        }
+        scope.expect(count, 0, count);
+    }
+    {
+        AllocScope scope("copy 100 paths to a Windows-style path list");
+        char* pathList;
+        size_t pathListSize;
+        CopyPathListWin(msg, pathList, pathListSize);
+        NFDi_Free(pathList);
+        scope.expect(1, 3, 1);
+    }
+    dbus_message_unref(msg);
+}
+
+bool PortalAvailable() {
+    if (EnsureConnection() != NFD_OKAY) return false;
+    DBusError err;
+    dbus_error_init(&err);
+    const bool res = dbus_bus_name_has_owner(dbus_conn, "org.freedesktop.portal.Desktop", &err);
+    dbus_error_free(&err);
+    return res;
+}
+
+void TestAsyncDialog() {
+    if (NFD_Init() != NFD_OKAY || !PortalAvailable()) {
+        puts("skip - launch an async dialog: no portal on the session bus");
+        return;
+    }
+    void* handle = nullptr;
+    {
+        NfdDialogParams params{};
+        params.title = "Allocation test";
+        params.outAsyncOpHandle = &handle;
+        AllocScope scope("launch an async dialog");
+        if (NFD_OpenDialogWin(&params) != NFD_OKAY)
+            printf("FAIL - launch an async dialog: %s\n", NFD_GetError());
+        // the request path is allocated and freed, and the handle and the path of its route are kept
+        // (as is the state of the dispatcher thread, which the first dialog starts)
+        scope.expect(4, 0, 1);
+    }
+    if (handle) {
+        while (!NFD_HasAsyncOpCompleted(handle)) usleep(1000);
+        char* outPath = nullptr;
+        NfdDialogResponse response{};
+        response.outPath = &outPath;
+        AllocScope scope("collect the result of an async dialog");
+        if (NFD_GetAsyncOpResult(handle, &response) == NFD_OKAY) NFD_FreePathN(outPath);
+        NFD_FreeHandle(handle);
+        // the path was allocated by the dispatcher thread
+        scope.expect(0, 0, 2);
+    }
+    NFD_Quit();
+}
+
+}  // namespace
+
+int main() {
+    TestFilterMessage();
+    TestSinglePathResponse();
+    TestPathSet();
+    TestAsyncDialog();
+    if (g_failures) {
+        printf("%d allocation check(s) failed\n", g_failures);
+        return 1;
+    }
+    return 0;
+}
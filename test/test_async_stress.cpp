@@ -0,0 +1,252 @@
+/*
+  Concurrency stress test for async dialogs on the portal backend.
+
+  Many threads keep many async dialogs in flight against nfd_mock_portal (run with
+  NFD_MOCK_TITLE_SCRIPT set).  Every dialog scripts its own response code, latency and file name
+  through its title, so that each result can be checked against the dialog that asked for it:
+  results must not be lost, delivered to another handle, or delivered twice.  Some dialogs are
+  cancelled by the mock, some end with an error (which must be reported by NFD_GetError() on the
+  thread that collects the result), and some handles are freed while their dialog is still open.
+  Every dialog also has a completion callback, which races with collecting and freeing its handle.
+
+  Usage: test_async_stress [--threads N] [--dialogs N] [--in-flight N] [--seed N]
+
+  --threads N    number of threads launching dialogs (default: 8)
+  --dialogs N    number of dialogs launched by each thread (default: 100)
+  --in-flight N  maximum number of open dialogs per thread (default: 16)
+  --seed N       seed of the random choices (default: 1)
+
+  Prints the number of dialogs per second, and "FAIL" followed by a reason for every problem.
+  The test is also built with ThreadSanitizer as test_async_stress_tsan when the compiler
+  supports it.
+*/
+
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class DialogKind { Open, OpenMultiple, Save, PickFolder };
+
+struct Options {
+    int threads = 8;
+    int dialogs = 100;
+    int inFlight = 16;
+    unsigned seed = 1;
+};
+
+Options g_options;
+
+std::atomic<long> g_completed{0};
+std::atomic<long> g_abandoned{0};
+std::atomic<long> g_failures{0};
+std::atomic<long> g_callbacks{0};
+
+// how long a dialog may take before we count its result as lost
+constexpr auto LOST_AFTER = std::chrono::seconds(20);
+
+struct Dialog {
+    void* handle;
+    DialogKind kind;
+    unsigned responseCode;  // 0 = success, 1 = cancelled, 2 = ended with an error
+    char name[32];
+    std::chrono::steady_clock::time_point launched;
+};
+
+void Fail(const Dialog& dialog, const char* reason, const char* detail) {
+    printf("FAIL - dialog %s: %s%s%s\n",
+           dialog.name,
+           reason,
+           detail ? ": " : "",
+           detail ? detail : "");
+    ++g_failures;
+}
+
+// Runs on the dispatcher thread; the handle must still be alive, and its dialog completed.
+void OnComplete(void* opHandle, void*) {
+    if (!NFD_HasAsyncOpCompleted(opHandle)) {
+        printf("FAIL - a completion callback ran before its dialog completed\n");
+        ++g_failures;
+    }
+    ++g_callbacks;
+}
+
+bool Launch(Dialog& dialog, std::mt19937& rng) {
+    static const DialogKind kinds[] = {
+        DialogKind::Open, DialogKind::OpenMultiple, DialogKind::Save, DialogKind::PickFolder};
+    dialog.kind = kinds[rng() % 4];
+    const unsigned roll = rng() % 10;
+    dialog.responseCode = roll < 6 ? 0 : roll < 9 ? 1 : 2;
+    const unsigned latencyMs = rng() % 20;
+    char title[64];
+    snprintf(title, sizeof(title), "%u:%u:%s", dialog.responseCode, latencyMs, dialog.name);
+
+    NfdDialogParams params{};
+    params.title = title;
+    params.outAsyncOpHandle = &dialog.handle;
+    params.onAsyncOpComplete = OnComplete;
+    nfdresult_t res;
+    switch (dialog.kind) {
+        case DialogKind::Open:
+            res = NFD_OpenDialogWin(&params);
+            break;
+        case DialogKind::OpenMultiple:
+            res = NFD_OpenDialogMultipleWin(&params);
+            break;
+        case DialogKind::Save:
+            res = NFD_SaveDialogWin(&params);
+            break;
+        default:
+            res = NFD_PickFolderWin(&params);
+            break;
+    }
+    if (res != NFD_OKAY) {
+        Fail(dialog, "launch failed", NFD_GetError());
+        return false;
+    }
+    dialog.launched = std::chrono::steady_clock::now();
+    return true;
+}
+
+// Collects the result of a completed dialog and checks that it is the one the dialog asked for.
+void Collect(const Dialog& dialog) {
+    char* outPath = nullptr;
+    NfdDialogResponse response{};
+    response.outPath = &outPath;
+    NFD_ClearError();
+    const nfdresult_t res = NFD_GetAsyncOpResult(dialog.handle, &response);
+    NFD_FreeHandle(dialog.handle);
+    ++g_completed;
+    if (dialog.responseCode == 1) {
+        if (res == NFD_OKAY) {
+            Fail(dialog, "expected a cancel, got a path", outPath);
+            NFD_FreePath(outPath);
+        } else if (res != NFD_CANCEL) {
+            Fail(dialog, "expected a cancel, got an error", NFD_GetError());
+        }
+        return;
+    }
+    if (dialog.responseCode == 2) {
+        const char* error = NFD_GetError();
+        if (res == NFD_OKAY) {
+            Fail(dialog, "expected an error, got a path", outPath);
+            NFD_FreePath(outPath);
+        } else if (res != NFD_ERROR) {
+            Fail(dialog, "expected an error, got a cancel", nullptr);
+        } else if (!error || !strstr(error, "ended abruptly")) {
+            Fail(dialog, "the error was not reported on this thread", error);
+        }
+        return;
+    }
+    if (res != NFD_OKAY) {
+        Fail(dialog,
+             res == NFD_CANCEL ? "unexpected cancel" : "unexpected error",
+             res == NFD_CANCEL ? nullptr : NFD_GetError());
+        return;
+    }
+    char expected[64];
+    snprintf(expected, sizeof(expected), "/tmp/nfd-mock/%s", dialog.name);
+    // a multiple-selection list of one path holds just that path, followed by an extra null
+    if (strcmp(outPath, expected) != 0) {
+        Fail(dialog, "got the result of another dialog", outPath);
+    } else if (dialog.kind == DialogKind::OpenMultiple && outPath[strlen(outPath) + 1] != '\0') {
+        Fail(dialog, "the path list has more than one path", nullptr);
+    }
+    NFD_FreePath(outPath);
+}
+
+void RunThread(int threadIndex) {
+    std::mt19937 rng(g_options.seed * 7919 + threadIndex);
+    std::vector<Dialog> open;
+    int launched = 0;
+    while (launched != g_options.dialogs || !open.empty()) {
+        while (launched != g_options.dialogs &&
+               static_cast<int>(open.size()) < g_options.inFlight) {
+            Dialog dialog{};
+            snprintf(dialog.name, sizeof(dialog.name), "t%d-%d", threadIndex, launched++);
+            if (Launch(dialog, rng)) open.push_back(dialog);
+        }
+
+        // look at the open dialogs in a random order, so that they are collected out of order
+        bool progress = false;
+        for (size_t n = open.size(); n; --n) {
+            const size_t i = rng() % open.size();
+            Dialog& dialog = open[i];
+            if (rng() % 50 == 0) {
+                // give up on the dialog while it may still be open
+                NFD_FreeHandle(dialog.handle);
+                ++g_abandoned;
+            } else if (NFD_HasAsyncOpCompleted(dialog.handle)) {
+                Collect(dialog);
+            } else if (std::chrono::steady_clock::now() - dialog.launched > LOST_AFTER) {
+                Fail(dialog, "the result was lost", nullptr);
+                NFD_FreeHandle(dialog.handle);
+            } else {
+                continue;
+            }
+            open[i] = open.back();
+            open.pop_back();
+            progress = true;
+        }
+        if (!progress) usleep(500);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            g_options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dialogs") == 0 && i + 1 < argc) {
+            g_options.dialogs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--in-flight") == 0 && i + 1 < argc) {
+            g_options.inFlight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            g_options.seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--threads N] [--dialogs N] [--in-flight N] [--seed N]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (g_options.threads < 1 || g_options.dialogs < 0 || g_options.inFlight < 1) {
+        fputs("The numbers of threads and dialogs in flight must be positive\n", stderr);
+        return 2;
+    }
+
+    if (NFD_Init() != NFD_OKAY) {
+        printf("FAIL - NFD_Init: %s\n", NFD_GetError());
+        return 1;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i != g_options.threads; ++i) threads.emplace_back(RunThread, i);
+    for (std::thread& thread : threads) thread.join();
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    NFD_Quit();
+
+    const long total = static_cast<long>(g_options.threads) * g_options.dialogs;
+    printf("%ld dialogs on %d threads: %ld completed, %ld freed while open, %ld callbacks, "
+           "%ld failures\n",
+           total,
+           g_options.threads,
+           g_completed.load(),
+           g_abandoned.load(),
+           g_callbacks.load(),
+           g_failures.load());
+    printf("%.0f dialogs/sec\n", seconds > 0 ? total / seconds : 0.0);
+    return g_failures ? 1 : 0;
+}
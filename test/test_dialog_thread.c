@@ -0,0 +1,47 @@
+#include <nfd.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* a dialog on one thread must not hold up the other functions on another one */
+
+static double NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void* ShowDialog(void* arg) {
+    nfdchar_t* outPath;
+    nfdresult_t* result = (nfdresult_t*)arg;
+    *result = NFD_OpenDialog(&outPath, NULL, 0, NULL);
+    if (*result == NFD_OKAY) NFD_FreePath(outPath);
+    return NULL;
+}
+
+int main(void) {
+    NFD_Init();
+
+    nfdresult_t result = NFD_ERROR;
+    pthread_t thread;
+    pthread_create(&thread, NULL, ShowDialog, &result);
+    // the dialog is shown for NFD_MOCK_LATENCY_MS, which is much longer than this
+    usleep(200000);
+
+    const double start = NowMs();
+    NFD_SetDirectoryPrefetch(1000, 100);
+    NFD_Prewarm();
+    NFD_Quit();
+    const double elapsed = NowMs() - start;
+    printf("calls during the dialog: %s\n", elapsed < 500 ? "did not wait" : "waited");
+
+    pthread_join(thread, NULL);
+    if (result == NFD_OKAY) {
+        puts("dialog: Success!");
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    return 0;
+}
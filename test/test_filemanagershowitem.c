@@ -8,7 +8,7 @@
 
 /* this test should compile on all supported platforms */
 
-int main(void) {
+int main(int argc, char** argv) {
     // initialize NFD
     // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
     // or before/after every time you want to show a file dialog.
@@ -20,8 +20,11 @@ int main(void) {
 //        "/home/yuan/.wine/dosdevices/c:/users/yuan/Documents/WeChat Files/wxid_vonu0ww7zfoh11/FileStorage/File/2022-11/backtrace2.txt",
 //        "/home/yuan/Blah",
         NFD_FM_OPEN_FOLDER,
-        1
+        1,
+        0
     };
+    // allow the path to be given on the command line (used by the automated tests)
+    if (argc > 1) params.filePath = argv[1];
 
     // show the dialog
     nfdresult_t result = NFD_OpenFileManager(&params);
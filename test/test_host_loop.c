@@ -0,0 +1,108 @@
+#include <nfd.h>
+
+#include <dirent.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* this test only compiles on the portal backend, which is the only one with NFD_Dispatch */
+
+/* Counts the threads of this process. */
+static int CountThreads(void) {
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return -1;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int pending = 0;
+
+/* called inside NFD_Dispatch once an async dialog has completed */
+static void OnComplete(void* opHandle, void* userData) {
+    char* outPath;
+    NfdDialogResponse response = {0};
+    response.outPath = &outPath;
+    nfdresult_t result = NFD_GetAsyncOpResult(opHandle, &response);
+    if (result == NFD_OKAY) {
+        printf("%s: %s\n", (const char*)userData, outPath);
+        NFD_FreePath(outPath);
+    } else if (result == NFD_CANCEL) {
+        printf("%s: cancelled\n", (const char*)userData);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    NFD_FreeHandle(opHandle);
+    --pending;
+}
+
+static void Launch(const char* title, const char* name) {
+    void* handle;
+    NfdDialogParams params = {0};
+    params.title = title;
+    params.outAsyncOpHandle = &handle;
+    params.onAsyncOpComplete = OnComplete;
+    params.userData = (void*)name;
+    if (NFD_OpenDialogWin(&params) == NFD_OKAY) {
+        ++pending;
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+}
+
+int main(void) {
+    // initialize NFD
+    // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
+    // or before/after every time you want to show a file dialog.
+    NFD_Init();
+
+    // let this thread's loop drive the portal, instead of a library thread
+    int fds[NFD_POLL_DESCRIPTORS];
+    if (NFD_GetPollDescriptors(fds) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+
+    // with NFD_MOCK_TITLE_SCRIPT set, the mock portal answers these in the order first, second,
+    // third
+    Launch("0:60:third", "third");
+    Launch("0:20:first", "first");
+    Launch("0:40:second", "second");
+
+    // the host's event loop; its other descriptors would go into the same poll()
+    struct pollfd pollfds[NFD_POLL_DESCRIPTORS];
+    for (int i = 0; i != NFD_POLL_DESCRIPTORS; ++i) {
+        pollfds[i].fd = fds[i];
+        pollfds[i].events = POLLIN;
+    }
+    while (pending) {
+        if (poll(pollfds, NFD_POLL_DESCRIPTORS, 5000) <= 0) {
+            puts("Error: timed out waiting for the dialogs");
+            break;
+        }
+        if (NFD_Dispatch() != NFD_OKAY) {
+            printf("Error: %s\n", NFD_GetError());
+            break;
+        }
+    }
+
+    // a blocking dialog reads the connection itself
+    char* outPath;
+    if (NFD_OpenDialog(&outPath, NULL, 0, NULL) == NFD_OKAY) {
+        printf("blocking: %s\n", outPath);
+        NFD_FreePath(outPath);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+
+    printf("threads: %d\n", CountThreads());
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}
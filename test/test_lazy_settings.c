@@ -0,0 +1,45 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/* this test only compiles with NFD_RUNTIME_BACKEND, whose backends are modules */
+
+/* Returns whether a backend module (libnfd_<name>.so) is loaded into this process. */
+static int ModuleLoaded(void) {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (!maps) return -1;
+    char line[4096];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), maps)) {
+        found = strstr(line, "/libnfd_") != NULL;
+    }
+    fclose(maps);
+    return found;
+}
+
+int main(void) {
+    NFD_Init();
+
+    // settings made before the first dialog do not choose (and load) the backend
+    NFD_SetTimeout(200);
+    NFD_SetDirectoryPrefetch(1000, 100);
+    NFD_ResetStats();
+    printf("loaded after settings: %s\n", ModuleLoaded() ? "yes" : "no");
+
+    // but the first dialog gets them
+    nfdchar_t* outPath;
+    nfdresult_t result = NFD_OpenDialog(&outPath, NULL, 0, NULL);
+    if (result == NFD_TIMEOUT) {
+        puts("dialog: timed out");
+    } else if (result == NFD_OKAY) {
+        printf("Error: the dialog returned %s without timing out\n", outPath);
+        NFD_FreePath(outPath);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    printf("loaded after dialog: %s\n", ModuleLoaded() ? "yes" : "no");
+
+    NFD_Quit();
+    return 0;
+}
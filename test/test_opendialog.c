@@ -5,7 +5,7 @@
 
 /* this test should compile on all supported platforms */
 
-int main(void) {
+int main(int argc, char** argv) {
     // initialize NFD
     // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
     // or before/after every time you want to show a file dialog.
@@ -16,8 +16,11 @@ int main(void) {
     // prepare filters for the dialog
     nfdfilteritem_t filterItem[2] = {{"Source code", "c,cpp,cc"}, {"Headers", "h,hpp"}};
 
+    // allow the default path to be given on the command line (used by the automated tests)
+    const nfdchar_t* defaultPath = argc > 1 ? argv[1] : NULL;
+
     // show the dialog
-    nfdresult_t result = NFD_OpenDialog(&outPath, filterItem, 2, NULL);
+    nfdresult_t result = NFD_OpenDialog(&outPath, filterItem, 2, defaultPath);
     if (result == NFD_OKAY) {
         puts("Success!");
         puts(outPath);
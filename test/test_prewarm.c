@@ -0,0 +1,49 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* this test only compiles on the portal backend, which is the only one with NFD_Prewarm */
+
+int main(void) {
+    // initialize NFD; on the portal backend, this does not connect to the session bus yet
+    NFD_Init();
+
+    // connect and start the portal in the background, e.g. while the application starts up
+    if (NFD_Prewarm() != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    // ... the rest of the start-up would go here
+    usleep(300000);
+    // (the prewarm test checks that nfd_mock_portal was asked for the portal's version before this)
+    puts("start-up done");
+    fflush(stdout);
+
+    char* outPath;
+    NfdDialogParams params = {0};
+    params.outPath = &outPath;
+    params.title = "this dialog uses a prewarmed connection";
+
+    nfdresult_t result = NFD_OpenDialogWin(&params);
+    if (result == NFD_OKAY) {
+        puts("Success!");
+        puts(outPath);
+        NFD_FreePath(outPath);
+        NfdDialogTimings timings;
+        if (NFD_GetLastTimings(&timings) == NFD_OKAY) {
+            printf("connection ready after %.3f ms\n",
+                   (double)(timings.connectionReady - timings.start) / 1e6);
+        }
+    } else if (result == NFD_CANCEL) {
+        puts("User pressed cancel.");
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}
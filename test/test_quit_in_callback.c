@@ -0,0 +1,151 @@
+#include <nfd.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* this test only compiles on the portal backend, which is the only one with onAsyncOpComplete */
+
+/* Counts the threads of this process. */
+static int CountThreads(void) {
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return -1;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+/* Returns the CPU time that this process has used, in milliseconds. */
+static long CpuTimeMs(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+typedef enum {
+    QUIT,        /* call NFD_Quit, like an application that calls NFD_Init/NFD_Quit per dialog */
+    QUIT_INIT,   /* call NFD_Quit, then NFD_Init again */
+    INIT_QUIT    /* call NFD_Init and NFD_Quit, while another thread is in the last NFD_Quit */
+} Action;
+
+typedef struct {
+    const char* name;
+    Action action;
+} Dialog;
+
+static int completed = 0;
+
+/* called once an async dialog has completed, on the dispatcher thread (or, for a dialog that is
+ * still open at the last NFD_Quit, on the thread calling it) */
+static void OnComplete(void* opHandle, void* userData) {
+    const Dialog* dialog = (const Dialog*)userData;
+    char* outPath;
+    NfdDialogResponse response = {0};
+    response.outPath = &outPath;
+    nfdresult_t result = NFD_GetAsyncOpResult(opHandle, &response);
+    if (result == NFD_OKAY) {
+        printf("%s: %s\n", dialog->name, outPath);
+        NFD_FreePath(outPath);
+    } else if (result == NFD_CANCEL) {
+        printf("%s: cancelled\n", dialog->name);
+    } else if (dialog->action == INIT_QUIT) {
+        printf("%s: ended\n", dialog->name);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    NFD_FreeHandle(opHandle);
+
+    switch (dialog->action) {
+        case QUIT:
+            NFD_Quit();
+            break;
+        case QUIT_INIT:
+            NFD_Quit();
+            NFD_Init();
+            break;
+        case INIT_QUIT:
+            NFD_Init();
+            NFD_Quit();
+            break;
+    }
+    __atomic_add_fetch(&completed, 1, __ATOMIC_RELEASE);
+}
+
+/* shows `dialog` with `title`, which scripts the mock portal's response (see
+ * NFD_MOCK_TITLE_SCRIPT) */
+static int Launch(const Dialog* dialog, const char* title) {
+    void* handle;
+    NfdDialogParams params = {0};
+    params.title = title;
+    params.outAsyncOpHandle = &handle;
+    params.onAsyncOpComplete = OnComplete;
+    params.userData = (void*)dialog;
+    if (NFD_OpenDialogWin(&params) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 0;
+    }
+    return 1;
+}
+
+static void WaitForCompleted(int count) {
+    while (__atomic_load_n(&completed, __ATOMIC_ACQUIRE) < count) usleep(1000);
+}
+
+int main(void) {
+    static const Dialog first = {"first", QUIT};
+    static const Dialog second = {"second", QUIT};
+    static const Dialog third = {"third", QUIT};
+    static const Dialog reinit = {"reinit", QUIT_INIT};
+    static const Dialog open = {"open at quit", INIT_QUIT};
+
+    // one NFD_Init per dialog, and the last NFD_Quit in its callback
+    int expected = 0;
+    NFD_Init();
+    expected += Launch(&first, "0:0:first");
+    WaitForCompleted(expected);
+    NFD_Init();
+    expected += Launch(&second, "0:0:second");
+    WaitForCompleted(expected);
+    NFD_Init();
+    expected += Launch(&third, "0:0:third");
+    WaitForCompleted(expected);
+
+    // the callback initializes NFD again, for the blocking dialog below
+    NFD_Init();
+    expected += Launch(&reinit, "0:0:reinit");
+    WaitForCompleted(expected);
+    nfdchar_t* outPath;
+    if (NFD_OpenDialog(&outPath, NULL, 0, NULL) == NFD_OKAY) {
+        printf("blocking: %s\n", outPath);
+        NFD_FreePath(outPath);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+
+    // a dialog that is still open when the last NFD_Quit ends it, whose callback (run by that
+    // NFD_Quit) uses NFD_Init and NFD_Quit
+    expected += Launch(&open, "0:60000:never");
+    NFD_Quit();
+    WaitForCompleted(expected);
+
+    // every dispatcher thread has exited, and none of them spins
+    usleep(100 * 1000);
+    printf("threads: %d\n", CountThreads());
+    const long cpuBefore = CpuTimeMs();
+    usleep(500 * 1000);
+    const long cpuIdle = CpuTimeMs() - cpuBefore;
+    if (cpuIdle < 100) {
+        puts("idle cpu: ok");
+    } else {
+        printf("Error: %ld ms of CPU time while idle\n", cpuIdle);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <nfd.h>
+
+#include <dbus/dbus.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* this test only compiles on the portal backend, which is the only one with
+ * NFD_InitWithConnection */
+
+/* Counts the connections to the bus (their unique names start with ':'). */
+static int CountBusClients(DBusConnection* conn) {
+    DBusMessage* query = dbus_message_new_method_call(
+        DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "ListNames");
+    DBusMessage* reply = dbus_connection_send_with_reply_and_block(conn, query, -1, NULL);
+    dbus_message_unref(query);
+    if (!reply) return -1;
+    char** names;
+    int count;
+    int clients = 0;
+    if (dbus_message_get_args(reply,
+                              NULL,
+                              DBUS_TYPE_ARRAY,
+                              DBUS_TYPE_STRING,
+                              &names,
+                              &count,
+                              DBUS_TYPE_INVALID)) {
+        for (int i = 0; i != count; ++i) {
+            if (names[i][0] == ':') ++clients;
+        }
+        dbus_free_string_array(names);
+    }
+    dbus_message_unref(reply);
+    return clients;
+}
+
+static int completed = 0;
+
+/* called while the application dispatches its connection */
+static void OnComplete(void* opHandle, void* userData) {
+    (void)userData;
+    char* outPath;
+    NfdDialogResponse response = {0};
+    response.outPath = &outPath;
+    if (NFD_GetAsyncOpResult(opHandle, &response) == NFD_OKAY) {
+        printf("async: %s\n", outPath);
+        NFD_FreePath(outPath);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    NFD_FreeHandle(opHandle);
+    completed = 1;
+}
+
+int main(void) {
+    // the connection that the application already has, e.g. for notifications
+    DBusError err;
+    dbus_error_init(&err);
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (!conn) {
+        printf("Error: %s\n", err.message);
+        dbus_error_free(&err);
+        return 1;
+    }
+
+    // initialize NFD on that connection, instead of having it open one of its own
+    if (NFD_InitWithConnection(conn) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+
+    // a blocking dialog dispatches the connection itself while it waits
+    char* outPath;
+    if (NFD_OpenDialog(&outPath, NULL, 0, NULL) == NFD_OKAY) {
+        printf("blocking: %s\n", outPath);
+        NFD_FreePath(outPath);
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+
+    // an async dialog completes while the application's main loop dispatches the connection
+    void* handle;
+    NfdDialogParams params = {0};
+    params.outAsyncOpHandle = &handle;
+    params.onAsyncOpComplete = OnComplete;
+    if (NFD_OpenDialogWin(&params) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    for (int i = 0; !completed && i != 50; ++i) dbus_connection_read_write_dispatch(conn, 100);
+    if (!completed) puts("Error: the async dialog did not complete");
+
+    // the mock portal and this program
+    printf("bus clients: %d\n", CountBusClients(conn));
+
+    // Quit NFD; the connection is still ours to use
+    NFD_Quit();
+    printf("still connected: %s\n", dbus_connection_get_is_connected(conn) ? "yes" : "no");
+    dbus_connection_unref(conn);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* this test only compiles on the portal backend, which is the only one that keeps statistics */
+
+static void ShowDialog(nfdresult_t (*dialog)(NfdDialogParams*)) {
+    char* outPath;
+    NfdDialogParams params = {0};
+    params.outPath = &outPath;
+    params.title = "this is a counted dialog";
+    nfdresult_t result = dialog(&params);
+    if (result == NFD_OKAY) {
+        NFD_FreePath(outPath);
+    } else if (result == NFD_ERROR) {
+        printf("Error: %s\n", NFD_GetError());
+    }
+}
+
+int main(void) {
+    // initialize NFD
+    // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
+    // or before/after every time you want to show a file dialog.
+    NFD_Init();
+
+    NFD_ResetStats();
+    ShowDialog(NFD_OpenDialogWin);
+    ShowDialog(NFD_OpenDialogMultipleWin);
+    ShowDialog(NFD_SaveDialogWin);
+
+    NfdStats stats;
+    if (NFD_GetStats(&stats) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    printf("openDialogs = %llu\n", (unsigned long long)stats.openDialogs);
+    printf("openMultipleDialogs = %llu\n", (unsigned long long)stats.openMultipleDialogs);
+    printf("saveDialogs = %llu\n", (unsigned long long)stats.saveDialogs);
+    printf("pickFolderDialogs = %llu\n", (unsigned long long)stats.pickFolderDialogs);
+    printf("cancels = %llu\n", (unsigned long long)stats.cancels);
+    printf("dbusErrors = %llu\n", (unsigned long long)stats.dbusErrors);
+    printf("responseErrors = %llu\n", (unsigned long long)stats.responseErrors);
+    printf("otherErrors = %llu\n", (unsigned long long)stats.otherErrors);
+    printf("timeouts = %llu\n", (unsigned long long)stats.timeouts);
+    printf("uriBytesDecoded = %llu\n", (unsigned long long)stats.uriBytesDecoded);
+    printf("pathsReturned = %llu\n", (unsigned long long)stats.pathsReturned);
+    printf("allocations = %llu\n", (unsigned long long)stats.allocations);
+    unsigned long long latencySamples = 0;
+    for (int i = 0; i != NFD_STATS_LATENCY_BUCKETS; ++i) {
+        latencySamples += stats.latencyHistogram[i];
+    }
+    printf("latency samples = %llu\n", latencySamples);
+
+    // after a reset, every counter must be zero
+    NFD_ResetStats();
+    NFD_GetStats(&stats);
+    const uint64_t* counters = (const uint64_t*)&stats;
+    for (size_t i = 0; i != sizeof(stats) / sizeof(uint64_t); ++i) {
+        if (counters[i] != 0) {
+            puts("Error: NFD_ResetStats did not reset all the counters");
+            return 1;
+        }
+    }
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}
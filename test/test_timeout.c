@@ -0,0 +1,79 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* this test only compiles on the portal backend, which is the only one with NFD_SetTimeout */
+
+/* how much later than its timeout a call may return before the test fails */
+#define SLACK_MS 1000
+
+static long NowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void PrintResult(const char* what, nfdresult_t result, long startMs, int timeoutMs) {
+    if (result == NFD_OKAY) {
+        printf("%s: ok\n", what);
+    } else if (result == NFD_CANCEL) {
+        printf("%s: cancelled\n", what);
+    } else if (result == NFD_TIMEOUT) {
+        printf("%s: timed out (%s)\n", what, NFD_GetError());
+    } else {
+        printf("Error: %s\n", NFD_GetError());
+    }
+    const long elapsedMs = NowMs() - startMs;
+    if (elapsedMs > timeoutMs + SLACK_MS) {
+        printf("Error: %s returned after %ld ms\n", what, elapsedMs);
+    }
+}
+
+static void PrintPath(nfdresult_t result, nfdchar_t* outPath) {
+    if (result == NFD_OKAY) {
+        puts(outPath);
+        NFD_FreePath(outPath);
+    }
+}
+
+int main(int argc, char** argv) {
+    // initialize NFD
+    // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
+    // or before/after every time you want to show a file dialog.
+    NFD_Init();
+
+    // give up on a dialog after this many milliseconds (given on the command line by the
+    // automated tests), instead of hanging if the portal does
+    const int timeoutMs = argc > 1 ? atoi(argv[1]) : 5000;
+    NFD_SetTimeout(timeoutMs);
+
+    nfdchar_t* outPath;
+    long start = NowMs();
+    nfdresult_t result = NFD_OpenDialog(&outPath, NULL, 0, NULL);
+    PrintResult("open", result, start, timeoutMs);
+    PrintPath(result, outPath);
+
+    // the timeout also covers asking the portal whether it supports a default path ...
+    start = NowMs();
+    result = NFD_OpenDialog(&outPath, NULL, 0, "/tmp");
+    PrintResult("open in /tmp", result, start, timeoutMs);
+    PrintPath(result, outPath);
+
+    // ... and folders
+    start = NowMs();
+    result = NFD_PickFolder(&outPath, NULL);
+    PrintResult("pick folder", result, start, timeoutMs);
+    PrintPath(result, outPath);
+
+    // a call can also set its own timeout
+    NfdFileManagerParams params = {"/tmp", NFD_FM_OPEN_FOLDER, 0, timeoutMs};
+    start = NowMs();
+    PrintResult("file manager", NFD_OpenFileManager(&params), start, timeoutMs);
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <nfd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* this test only compiles on the portal backend, which is the only one that records timings */
+
+static int PrintTimings(const char* what, const NfdDialogTimings* timings) {
+    const uint64_t phases[] = {timings->start,
+                               timings->connectionReady,
+                               timings->matchRuleAdded,
+                               timings->queryBuilt,
+                               timings->methodReplied,
+                               timings->responseReceived,
+                               timings->resultDecoded,
+                               timings->resultDelivered};
+    const char* names[] = {"start",
+                           "connection ready",
+                           "match rule added",
+                           "query built",
+                           "method replied",
+                           "response received",
+                           "result decoded",
+                           "result delivered"};
+    printf("%s:\n", what);
+    for (size_t i = 0; i != sizeof(phases) / sizeof(phases[0]); ++i) {
+        if (phases[i] < phases[i ? i - 1 : 0]) {
+            printf("Error: phase '%s' was recorded before the previous phase\n", names[i]);
+            return 0;
+        }
+        printf("  %-18s +%.3f ms\n", names[i], (double)(phases[i] - timings->start) / 1e6);
+    }
+    return 1;
+}
+
+int main(void) {
+    // initialize NFD
+    // either call NFD_Init at the start of your program and NFD_Quit at the end of your program,
+    // or before/after every time you want to show a file dialog.
+    NFD_Init();
+
+    NfdDialogTimings timings;
+    if (NFD_GetLastTimings(&timings) == NFD_OKAY) {
+        puts("Error: there are timings before any dialog was shown");
+        return 1;
+    }
+
+    char* outPath;
+    NfdDialogParams params = {0};
+    params.outPath = &outPath;
+    params.title = "this is a timed dialog";
+
+    // a synchronous dialog
+    nfdresult_t result = NFD_OpenDialogWin(&params);
+    if (result != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    NFD_FreePath(outPath);
+    if (NFD_GetLastTimings(&timings) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    if (!PrintTimings("sync dialog", &timings)) return 1;
+
+    // an async dialog
+    void* asyncOpHandle;
+    params.outPath = NULL;
+    params.outAsyncOpHandle = &asyncOpHandle;
+    result = NFD_OpenDialogWin(&params);
+    if (result != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    while (!NFD_HasAsyncOpCompleted(asyncOpHandle)) {
+        usleep(1000);
+    }
+    NfdDialogResponse response = {.outPath = &outPath};
+    if (NFD_GetAsyncOpResult(asyncOpHandle, &response) != NFD_OKAY) {
+        printf("Error: %s\n", NFD_GetError());
+        return 1;
+    }
+    NFD_FreePath(outPath);
+    NFD_GetAsyncOpTimings(asyncOpHandle, &timings);
+    NFD_FreeHandle(asyncOpHandle);
+    if (!PrintTimings("async dialog", &timings)) return 1;
+
+    // Quit NFD
+    NFD_Quit();
+
+    return 0;
+}